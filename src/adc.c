@@ -0,0 +1,171 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef BCM2835LIB
+#include <bcm2835.h>
+#endif
+
+#ifdef WIRINGPI
+#include <wiringPiSPI.h>
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include "adc.h"
+
+/* Available backends. The first one is the default. */
+static const struct adc_backend *backends[] = {
+#if defined(BCM2835LIB) || defined(WIRINGPI)
+     &adc_spi_backend,
+#endif
+     &adc_spidev_backend,
+     &adc_replay_backend,
+     &adc_replay_fast_backend,
+     NULL
+};
+
+int adc_open(struct adc *adc, const char *spec,
+	     const struct mcp320x_input *inputs, const uint8_t *spi_channels,
+	     unsigned int count, int spi_frequency)
+{
+     if (count > MCP320X_MAX_SCAN) {
+	  errno = EINVAL;
+	  return -1;
+     }
+     memcpy(adc->inputs, inputs, count*sizeof(*inputs));
+     memcpy(adc->spi_channels, spi_channels, count);
+     adc->input_count = count;
+     adc->spi_frequency = spi_frequency;
+     adc->paced = false;
+     adc->state = NULL;
+
+     /* Split "NAME:ARG" */
+     const char *arg = NULL;
+     size_t name_length;
+     if (spec == NULL) {
+	  spec = backends[0]->name;
+	  name_length = strlen(spec);
+     } else {
+	  const char *colon = strchr(spec, ':');
+	  name_length = (colon != NULL ? colon-spec : strlen(spec));
+	  if (colon != NULL)
+	       arg = colon+1;
+     }
+
+     adc->backend = NULL;
+     for (unsigned int i = 0; backends[i] != NULL; i++) {
+	  if (strlen(backends[i]->name) == name_length &&
+	      strncmp(backends[i]->name, spec, name_length) == 0)
+	       adc->backend = backends[i];
+     }
+     if (adc->backend == NULL) {
+	  errno = EINVAL;
+	  return -1;
+     }
+
+     return adc->backend->open(adc, arg);
+}
+
+void adc_close(struct adc *adc)
+{
+     adc->backend->close(adc);
+}
+
+#if defined(BCM2835LIB) || defined(WIRINGPI)
+
+/* Backend sampling the MCP320x with the SPI library chosen in the
+   Makefile (see get_samples()) */
+
+static int spi_open(struct adc *adc, const char *arg)
+{
+#ifdef WIRINGPI
+     for (int cs = 0; cs < 2; cs++) {
+	  bool used = false;
+	  for (unsigned int i = 0; i < adc->input_count; i++) {
+	       if (adc->spi_channels[i] == cs)
+		    used = true;
+	  }
+	  if (used && wiringPiSPISetup(cs, adc->spi_frequency) < 0)
+	       return -1;
+     }
+#endif
+
+#ifdef BCM2835LIB
+     if (!bcm2835_init()) {
+	  errno = EIO;
+	  return -1;
+     }
+     bcm2835_spi_begin();
+
+     /* The chip select is switched with every transaction to an ADC on
+	another SPI channel (see sample()). */
+     if (adc->input_count > 0 && adc->spi_channels[0] == 1)
+	  bcm2835_spi_chipSelect(BCM2835_SPI_CS1);
+     else
+	  bcm2835_spi_chipSelect(BCM2835_SPI_CS0);
+
+     // Set divider according to requested spi frequency
+     uint16_t divider = (uint16_t) ((double) 250000000/adc->spi_frequency +
+				    0.5);
+     bcm2835_spi_setClockDivider(divider);
+
+     // SPI 0,0 as per MCP3208 data sheet
+     bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);
+
+     bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);
+
+     bcm2835_spi_setChipSelectPolarity(BCM2835_SPI_CS0, LOW);
+     bcm2835_spi_setChipSelectPolarity(BCM2835_SPI_CS1, LOW);
+#endif
+
+     return 0;
+}
+
+static int spi_scan(struct adc *adc, const unsigned int *indices,
+		    unsigned int count, uint16_t *values)
+{
+     struct mcp320x_input inputs[MCP320X_MAX_SCAN];
+     uint8_t spi_channels[MCP320X_MAX_SCAN];
+     for (unsigned int k = 0; k < count; k++) {
+	  inputs[k] = adc->inputs[indices[k]];
+	  spi_channels[k] = adc->spi_channels[indices[k]];
+     }
+
+     return get_samples(inputs, spi_channels, count, values);
+}
+
+static void spi_close(struct adc *adc)
+{
+#ifdef BCM2835LIB
+     bcm2835_spi_end();
+     bcm2835_close();
+#endif
+}
+
+const struct adc_backend adc_spi_backend = {
+#ifdef BCM2835LIB
+     .name = "bcm2835",
+#else
+     .name = "wiringpi",
+#endif
+     .open = spi_open,
+     .scan = spi_scan,
+     .close = spi_close
+};
+
+#endif
@@ -0,0 +1,130 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ADC_H
+#define ADC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mcp320x.h"
+
+/* Return value of adc_scan() if a source has no more samples */
+#define ADC_END 1
+
+struct adc;
+
+/**
+ * A source of samples of the inputs of a scan list.
+ */
+struct adc_backend {
+     /* Name used to select the backend */
+     const char *name;
+
+     /**
+      * Open the source.
+      *
+      * @param adc the ADC with the scan list set
+      * @param arg backend argument following "NAME:" (NULL if none)
+      * @return 0 on success; -1 on error (errno is set)
+      */
+     int (*open)(struct adc *adc, const char *arg);
+
+     /**
+      * Sample inputs of the scan list.
+      *
+      * @param adc the ADC
+      * @param indices indices into the scan list of the inputs to be
+      * sampled, in this order
+      * @param count number of inputs
+      * @param values 12 bit sample value of each input
+      * @return 0 on success; -1 on error; ADC_END at the end of the source
+      */
+     int (*scan)(struct adc *adc, const unsigned int *indices,
+		 unsigned int count, uint16_t *values);
+
+     /**
+      * Close the source.
+      *
+      * @param adc the ADC
+      */
+     void (*close)(struct adc *adc);
+};
+
+/**
+ * An ADC sampled through one of the backends.
+ */
+struct adc {
+     const struct adc_backend *backend;
+     /* Scan list: inputs and SPI channel of the ADC of each input */
+     struct mcp320x_input inputs[MCP320X_MAX_SCAN];
+     uint8_t spi_channels[MCP320X_MAX_SCAN];
+     unsigned int input_count;
+     int spi_frequency;
+     /* Set by backends that pace scans themselves. Then, the caller must
+	not sleep between scans. */
+     bool paced;
+     /* Backend specific state */
+     void *state;
+};
+
+/* Backends sampling the MCP320x through SPI, and replaying log files */
+extern const struct adc_backend adc_spi_backend;
+extern const struct adc_backend adc_spidev_backend;
+extern const struct adc_backend adc_replay_backend;
+extern const struct adc_backend adc_replay_fast_backend;
+
+/**
+ * Open an ADC.
+ *
+ * @param adc the ADC
+ * @param spec backend specification "NAME" or "NAME:ARG"
+ * @param inputs the scan list
+ * @param spi_channels SPI channel of the ADC of each input
+ * @param count length of the scan list
+ * @param spi_frequency SPI clock rate in Hz
+ * @return 0 on success; -1 on error (errno is set, EINVAL for an unknown
+ * backend)
+ */
+int adc_open(struct adc *adc, const char *spec,
+	     const struct mcp320x_input *inputs, const uint8_t *spi_channels,
+	     unsigned int count, int spi_frequency);
+
+/**
+ * Sample inputs of the scan list.
+ *
+ * @param adc the ADC
+ * @param indices indices into the scan list of the inputs to be sampled,
+ * in this order
+ * @param count number of inputs
+ * @param values 12 bit sample value of each input
+ * @return 0 on success; -1 on error; ADC_END at the end of the source
+ */
+static inline int adc_scan(struct adc *adc, const unsigned int *indices,
+			   unsigned int count, uint16_t *values)
+{
+     return adc->backend->scan(adc, indices, count, values);
+}
+
+/**
+ * Close an ADC.
+ *
+ * @param adc the ADC
+ */
+void adc_close(struct adc *adc);
+
+#endif
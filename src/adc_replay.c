@@ -0,0 +1,224 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Backends replaying a CSV log of raw samples (e.g., calibration/hall/
+   log-*.dat) instead of sampling an ADC, so the sampling, ring, and logging
+   pipeline can be run on any Linux machine. Each scan returns the next
+   line of the log; input i of the scan list gets the value of column i+1.
+   Empty values (inputs not sampled in a line) repeat the previous value.
+   Comment lines (e.g., gap markers) are skipped.
+
+   "replay" returns each line at its original time relative to the first
+   line; "replay-fast" returns lines as fast as possible. The whole log is
+   loaded when the backend is opened, so scans do no I/O. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "adc.h"
+
+/* Maximum length of a line of the log */
+#define REPLAY_MAX_LINE 512
+
+struct replay_state {
+     bool fast;
+     uint64_t row_count;
+     unsigned int column_count;
+     uint64_t *timestamps;
+     uint16_t *values;
+     uint64_t next_row;
+     /* Time of the first scan */
+     uint64_t tstart;
+};
+
+/**
+ * Parse a line of the log.
+ *
+ * @param line the line
+ * @param timestamp timestamp of the line
+ * @param values values of the line
+ * @param previous values of the previous line (NULL for the first line)
+ * @return number of values; -1 if the line is invalid
+ */
+static int parse_line(const char *line, uint64_t *timestamp,
+		      uint16_t *values, const uint16_t *previous)
+{
+     char *end;
+     *timestamp = strtoull(line, &end, 10);
+     if (end == line)
+	  return -1;
+
+     int n = 0;
+     while (*end == ',') {
+	  if (n == MCP320X_MAX_SCAN)
+	       return -1;
+	  const char *s = end+1;
+	  unsigned long value = strtoul(s, &end, 10);
+	  if (end == s)
+	       value = (previous != NULL ? previous[n] : 0);
+	  else if (value > 0x0fff)
+	       return -1;
+	  values[n++] = value;
+     }
+     if (*end != '\n' && *end != '\r' && *end != '\0')
+	  return -1;
+
+     return n;
+}
+
+/**
+ * Load the log to be replayed.
+ *
+ * @param adc the ADC
+ * @param path path of the log
+ * @param fast true to replay as fast as possible
+ * @return 0 on success; -1 on error (errno is set)
+ */
+static int replay_open_log(struct adc *adc, const char *path, bool fast)
+{
+     if (path == NULL) {
+	  errno = EINVAL;
+	  return -1;
+     }
+
+     FILE *f = fopen(path, "r");
+     if (f == NULL)
+	  return -1;
+
+     struct replay_state *state = calloc(1, sizeof(*state));
+     if (state == NULL) {
+	  fclose(f);
+	  return -1;
+     }
+     state->fast = fast;
+     adc->state = state;
+     adc->paced = true;
+
+     uint64_t capacity = 0;
+     char line[REPLAY_MAX_LINE];
+     while (fgets(line, sizeof(line), f) != NULL) {
+	  if (line[0] == '#')
+	       continue;
+	  if (state->row_count == capacity) {
+	       capacity = (capacity == 0 ? 4096 : 2*capacity);
+	       uint64_t *timestamps = realloc(state->timestamps,
+					      capacity*sizeof(uint64_t));
+	       if (timestamps != NULL)
+		    state->timestamps = timestamps;
+	       uint16_t *values = realloc(state->values,
+					  capacity*MCP320X_MAX_SCAN*
+					  sizeof(uint16_t));
+	       if (values != NULL)
+		    state->values = values;
+	       if (timestamps == NULL || values == NULL) {
+		    fclose(f);
+		    adc->backend->close(adc);
+		    return -1;
+	       }
+	  }
+
+	  uint64_t row = state->row_count;
+	  uint16_t *values = &state->values[row*MCP320X_MAX_SCAN];
+	  int n = parse_line(line, &state->timestamps[row], values,
+			     row > 0 ? values-MCP320X_MAX_SCAN : NULL);
+	  if (n < (int) adc->input_count ||
+	      (row > 0 && n != (int) state->column_count)) {
+	       fclose(f);
+	       adc->backend->close(adc);
+	       errno = EINVAL;
+	       return -1;
+	  }
+	  state->column_count = n;
+	  state->row_count++;
+     }
+     fclose(f);
+
+     if (state->row_count == 0) {
+	  adc->backend->close(adc);
+	  errno = EINVAL;
+	  return -1;
+     }
+
+     return 0;
+}
+
+static int replay_open(struct adc *adc, const char *arg)
+{
+     return replay_open_log(adc, arg, false);
+}
+
+static int replay_fast_open(struct adc *adc, const char *arg)
+{
+     return replay_open_log(adc, arg, true);
+}
+
+static int replay_scan(struct adc *adc, const unsigned int *indices,
+		       unsigned int count, uint16_t *values)
+{
+     struct replay_state *state = adc->state;
+     if (state->next_row == state->row_count)
+	  return ADC_END;
+
+     uint64_t row = state->next_row++;
+     if (!state->fast) {
+	  struct timespec t;
+	  if (row == 0) {
+	       clock_gettime(CLOCK_MONOTONIC, &t);
+	       state->tstart = 1000000000ull*t.tv_sec + t.tv_nsec;
+	  }
+	  uint64_t tdue = state->tstart +
+	       (state->timestamps[row]-state->timestamps[0]);
+	  t.tv_sec = tdue/1000000000ull;
+	  t.tv_nsec = tdue%1000000000ull;
+	  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+     }
+
+     const uint16_t *row_values = &state->values[row*MCP320X_MAX_SCAN];
+     for (unsigned int k = 0; k < count; k++)
+	  values[k] = row_values[indices[k]];
+
+     return 0;
+}
+
+static void replay_close(struct adc *adc)
+{
+     struct replay_state *state = adc->state;
+     if (state == NULL)
+	  return;
+
+     free(state->timestamps);
+     free(state->values);
+     free(state);
+     adc->state = NULL;
+}
+
+const struct adc_backend adc_replay_backend = {
+     .name = "replay",
+     .open = replay_open,
+     .scan = replay_scan,
+     .close = replay_close
+};
+
+const struct adc_backend adc_replay_fast_backend = {
+     .name = "replay-fast",
+     .open = replay_fast_open,
+     .scan = replay_scan,
+     .close = replay_close
+};
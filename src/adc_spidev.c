@@ -0,0 +1,146 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Backend sampling the MCP320x through the Linux spidev driver. The
+   conversions of a scan are chained into one SPI_IOC_MESSAGE per ADC, so
+   a scan costs a single system call per run of inputs of the same ADC; the
+   kernel deasserts CS between the conversions (cs_change). With a
+   DMA-capable SPI driver, the transfers of a message need no CPU. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include "adc.h"
+
+struct spidev_state {
+     /* Device of each SPI channel (-1 if not used) */
+     int fds[2];
+};
+
+/**
+ * Open the spidev device of the ADCs on the SPI channels used.
+ *
+ * @param adc the ADC
+ * @param arg SPI bus number (NULL for bus 0)
+ * @return 0 on success; -1 on error (errno is set)
+ */
+static int spidev_open(struct adc *adc, const char *arg)
+{
+     int bus = (arg != NULL ? atoi(arg) : 0);
+
+     struct spidev_state *state = malloc(sizeof(*state));
+     if (state == NULL)
+	  return -1;
+     state->fds[0] = -1;
+     state->fds[1] = -1;
+     adc->state = state;
+
+     for (unsigned int i = 0; i < adc->input_count; i++) {
+	  int cs = adc->spi_channels[i];
+	  if (state->fds[cs] != -1)
+	       continue;
+
+	  char path[64];
+	  snprintf(path, sizeof(path), "/dev/spidev%d.%d", bus, cs);
+	  int fd = open(path, O_RDWR);
+	  if (fd == -1) {
+	       adc->backend->close(adc);
+	       return -1;
+	  }
+	  state->fds[cs] = fd;
+
+	  // SPI 0,0 as per MCP3208 data sheet
+	  uint8_t mode = SPI_MODE_0;
+	  uint8_t bits = 8;
+	  uint32_t speed = adc->spi_frequency;
+	  if (ioctl(fd, SPI_IOC_WR_MODE, &mode) == -1 ||
+	      ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) == -1 ||
+	      ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) == -1) {
+	       adc->backend->close(adc);
+	       return -1;
+	  }
+     }
+
+     return 0;
+}
+
+static int spidev_scan(struct adc *adc, const unsigned int *indices,
+		       unsigned int count, uint16_t *values)
+{
+     struct spidev_state *state = adc->state;
+     uint8_t data[3*MCP320X_MAX_SCAN];
+     struct spi_ioc_transfer transfers[MCP320X_MAX_SCAN];
+
+     memset(transfers, 0, count*sizeof(transfers[0]));
+     for (unsigned int k = 0; k < count; k++) {
+	  mcp320x_request(&data[3*k], &adc->inputs[indices[k]]);
+	  transfers[k].tx_buf = (unsigned long) &data[3*k];
+	  transfers[k].rx_buf = (unsigned long) &data[3*k];
+	  transfers[k].len = 3;
+	  transfers[k].speed_hz = adc->spi_frequency;
+	  transfers[k].bits_per_word = 8;
+	  /* MCP320x ends a conversion when CS is deasserted. */
+	  transfers[k].cs_change = 1;
+     }
+
+     /* One message per run of inputs of the same ADC */
+     unsigned int first = 0;
+     while (first < count) {
+	  int cs = adc->spi_channels[indices[first]];
+	  unsigned int last = first+1;
+	  while (last < count && adc->spi_channels[indices[last]] == cs)
+	       last++;
+	  /* CS is deasserted after the last transfer of a message anyway. */
+	  transfers[last-1].cs_change = 0;
+	  if (ioctl(state->fds[cs], SPI_IOC_MESSAGE(last-first),
+		    &transfers[first]) < 0)
+	       return -1;
+	  first = last;
+     }
+
+     for (unsigned int k = 0; k < count; k++)
+	  values[k] = mcp320x_decode(&data[3*k]);
+
+     return 0;
+}
+
+static void spidev_close(struct adc *adc)
+{
+     struct spidev_state *state = adc->state;
+     if (state == NULL)
+	  return;
+
+     for (int cs = 0; cs < 2; cs++) {
+	  if (state->fds[cs] != -1)
+	       close(state->fds[cs]);
+     }
+     free(state);
+     adc->state = NULL;
+}
+
+const struct adc_backend adc_spidev_backend = {
+     .name = "spidev",
+     .open = spidev_open,
+     .scan = spidev_scan,
+     .close = spidev_close
+};
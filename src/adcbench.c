@@ -0,0 +1,211 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Throughput benchmark comparing scans of the ADC through one call of
+   get_samples() per scan with one call of get_sample() per input.
+
+   Usage: adcbench -s SPI_CHANNEL -f SPI_FREQUENCY [-c INPUTS] [-n SCANS]
+   [-p TASK_PRIORITY]
+
+   Scans of the single-ended channels 0 to INPUTS-1 are taken back to back.
+   The duration of each scan is measured, and the mean scan rate as well
+   as the scan rate sustainable with the 99th percentile and maximum scan
+   duration are printed for both methods. */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "mcp320x.h"
+
+#ifdef BCM2835LIB
+#include <bcm2835.h>
+#endif
+
+#ifdef WIRINGPI
+#include <wiringPiSPI.h>
+#endif
+
+int spi_channel = -1;
+int spi_frequency = 0;
+unsigned int input_count = 2;
+unsigned long scans_total = 100000;
+int task_priority = 0;
+
+struct mcp320x_input inputs[MCP320X_CHANNELS];
+uint8_t spi_channels[MCP320X_CHANNELS];
+
+uint64_t *durations;
+
+uint64_t now_ns(void)
+{
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return 1000000000ull*t.tv_sec + t.tv_nsec;
+}
+
+int compare_u64(const void *a, const void *b)
+{
+     uint64_t x = *((const uint64_t *) a);
+     uint64_t y = *((const uint64_t *) b);
+
+     return (x > y) - (x < y);
+}
+
+/**
+ * Take scans back to back with one method and print the scan rates.
+ *
+ * @param combined true to use get_samples(), false to call get_sample()
+ * for each input
+ */
+void run(bool combined)
+{
+     uint16_t values[MCP320X_CHANNELS];
+     unsigned long errors = 0;
+
+     uint64_t tbegin = now_ns();
+     for (unsigned long i = 0; i < scans_total; i++) {
+	  uint64_t tstart = now_ns();
+	  if (combined) {
+	       if (get_samples(inputs, spi_channels, input_count,
+			       values) == -1)
+		    errors++;
+	  } else {
+	       for (unsigned int k = 0; k < input_count; k++) {
+		    int16_t sample = get_sample(&inputs[k], spi_channel);
+		    if (sample == -1)
+			 errors++;
+		    values[k] = sample;
+	       }
+	  }
+	  durations[i] = now_ns()-tstart;
+     }
+     uint64_t tend = now_ns();
+
+     qsort(durations, scans_total, sizeof(uint64_t), compare_u64);
+     uint64_t p99 = durations[(unsigned long) (0.99*(scans_total-1))];
+     uint64_t max = durations[scans_total-1];
+
+     printf("%-12s %12.0f %12.0f %12.0f %8lu\n",
+	    combined ? "get_samples" : "get_sample",
+	    1000000000.0*scans_total/(tend-tbegin), 1000000000.0/p99,
+	    1000000000.0/max, errors);
+}
+
+void usage(const char *appl)
+{
+     fprintf(stderr, "%s -s SPI_CHANNEL -f SPI_FREQUENCY [-c INPUTS] "
+	     "[-n SCANS] [-p TASK_PRIORITY]\n", appl);
+}
+
+int main(int argc, char *argv[])
+{
+     int c;
+     while ((c = getopt(argc, argv, "s:f:c:n:p:")) != -1) {
+	  switch (c) {
+	  case 's' :
+	       spi_channel = atoi(optarg);
+	       break;
+	  case 'f' :
+	       spi_frequency = atoi(optarg);
+	       break;
+	  case 'c' :
+	       input_count = strtoul(optarg, NULL, 10);
+	       break;
+	  case 'n' :
+	       scans_total = strtoul(optarg, NULL, 10);
+	       break;
+	  case 'p' :
+	       task_priority = atoi(optarg);
+	       break;
+	  default:
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+
+     if ((spi_channel != 0 && spi_channel != 1) || spi_frequency <= 0 ||
+	 input_count == 0 || input_count > MCP320X_CHANNELS ||
+	 scans_total == 0) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     for (unsigned int k = 0; k < input_count; k++) {
+	  inputs[k].differential = false;
+	  inputs[k].channel = k;
+	  spi_channels[k] = spi_channel;
+     }
+
+     durations = malloc(scans_total*sizeof(uint64_t));
+     if (durations == NULL) {
+	  perror("Could not allocate memory");
+	  exit(-1);
+     }
+
+     if (task_priority > 0) {
+	  struct sched_param schedparam;
+	  schedparam.sched_priority = task_priority;
+	  if (sched_setscheduler(0, SCHED_FIFO, &schedparam) == -1)
+	       perror("sched_setscheduler failed");
+     }
+     if (mlockall(MCL_CURRENT|MCL_FUTURE) == -1)
+	  perror("mlockall failed");
+
+#ifdef WIRINGPI
+     if (wiringPiSPISetup(spi_channel, spi_frequency) < 0) {
+	  perror("Could not setup SPI");
+	  exit(-1);
+     }
+#endif
+
+#ifdef BCM2835LIB
+     bcm2835_init();
+     bcm2835_spi_begin();
+     if (spi_channel == 0)
+	  bcm2835_spi_chipSelect(BCM2835_SPI_CS0);
+     else
+	  bcm2835_spi_chipSelect(BCM2835_SPI_CS1);
+     uint16_t divider = (uint16_t) ((double) 250000000/spi_frequency + 0.5);
+     bcm2835_spi_setClockDivider(divider);
+     bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);
+     bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);
+     bcm2835_spi_setChipSelectPolarity(BCM2835_SPI_CS0, LOW);
+     bcm2835_spi_setChipSelectPolarity(BCM2835_SPI_CS1, LOW);
+#endif
+
+     printf("scan rate [scans/s], %lu scans of %u inputs at %d Hz SPI "
+	    "clock\n", scans_total, input_count, spi_frequency);
+     printf("%-12s %12s %12s %12s %8s\n", "method", "mean", "p99", "max",
+	    "errors");
+     run(false);
+     run(true);
+
+#ifdef BCM2835LIB
+     bcm2835_spi_end();
+     bcm2835_close();
+#endif
+
+     free(durations);
+
+     return 0;
+}
@@ -0,0 +1,744 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Note: the binary log format is little-endian. We write and read values
+   in host byte order, which is little-endian on the Raspberry Pi. */
+
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "binlog.h"
+
+/**
+ * Calculate the size of records.
+ *
+ * @param h file header
+ * @return record size in bytes
+ */
+static uint32_t record_size(const struct binlog_header *h)
+{
+     uint32_t size = sizeof(int32_t);
+     if (h->flags & BINLOG_FLAG_OVERSAMPLED)
+	  size += 2*h->channel_count;
+     else
+	  size += (12*h->channel_count+7)/8;
+     if (h->flags & BINLOG_FLAG_MASK)
+	  size += (h->channel_count+7)/8;
+
+     return size;
+}
+
+/**
+ * Calculate the number of bits of a compressed block available for
+ * records.
+ *
+ * @param h file header
+ * @return number of bits
+ */
+static uint32_t payload_bits(const struct binlog_header *h)
+{
+     return 8*(h->block_size-sizeof(struct binlog_block_header)-
+	       sizeof(uint64_t));
+}
+
+/**
+ * Calculate the largest number of bits a compressed record can take.
+ *
+ * @param h file header
+ * @return number of bits
+ */
+static uint32_t max_record_bits(const struct binlog_header *h)
+{
+     uint32_t bits = (1+h->channel_count)*(BINLOG_RICE_ESCAPE+32);
+     if (h->flags & BINLOG_FLAG_MASK)
+	  bits += h->channel_count;
+
+     return bits;
+}
+
+/**
+ * Calculate the maximum number of records of a block.
+ *
+ * @param h file header
+ * @return number of records
+ */
+static uint32_t max_records(const struct binlog_header *h)
+{
+     if (!(h->flags & BINLOG_FLAG_COMPRESSED))
+	  return (h->block_size-sizeof(struct binlog_block_header))/
+	       h->record_size;
+
+     /* Every record but the first takes at least one bit for the
+	timestamp and one bit per value (plus the mask), and holds at least
+	one value. */
+     uint32_t min_bits = 1 + ((h->flags & BINLOG_FLAG_MASK) ?
+			      h->channel_count+1 : h->channel_count);
+     return 1 + payload_bits(h)/min_bits;
+}
+
+/**
+ * Calculate record size and records per block of a header.
+ *
+ * @param h file header
+ * @return 0 on success; -1 if a record does not fit into a block
+ */
+static int layout(struct binlog_header *h)
+{
+     h->record_size = record_size(h);
+     if (h->block_size < sizeof(struct binlog_header) ||
+	 h->block_size < sizeof(struct binlog_block_header)+h->record_size)
+	  return -1;
+     if ((h->flags & BINLOG_FLAG_COMPRESSED) &&
+	 h->block_size < sizeof(struct binlog_block_header)+
+	 sizeof(uint64_t) + (max_record_bits(h)+7)/8)
+	  return -1;
+     h->records_per_block = max_records(h);
+
+     return 0;
+}
+
+int binlog_header_init(struct binlog_header *h, uint32_t block_size,
+		       uint64_t sampling_interval, unsigned int channel_count,
+		       const uint8_t *adc_channels,
+		       const uint64_t *channel_intervals,
+		       const uint8_t *spi_channels, int spi_frequency)
+{
+     if (channel_count == 0 || channel_count > BINLOG_MAX_CHANNELS)
+	  return -1;
+     
+     memset(h, 0, sizeof(*h));
+     memcpy(h->magic, BINLOG_MAGIC, sizeof(h->magic));
+     h->version = BINLOG_VERSION;
+     h->channel_count = channel_count;
+     h->block_size = block_size;
+     for (unsigned int i = 0; i < channel_count; i++) {
+	  if (channel_intervals == NULL) {
+	       h->channel_intervals[i] = sampling_interval;
+	  } else {
+	       h->channel_intervals[i] = channel_intervals[i];
+	       if (channel_intervals[i] != sampling_interval)
+		    h->flags |= BINLOG_FLAG_MASK;
+	  }
+     }
+     if (layout(h) == -1)
+	  return -1;
+     h->sampling_interval = sampling_interval;
+     h->spi_frequency = spi_frequency;
+     memcpy(h->spi_channels, spi_channels, channel_count);
+     memcpy(h->adc_channels, adc_channels, channel_count);
+
+     return 0;
+}
+
+int binlog_header_set_oversampling(struct binlog_header *h,
+				   unsigned int oversampling, uint8_t filter)
+{
+     h->flags |= BINLOG_FLAG_OVERSAMPLED;
+     h->filter = filter;
+     h->oversampling = oversampling;
+
+     return layout(h);
+}
+
+int binlog_header_set_compressed(struct binlog_header *h)
+{
+     h->flags |= BINLOG_FLAG_COMPRESSED;
+
+     return layout(h);
+}
+
+void binlog_writer_init(struct binlog_writer *w,
+			const struct binlog_header *h, uint8_t *block)
+{
+     w->header = *h;
+     w->block = block;
+     w->record_count = 0;
+     w->t0 = 0;
+     w->lost = 0;
+     w->bit_count = 0;
+}
+
+void binlog_writer_header_block(const struct binlog_writer *w,
+				uint8_t *buffer)
+{
+     memset(buffer, 0, w->header.block_size);
+     memcpy(buffer, &w->header, sizeof(w->header));
+}
+
+void binlog_pack12(uint8_t *dest, const uint16_t *values, unsigned int count)
+{
+     unsigned int i;
+     for (i = 0; i+1 < count; i += 2) {
+	  dest[0] = values[i] & 0xff;
+	  dest[1] = ((values[i] >> 8) & 0x0f) | ((values[i+1] & 0x0f) << 4);
+	  dest[2] = (values[i+1] >> 4) & 0xff;
+	  dest += 3;
+     }
+     if (i < count) {
+	  dest[0] = values[i] & 0xff;
+	  dest[1] = (values[i] >> 8) & 0x0f;
+     }
+}
+
+void binlog_unpack12(uint16_t *values, const uint8_t *src,
+		     unsigned int count)
+{
+     unsigned int i;
+     for (i = 0; i+1 < count; i += 2) {
+	  values[i] = src[0] | ((uint16_t) (src[1] & 0x0f) << 8);
+	  values[i+1] = (src[1] >> 4) | ((uint16_t) src[2] << 4);
+	  src += 3;
+     }
+     if (i < count) {
+	  values[i] = src[0] | ((uint16_t) (src[1] & 0x0f) << 8);
+     }
+}
+
+/**
+ * Pack the values of a record, 12 or 16 bit depending on the header.
+ *
+ * @param h file header
+ * @param dest destination
+ * @param values channel_count values
+ */
+static void pack_values(const struct binlog_header *h, uint8_t *dest,
+			const uint16_t *values)
+{
+     if (h->flags & BINLOG_FLAG_OVERSAMPLED)
+	  memcpy(dest, values, 2*h->channel_count);
+     else
+	  binlog_pack12(dest, values, h->channel_count);
+}
+
+/**
+ * Unpack the values of a record packed by pack_values().
+ *
+ * @param h file header
+ * @param values destination of channel_count values
+ * @param src packed values
+ */
+static void unpack_values(const struct binlog_header *h, uint16_t *values,
+			  const uint8_t *src)
+{
+     if (h->flags & BINLOG_FLAG_OVERSAMPLED)
+	  memcpy(values, src, 2*h->channel_count);
+     else
+	  binlog_unpack12(values, src, h->channel_count);
+}
+
+/**
+ * Append bits to a bit stream (LSB first). The bits of the stream behind
+ * the position must be 0.
+ *
+ * @param p the stream
+ * @param pos bit position; advanced by n
+ * @param value the bits (less than 2^n)
+ * @param n number of bits (at most 56)
+ */
+static inline void put_bits(uint8_t *p, uint32_t *pos, uint64_t value,
+			    unsigned int n)
+{
+     uint64_t word;
+     memcpy(&word, p + *pos/8, sizeof(word));
+     word |= value << (*pos%8);
+     memcpy(p + *pos/8, &word, sizeof(word));
+     *pos += n;
+}
+
+/**
+ * Get the next 56 bits of a bit stream without advancing the position.
+ *
+ * @param p the stream
+ * @param pos bit position
+ * @return the bits
+ */
+static inline uint64_t peek_bits(const uint8_t *p, uint32_t pos)
+{
+     uint64_t word;
+     memcpy(&word, p + pos/8, sizeof(word));
+     return word >> (pos%8);
+}
+
+/**
+ * Read bits from a bit stream.
+ *
+ * @param p the stream
+ * @param pos bit position; advanced by n
+ * @param n number of bits (at most 56)
+ * @return the bits
+ */
+static inline uint64_t get_bits(const uint8_t *p, uint32_t *pos,
+				unsigned int n)
+{
+     uint64_t value = peek_bits(p, *pos) & (((uint64_t) 1 << n)-1);
+     *pos += n;
+     return value;
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+     return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t z)
+{
+     return (int32_t) ((z >> 1) ^ -(z & 1));
+}
+
+/**
+ * Reset a Rice context at the start of a block.
+ */
+static void rice_reset(struct binlog_rice_context *c)
+{
+     c->sum = BINLOG_RICE_INITIAL_SUM;
+     c->count = 1;
+}
+
+/**
+ * Get the Rice parameter of a context.
+ */
+static inline unsigned int rice_parameter(const struct binlog_rice_context *c)
+{
+     unsigned int k = 0;
+     while (k < 31 && ((uint64_t) c->count << k) < c->sum)
+	  k++;
+     return k;
+}
+
+/**
+ * Update a Rice context with a coded value.
+ */
+static inline void rice_update(struct binlog_rice_context *c, uint32_t z)
+{
+     c->sum += z;
+     if (++c->count == BINLOG_RICE_MAX_COUNT) {
+	  c->sum >>= 1;
+	  c->count >>= 1;
+     }
+}
+
+/**
+ * Append a Rice coded value to a bit stream.
+ *
+ * @param p the stream
+ * @param pos bit position
+ * @param c context of the value
+ * @param z the value
+ */
+static void rice_put(uint8_t *p, uint32_t *pos,
+		     struct binlog_rice_context *c, uint32_t z)
+{
+     unsigned int k = rice_parameter(c);
+     uint32_t q = z >> k;
+     if (q < BINLOG_RICE_ESCAPE) {
+	  put_bits(p, pos, ((uint64_t) 1 << q)-1, q+1);
+	  put_bits(p, pos, z & ((1u << k)-1), k);
+     } else {
+	  put_bits(p, pos, ((uint64_t) 1 << BINLOG_RICE_ESCAPE)-1,
+		   BINLOG_RICE_ESCAPE);
+	  put_bits(p, pos, z, 32);
+     }
+     rice_update(c, z);
+}
+
+/**
+ * Read a Rice coded value from a bit stream.
+ *
+ * @param p the stream
+ * @param pos bit position
+ * @param c context of the value
+ * @return the value
+ */
+static uint32_t rice_get(const uint8_t *p, uint32_t *pos,
+			 struct binlog_rice_context *c)
+{
+     unsigned int k = rice_parameter(c);
+     unsigned int q = __builtin_ctzll(~peek_bits(p, *pos));
+     uint32_t z;
+     if (q >= BINLOG_RICE_ESCAPE) {
+	  *pos += BINLOG_RICE_ESCAPE;
+	  z = get_bits(p, pos, 32);
+     } else {
+	  *pos += q+1;
+	  z = (q << k) | get_bits(p, pos, k);
+     }
+     rice_update(c, z);
+     return z;
+}
+
+/**
+ * Add a record to the current block of a compressed log.
+ *
+ * @param w the writer
+ * @param timestamp timestamp of the samples in nanoseconds
+ * @param values sample values
+ * @return 0 on success; -1 if the record does not fit into the current
+ * block
+ */
+static int add_compressed(struct binlog_writer *w, uint64_t timestamp,
+			  const uint16_t *values)
+{
+     const struct binlog_header *h = &w->header;
+     uint8_t *p = w->block + sizeof(struct binlog_block_header);
+     unsigned int channel_count = h->channel_count;
+
+     if (w->record_count == 0) {
+	  memset(p, 0, h->block_size-sizeof(struct binlog_block_header));
+	  w->t0 = timestamp;
+	  w->bit_count = 0;
+	  for (unsigned int i = 0; i <= channel_count; i++)
+	       rice_reset(&w->contexts[i]);
+	  for (unsigned int i = 0; i < channel_count; i++)
+	       w->previous[i] = BINLOG_NO_VALUE;
+     } else {
+	  if (w->bit_count+max_record_bits(h) > payload_bits(h))
+	       return -1;
+	  int64_t d = (int64_t) (timestamp-w->t_previous-
+				 h->sampling_interval);
+	  if (d > INT32_MAX || d < INT32_MIN)
+	       return -1;
+	  rice_put(p, &w->bit_count, &w->contexts[0], zigzag((int32_t) d));
+     }
+     w->t_previous = timestamp;
+
+     bool masked = (h->flags & BINLOG_FLAG_MASK);
+     if (masked) {
+	  uint32_t mask = 0;
+	  for (unsigned int i = 0; i < channel_count; i++) {
+	       if (values[i] != BINLOG_NO_VALUE)
+		    mask |= 1u << i;
+	  }
+	  put_bits(p, &w->bit_count, mask, channel_count);
+     }
+
+     unsigned int width = (h->flags & BINLOG_FLAG_OVERSAMPLED) ? 16 : 12;
+     for (unsigned int i = 0; i < channel_count; i++) {
+	  uint16_t v = values[i];
+	  if (masked && v == BINLOG_NO_VALUE)
+	       continue;
+	  if (w->previous[i] == BINLOG_NO_VALUE)
+	       put_bits(p, &w->bit_count, v & ((1u << width)-1), width);
+	  else
+	       rice_put(p, &w->bit_count, &w->contexts[i+1],
+			zigzag((int32_t) v-w->previous[i]));
+	  w->previous[i] = v;
+     }
+     w->record_count++;
+
+     return 0;
+}
+
+int binlog_writer_add(struct binlog_writer *w, uint64_t timestamp,
+		      const uint16_t *values)
+{
+     if (w->record_count == w->header.records_per_block)
+	  return -1;
+     if (w->header.flags & BINLOG_FLAG_COMPRESSED)
+	  return add_compressed(w, timestamp, values);
+
+     int32_t deviation = 0;
+     if (w->record_count == 0) {
+	  w->t0 = timestamp;
+     } else {
+	  uint64_t tnominal = w->t0 +
+	       w->record_count*w->header.sampling_interval;
+	  int64_t d = (int64_t) (timestamp-tnominal);
+	  /* Records lost in between could make the deviation too large
+	     for 32 bit. Then, a new block with new t0 must be started. */
+	  if (d > INT32_MAX || d < INT32_MIN)
+	       return -1;
+	  deviation = (int32_t) d;
+     }
+
+     uint8_t *record = w->block + sizeof(struct binlog_block_header) +
+	  w->record_count*w->header.record_size;
+     memcpy(record, &deviation, sizeof(deviation));
+     record += sizeof(deviation);
+
+     unsigned int channel_count = w->header.channel_count;
+     if (w->header.flags & BINLOG_FLAG_MASK) {
+	  uint16_t present[BINLOG_MAX_CHANNELS];
+	  memset(record, 0, (channel_count+7)/8);
+	  for (unsigned int i = 0; i < channel_count; i++) {
+	       if (values[i] != BINLOG_NO_VALUE) {
+		    record[i/8] |= 1 << (i%8);
+		    present[i] = values[i];
+	       } else {
+		    present[i] = 0;
+	       }
+	  }
+	  record += (channel_count+7)/8;
+	  pack_values(&w->header, record, present);
+     } else {
+	  pack_values(&w->header, record, values);
+     }
+     w->record_count++;
+
+     return 0;
+}
+
+void binlog_writer_add_gap(struct binlog_writer *w, uint32_t lost)
+{
+     w->lost += lost;
+}
+
+int binlog_writer_full(const struct binlog_writer *w)
+{
+     if (w->header.flags & BINLOG_FLAG_COMPRESSED)
+	  return (w->record_count > 0 &&
+		  w->bit_count+max_record_bits(&w->header) >
+		  payload_bits(&w->header));
+     return (w->record_count == w->header.records_per_block);
+}
+
+uint32_t binlog_writer_finish_block(struct binlog_writer *w)
+{
+     uint32_t n = w->record_count;
+     if (n == 0)
+	  return 0;
+     
+     struct binlog_block_header bh;
+     bh.t0 = w->t0;
+     bh.record_count = n;
+     bh.lost = w->lost;
+     memcpy(w->block, &bh, sizeof(bh));
+
+     size_t used = sizeof(bh);
+     if (w->header.flags & BINLOG_FLAG_COMPRESSED)
+	  used += (w->bit_count+7)/8;
+     else
+	  used += n*w->header.record_size;
+     memset(w->block+used, 0, w->header.block_size-used);
+
+     w->record_count = 0;
+     w->lost = 0;
+
+     return n;
+}
+
+void binlog_writer_summary(struct binlog_writer *w,
+			   const struct binlog_summary *s)
+{
+     struct binlog_block_header bh;
+     bh.t0 = s->tfirst;
+     bh.record_count = 0;
+     bh.lost = 0;
+     memcpy(w->block, &bh, sizeof(bh));
+     memcpy(w->block+sizeof(bh), s, sizeof(*s));
+     memset(w->block+sizeof(bh)+sizeof(*s), 0,
+	    w->header.block_size-sizeof(bh)-sizeof(*s));
+}
+
+int binlog_open(struct binlog_reader *r, const char *path)
+{
+     r->fd = open(path, O_RDONLY);
+     if (r->fd == -1)
+	  return -1;
+
+     struct stat st;
+     if (fstat(r->fd, &st) == -1) {
+	  close(r->fd);
+	  return -1;
+     }
+     r->size = st.st_size;
+     
+     if (r->size < sizeof(struct binlog_header)) {
+	  close(r->fd);
+	  errno = EINVAL;
+	  return -1;
+     }
+     
+     r->map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+     if (r->map == MAP_FAILED) {
+	  close(r->fd);
+	  return -1;
+     }
+
+     struct binlog_header *h = &r->header;
+     memcpy(h, r->map, sizeof(*h));
+     if (memcmp(h->magic, BINLOG_MAGIC, sizeof(h->magic)) != 0 ||
+	 h->version != BINLOG_VERSION ||
+	 h->channel_count == 0 || h->channel_count > BINLOG_MAX_CHANNELS ||
+	 h->block_size < sizeof(struct binlog_header) ||
+	 r->size < h->block_size ||
+	 h->record_size != record_size(h) ||
+	 h->records_per_block != max_records(h)) {
+	  binlog_close(r);
+	  errno = EINVAL;
+	  return -1;
+     }
+
+     /* The first block holds the file header. A partially written last
+	block is ignored. */
+     uint64_t blocks = r->size/h->block_size;
+     r->block_count = (blocks > 0 ? blocks-1 : 0);
+
+     /* We access blocks in sequence most of the time. */
+     madvise((void *) r->map, r->size, MADV_SEQUENTIAL);
+     
+     return 0;
+}
+
+void binlog_close(struct binlog_reader *r)
+{
+     munmap((void *) r->map, r->size);
+     close(r->fd);
+}
+
+const struct binlog_block_header *binlog_block(const struct binlog_reader *r,
+					       uint64_t block)
+{
+     return (const struct binlog_block_header *)
+	  (r->map + (block+1)*r->header.block_size);
+}
+
+const struct binlog_summary *binlog_block_summary(
+     const struct binlog_reader *r, uint64_t block)
+{
+     const struct binlog_block_header *bh = binlog_block(r, block);
+     if (bh->record_count > 0)
+	  return NULL;
+     return (const struct binlog_summary *) (bh+1);
+}
+
+void binlog_record(const struct binlog_reader *r, uint64_t block,
+		   uint32_t record, uint64_t *timestamp, uint16_t *values)
+{
+     const struct binlog_header *h = &r->header;
+     const struct binlog_block_header *bh = binlog_block(r, block);
+     const uint8_t *rec = (const uint8_t *) bh +
+	  sizeof(struct binlog_block_header) + record*h->record_size;
+
+     int32_t deviation;
+     memcpy(&deviation, rec, sizeof(deviation));
+     *timestamp = bh->t0 + record*h->sampling_interval + deviation;
+     rec += sizeof(deviation);
+
+     if (h->flags & BINLOG_FLAG_MASK) {
+	  const uint8_t *mask = rec;
+	  rec += (h->channel_count+7)/8;
+	  unpack_values(h, values, rec);
+	  for (unsigned int i = 0; i < h->channel_count; i++) {
+	       if (!(mask[i/8] & (1 << (i%8))))
+		    values[i] = BINLOG_NO_VALUE;
+	  }
+     } else {
+	  unpack_values(h, values, rec);
+     }
+}
+
+/**
+ * Decode all records of a compressed block.
+ *
+ * @param h file header
+ * @param bh the block
+ * @param timestamps set to the timestamps of the records
+ * @param values set to the sample values of the records
+ * @return number of records; 0 if the block is corrupt
+ */
+static uint32_t read_compressed(const struct binlog_header *h,
+				const struct binlog_block_header *bh,
+				uint64_t *timestamps, uint16_t *values)
+{
+     const uint8_t *p = (const uint8_t *) bh +
+	  sizeof(struct binlog_block_header);
+     unsigned int channel_count = h->channel_count;
+     bool masked = (h->flags & BINLOG_FLAG_MASK);
+     unsigned int width = (h->flags & BINLOG_FLAG_OVERSAMPLED) ? 16 : 12;
+     uint32_t limit = payload_bits(h);
+     
+     struct binlog_rice_context contexts[BINLOG_MAX_CHANNELS+1];
+     uint16_t previous[BINLOG_MAX_CHANNELS];
+     for (unsigned int i = 0; i <= channel_count; i++)
+	  rice_reset(&contexts[i]);
+     for (unsigned int i = 0; i < channel_count; i++)
+	  previous[i] = BINLOG_NO_VALUE;
+
+     uint32_t pos = 0;
+     uint64_t t = bh->t0;
+     for (uint32_t n = 0; n < bh->record_count; n++) {
+	  /* A record never starts in the last bits of a block. */
+	  if (pos+max_record_bits(h) > limit && n > 0)
+	       return 0;
+	  if (n > 0)
+	       t += h->sampling_interval +
+		    unzigzag(rice_get(p, &pos, &contexts[0]));
+	  timestamps[n] = t;
+
+	  uint32_t mask = (uint32_t) -1;
+	  if (masked)
+	       mask = get_bits(p, &pos, channel_count);
+
+	  uint16_t *v = &values[n*channel_count];
+	  for (unsigned int i = 0; i < channel_count; i++) {
+	       if (!(mask & (1u << i))) {
+		    v[i] = BINLOG_NO_VALUE;
+		    continue;
+	       }
+	       if (previous[i] == BINLOG_NO_VALUE)
+		    v[i] = get_bits(p, &pos, width);
+	       else
+		    v[i] = previous[i] +
+			 unzigzag(rice_get(p, &pos, &contexts[i+1]));
+	       previous[i] = v[i];
+	  }
+     }
+
+     return bh->record_count;
+}
+
+uint32_t binlog_read_block(const struct binlog_reader *r, uint64_t block,
+			   uint64_t *timestamps, uint16_t *values)
+{
+     const struct binlog_header *h = &r->header;
+     const struct binlog_block_header *bh = binlog_block(r, block);
+     if (bh->record_count > h->records_per_block)
+	  return 0;
+
+     if (h->flags & BINLOG_FLAG_COMPRESSED)
+	  return read_compressed(h, bh, timestamps, values);
+
+     for (uint32_t i = 0; i < bh->record_count; i++)
+	  binlog_record(r, block, i, &timestamps[i],
+			&values[i*h->channel_count]);
+
+     return bh->record_count;
+}
+
+uint64_t binlog_find_block(const struct binlog_reader *r,
+			   uint64_t timestamp)
+{
+     uint64_t lo = 0;
+     uint64_t hi = r->block_count;
+
+     /* Invariant: all blocks before lo start at or before the timestamp,
+	all blocks from hi on start after it. */
+     while (lo < hi) {
+	  uint64_t mid = lo + (hi-lo)/2;
+	  if (binlog_block(r, mid)->t0 <= timestamp)
+	       lo = mid+1;
+	  else
+	       hi = mid;
+     }
+
+     return (lo == 0 ? 0 : lo-1);
+}
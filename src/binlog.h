@@ -0,0 +1,409 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Binary log format
+   
+   A binary log consists of fixed-size blocks. The first block holds the
+   file header (struct binlog_header, padded to the block size), all
+   following blocks hold records. All values are little-endian.
+
+   Each record block starts with a struct binlog_block_header holding the
+   absolute timestamp t0 of the block and the number of records in the
+   block. Record i of a block nominally was taken at
+   t0 + i*sampling_interval; the record only stores the deviation of the
+   actual timestamp from this nominal time as signed 32 bit value in
+   nanoseconds, followed by the 12 bit samples of all channels packed
+   into (12*channel_count+7)/8 bytes (LSB first).
+
+   If channels are sampled at different rates (BINLOG_FLAG_MASK), not
+   every record holds a value for every channel. Then, the deviation is
+   followed by a bit mask of (channel_count+7)/8 bytes with bit i set if
+   the record holds a value of channel i; values of other channels are
+   packed as 0.
+
+   If inputs are oversampled (BINLOG_FLAG_OVERSAMPLED), values are 16 bit
+   fixed-point numbers with BINLOG_OVERSAMPLED_FRAC_BITS fractional bits,
+   each reduced from oversampling conversions by a decimation filter, and
+   stored as 16 bit little-endian values instead of packed 12 bit values.
+
+   Compressed logs (BINLOG_FLAG_COMPRESSED) have the same file header and
+   block headers, but the records of a block are a bit stream (LSB first)
+   of variable-length records, so a block holds as many records as fit:
+   - The timestamp of the first record is t0. For every further record,
+     the deviation of its timestamp from the previous timestamp plus
+     sampling_interval is zigzag encoded (0, -1, 1, -2, ... as 0, 1, 2,
+     3, ...) and Rice coded.
+   - With BINLOG_FLAG_MASK, the channel mask follows as channel_count bits.
+   - The first value of each channel within the block is stored with 12
+     bits (16 bits if oversampled); every further value as zigzag encoded
+     and Rice coded difference to the previous value of the channel.
+   A Rice code with parameter k stores z >> k in unary (that many 1 bits
+   and a 0 bit) followed by the lower k bits of z. Quotients of
+   BINLOG_RICE_ESCAPE and more are stored as BINLOG_RICE_ESCAPE 1 bits
+   followed by z with 32 bits. The parameter adapts to the data: each
+   value has a context (the timestamp, each channel) holding the sum and
+   count of the recent zigzag values coded in this context, and k is the
+   smallest number with count << k >= sum. Contexts are reset at the
+   start of a block (sum BINLOG_RICE_INITIAL_SUM, count 1), and sum and
+   count are halved once count reaches BINLOG_RICE_MAX_COUNT, so each
+   block can be decoded independently. The last 8 bytes of a block are
+   never used, so 64 bit accesses stay within the block. records_per_block
+   is the maximum number of records of a compressed block.
+
+   The header records the SPI channel (chip select) of every channel to
+   log several ADCs, and allows for up to 16 channels. Logs with other
+   header versions are rejected.
+
+   If scans were lost before they could be logged (e.g., because the
+   logger could not keep up), the block following the gap starts with the
+   first record after the gap, and its header holds the number of lost
+   scans (lost).
+
+   Logs written with a trigger summarize the scans not captured in
+   summary blocks: a block with record_count 0 holds a struct
+   binlog_summary after its block header (t0 is the time of the first
+   scan summarized). Record blocks are never empty, so readers tell
+   summary blocks apart by their record count.
+
+   Since records have a fixed width and blocks a fixed size, any block can
+   be accessed directly, and blocks can be searched for a timestamp by
+   binary search over t0. */
+
+#define BINLOG_MAGIC "PMBINLOG"
+#define BINLOG_VERSION 3
+
+#define BINLOG_DEFAULT_BLOCK_SIZE 4096
+#define BINLOG_MAX_CHANNELS 16
+
+/* Flag of adc_channels marking a differential channel pair. Single-ended
+   channels are stored as enum channel_singleended, differential pairs as
+   enum channel_differential with this flag set. */
+#define BINLOG_DIFFERENTIAL 0x80
+
+/* Flag of the header: records have a mask of channels with values */
+#define BINLOG_FLAG_MASK 0x01
+/* Flag of the header: values are oversampled 16 bit values */
+#define BINLOG_FLAG_OVERSAMPLED 0x02
+
+/* Flag of the header: blocks are compressed */
+#define BINLOG_FLAG_COMPRESSED 0x04
+
+/* Parameters of the Rice codes of compressed blocks */
+#define BINLOG_RICE_ESCAPE 24
+#define BINLOG_RICE_INITIAL_SUM 16
+#define BINLOG_RICE_MAX_COUNT 64
+
+/* Fractional bits of oversampled values */
+#define BINLOG_OVERSAMPLED_FRAC_BITS 4
+
+/* Value of channels without a value in a record */
+#define BINLOG_NO_VALUE 0xffff
+
+struct binlog_header {
+     char magic[8];
+     uint16_t version;
+     uint16_t channel_count;
+     uint32_t block_size;
+     uint32_t record_size;
+     uint32_t records_per_block;
+     uint64_t sampling_interval;
+     uint32_t spi_frequency;
+     uint8_t flags;
+     /* Decimation filter (enum decimation_filter) and number of
+	conversions per value if BINLOG_FLAG_OVERSAMPLED is set */
+     uint8_t filter;
+     uint16_t oversampling;
+     /* SPI channel (chip select) of the ADC of each channel */
+     uint8_t spi_channels[BINLOG_MAX_CHANNELS];
+     uint8_t adc_channels[BINLOG_MAX_CHANNELS];
+     /* Sampling interval of each channel in ns */
+     uint64_t channel_intervals[BINLOG_MAX_CHANNELS];
+} __attribute__((packed));
+
+struct binlog_block_header {
+     uint64_t t0;
+     uint32_t record_count;
+     /* Number of scans lost right before the first record of the block */
+     uint32_t lost;
+} __attribute__((packed));
+
+/* Statistics of the scans summarized by a summary block. Channels without
+   values in these scans hold BINLOG_NO_VALUE. */
+struct binlog_summary {
+     uint64_t tfirst;
+     uint64_t tlast;
+     uint64_t scans;
+     uint16_t min[BINLOG_MAX_CHANNELS];
+     uint16_t mean[BINLOG_MAX_CHANNELS];
+     uint16_t max[BINLOG_MAX_CHANNELS];
+} __attribute__((packed));
+
+/* Adaptive Rice parameter of a value coded in compressed blocks */
+struct binlog_rice_context {
+     uint64_t sum;
+     uint32_t count;
+};
+
+/**
+ * Writer filling one block at a time. The writer does not do any I/O;
+ * complete blocks are handed out to the caller.
+ */
+struct binlog_writer {
+     struct binlog_header header;
+     uint8_t *block;
+     uint32_t record_count;
+     uint64_t t0;
+     uint32_t lost;
+
+     /* State of compressed blocks: bits used, timestamp and values of the
+	previous record (BINLOG_NO_VALUE if a channel has no value in the
+	block yet), and contexts of the timestamp and each channel. */
+     uint32_t bit_count;
+     uint64_t t_previous;
+     uint16_t previous[BINLOG_MAX_CHANNELS];
+     struct binlog_rice_context contexts[BINLOG_MAX_CHANNELS+1];
+};
+
+/**
+ * Reader accessing a binary log through a read-only memory mapping.
+ */
+struct binlog_reader {
+     int fd;
+     const uint8_t *map;
+     size_t size;
+     /* File header */
+     struct binlog_header header;
+     uint64_t block_count;
+};
+
+/**
+ * Initialize a file header.
+ *
+ * @param h the header to be initialized
+ * @param block_size size of blocks in bytes
+ * @param sampling_interval nominal interval between records in nanoseconds
+ * @param channel_count number of channels per record
+ * @param adc_channels ADC channel of each value of a record
+ * @param channel_intervals sampling interval of each channel in
+ * nanoseconds; NULL if all channels are sampled with every record
+ * @param spi_channels SPI channel (chip select) of the ADC of each channel
+ * @param spi_frequency SPI clock rate in Hz
+ * @return 0 on success; -1 if the parameters are invalid
+ */
+int binlog_header_init(struct binlog_header *h, uint32_t block_size,
+		       uint64_t sampling_interval, unsigned int channel_count,
+		       const uint8_t *adc_channels,
+		       const uint64_t *channel_intervals,
+		       const uint8_t *spi_channels, int spi_frequency);
+
+/**
+ * Mark the values of a log as oversampled. Must be called after
+ * binlog_header_init(), since records get larger.
+ *
+ * @param h the header
+ * @param oversampling number of conversions per value
+ * @param filter decimation filter (enum decimation_filter)
+ * @return 0 on success; -1 if a record does not fit into a block
+ */
+int binlog_header_set_oversampling(struct binlog_header *h,
+				   unsigned int oversampling, uint8_t filter);
+
+/**
+ * Compress the blocks of a log. Must be called after binlog_header_init()
+ * and binlog_header_set_oversampling().
+ *
+ * @param h the header
+ * @return 0 on success; -1 if a record does not fit into a block
+ */
+int binlog_header_set_compressed(struct binlog_header *h);
+
+/**
+ * Initialize a writer.
+ *
+ * @param w the writer
+ * @param h file header
+ * @param block buffer of h->block_size bytes to assemble blocks in
+ */
+void binlog_writer_init(struct binlog_writer *w,
+			const struct binlog_header *h, uint8_t *block);
+
+/**
+ * Copy the file header, padded to a full block, to a buffer.
+ *
+ * @param w the writer
+ * @param buffer buffer of block_size bytes
+ */
+void binlog_writer_header_block(const struct binlog_writer *w,
+				uint8_t *buffer);
+
+/**
+ * Add a record to the current block.
+ *
+ * @param w the writer
+ * @param timestamp timestamp of the samples in nanoseconds
+ * @param values 12 bit (or oversampled 16 bit) sample values, one for each
+ * channel (BINLOG_NO_VALUE for channels without a value)
+ * @return 0 on success; -1 if the record does not fit into the current
+ * block. In this case, the block must be finished, written, and the
+ * record added again.
+ */
+int binlog_writer_add(struct binlog_writer *w, uint64_t timestamp,
+		      const uint16_t *values);
+
+/**
+ * Record scans lost before the next record. The current block must have
+ * been finished before, so the gap is at the start of a block.
+ *
+ * @param w the writer
+ * @param lost number of lost scans
+ */
+void binlog_writer_add_gap(struct binlog_writer *w, uint32_t lost);
+
+/**
+ * Check whether the current block has no space left.
+ *
+ * @param w the writer
+ * @return non-zero if the current block is full
+ */
+int binlog_writer_full(const struct binlog_writer *w);
+
+/**
+ * Finish the current block. Afterwards, the block buffer holds a complete
+ * block of block_size bytes that can be written to the file, and the next
+ * record will start a new block.
+ *
+ * @param w the writer
+ * @return number of records in the finished block (0 if empty; an empty
+ * block need not be written)
+ */
+uint32_t binlog_writer_finish_block(struct binlog_writer *w);
+
+/**
+ * Write a summary block into the block buffer. The current block must
+ * have been finished before. Afterwards, the block buffer holds a complete
+ * block of block_size bytes that can be written to the file.
+ *
+ * @param w the writer
+ * @param s the summary
+ */
+void binlog_writer_summary(struct binlog_writer *w,
+			   const struct binlog_summary *s);
+
+/**
+ * Map a binary log for reading.
+ *
+ * @param r the reader
+ * @param path path of the binary log
+ * @return 0 on success; -1 on error (errno is set, EINVAL for an
+ * invalid file)
+ */
+int binlog_open(struct binlog_reader *r, const char *path);
+
+/**
+ * Unmap a binary log.
+ *
+ * @param r the reader
+ */
+void binlog_close(struct binlog_reader *r);
+
+/**
+ * Get the header of a block.
+ *
+ * @param r the reader
+ * @param block block number (0 is the first record block)
+ * @return block header pointing into the mapped file
+ */
+const struct binlog_block_header *binlog_block(const struct binlog_reader *r,
+					       uint64_t block);
+
+/**
+ * Get the summary of a summary block.
+ *
+ * @param r the reader
+ * @param block block number
+ * @return summary pointing into the mapped file; NULL if the block is no
+ * summary block
+ */
+const struct binlog_summary *binlog_block_summary(
+     const struct binlog_reader *r, uint64_t block);
+
+/**
+ * Decode a record of an uncompressed log.
+ *
+ * @param r the reader
+ * @param block block number
+ * @param record record number within the block
+ * @param timestamp set to the timestamp of the record in nanoseconds
+ * @param values set to the sample values (channel_count values;
+ * BINLOG_NO_VALUE for channels without a value)
+ */
+void binlog_record(const struct binlog_reader *r, uint64_t block,
+		   uint32_t record, uint64_t *timestamp, uint16_t *values);
+
+/**
+ * Decode all records of a block of a compressed or uncompressed log.
+ *
+ * @param r the reader
+ * @param block block number
+ * @param timestamps set to the timestamps of the records (array of
+ * records_per_block timestamps)
+ * @param values set to the sample values of the records (array of
+ * records_per_block*channel_count values)
+ * @return number of records; 0 if a compressed block is corrupt or the
+ * block is a summary block
+ */
+uint32_t binlog_read_block(const struct binlog_reader *r, uint64_t block,
+			   uint64_t *timestamps, uint16_t *values);
+
+/**
+ * Find the block containing a timestamp by binary search.
+ *
+ * @param r the reader
+ * @param timestamp timestamp in nanoseconds
+ * @return number of the last block starting at or before the timestamp
+ * (0 if the timestamp is before the first block)
+ */
+uint64_t binlog_find_block(const struct binlog_reader *r,
+			   uint64_t timestamp);
+
+/**
+ * Pack 12 bit values (LSB first).
+ *
+ * @param dest destination of (12*count+7)/8 bytes
+ * @param values values to be packed
+ * @param count number of values
+ */
+void binlog_pack12(uint8_t *dest, const uint16_t *values, unsigned int count);
+
+/**
+ * Unpack 12 bit values packed by binlog_pack12().
+ *
+ * @param values destination of count values
+ * @param src packed values
+ * @param count number of values
+ */
+void binlog_unpack12(uint16_t *values, const uint8_t *src,
+		     unsigned int count);
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Convert a binary log written by powermeter (-m binary or compressed) to
+   the CSV format of powermeter. Summary blocks become "# summary" lines
+   as in CSV logs. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "binlog.h"
+
+void usage(const char *appl)
+{
+     fprintf(stderr, "%s BINLOG [CSVFILE]\n", appl);
+}
+
+int main(int argc, char *argv[])
+{
+     if (argc < 2 || argc > 3) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     struct binlog_reader reader;
+     if (binlog_open(&reader, argv[1]) == -1) {
+	  perror("Could not open binary log");
+	  exit(-1);
+     }
+
+     FILE *fout = stdout;
+     if (argc == 3) {
+	  fout = fopen(argv[2], "w");
+	  if (fout == NULL) {
+	       perror("Could not open output file");
+	       binlog_close(&reader);
+	       exit(-1);
+	  }
+     }
+
+     unsigned int channel_count = reader.header.channel_count;
+     uint32_t max_records = reader.header.records_per_block;
+     uint64_t *timestamps = malloc(max_records*sizeof(uint64_t));
+     uint16_t *values = malloc(max_records*channel_count*sizeof(uint16_t));
+     if (timestamps == NULL || values == NULL) {
+	  perror("Could not allocate memory");
+	  exit(-1);
+     }
+     
+     int status = 0;
+     for (uint64_t b = 0; b < reader.block_count; b++) {
+	  const struct binlog_block_header *bh = binlog_block(&reader, b);
+	  const struct binlog_summary *s = binlog_block_summary(&reader, b);
+	  if (s != NULL) {
+	       fprintf(fout, "# summary %llu,%llu,%llu",
+		       (unsigned long long) s->tfirst,
+		       (unsigned long long) s->tlast,
+		       (unsigned long long) s->scans);
+	       for (unsigned int c = 0; c < channel_count; c++) {
+		    if (s->mean[c] == BINLOG_NO_VALUE)
+			 fprintf(fout, ",,,");
+		    else
+			 fprintf(fout, ",%u,%u,%u", s->min[c], s->mean[c],
+				 s->max[c]);
+	       }
+	       fputc('\n', fout);
+	       continue;
+	  }
+	  if (bh->lost > 0)
+	       fprintf(fout, "# gap %u\n", bh->lost);
+	  uint32_t n = binlog_read_block(&reader, b, timestamps, values);
+	  if (n == 0 && bh->record_count > 0) {
+	       fprintf(stderr, "Block %llu is corrupt\n",
+		       (unsigned long long) b);
+	       status = -1;
+	  }
+	  for (uint32_t i = 0; i < n; i++) {
+	       const uint16_t *v = &values[i*channel_count];
+	       fprintf(fout, "%llu", (unsigned long long) timestamps[i]);
+	       for (unsigned int c = 0; c < channel_count; c++) {
+		    if (v[c] == BINLOG_NO_VALUE)
+			 fputc(',', fout);
+		    else
+			 fprintf(fout, ",%u", v[c]);
+	       }
+	       fputc('\n', fout);
+	  }
+     }
+
+     free(timestamps);
+     free(values);
+     binlog_close(&reader);
+     if (fout != stdout)
+	  fclose(fout);
+     
+     return status;
+}
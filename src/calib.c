@@ -0,0 +1,171 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include "calib.h"
+
+int calib_fit_line(const double *x, const double *y, unsigned int n,
+		   double *m, double *c)
+{
+     if (n < 2)
+	  return -1;
+
+     double xmean = 0.0;
+     double ymean = 0.0;
+     for (unsigned int i = 0; i < n; i++) {
+	  xmean += x[i];
+	  ymean += y[i];
+     }
+     xmean /= n;
+     ymean /= n;
+
+     double sxy = 0.0;
+     double sxx = 0.0;
+     for (unsigned int i = 0; i < n; i++) {
+	  sxy += (x[i]-xmean)*(y[i]-ymean);
+	  sxx += (x[i]-xmean)*(x[i]-xmean);
+     }
+     if (sxx == 0.0)
+	  return -1;
+
+     *m = sxy/sxx;
+     *c = ymean - (*m)*xmean;
+
+     return 0;
+}
+
+void calib_set_channel(struct channel_calibration *cal, double m, double c)
+{
+     cal->gain = (int64_t) llround(m*1000.0*65536.0);
+     cal->offset = (int64_t) llround(c*1000.0);
+}
+
+int calib_load(struct calibration *cal, const char *path)
+{
+     FILE *f = fopen(path, "r");
+     if (f == NULL)
+	  return -1;
+
+     static double voltage[CALIB_MAX_POINTS];
+     static double current[CALIB_MAX_POINTS];
+     static double current_count[CALIB_MAX_POINTS];
+     static double voltage_count[CALIB_MAX_POINTS];
+     unsigned int n = 0;
+     unsigned int nvoltage = 0;
+     
+     char line[256];
+     while (fgets(line, sizeof(line), f) != NULL) {
+	  if (line[0] == '#')
+	       continue;
+
+	  double values[6];
+	  int ncolumns = 0;
+	  char *p = line;
+	  while (ncolumns < 6) {
+	       char *end;
+	       values[ncolumns] = strtod(p, &end);
+	       if (end == p)
+		    break;
+	       ncolumns++;
+	       p = end;
+	       while (*p == ' ' || *p == '\t')
+		    p++;
+	       if (*p != ',')
+		    break;
+	       p++;
+	  }
+	  
+	  if (ncolumns == 0)
+	       continue;
+	  if (ncolumns < 3 || n == CALIB_MAX_POINTS) {
+	       fclose(f);
+	       errno = EINVAL;
+	       return -1;
+	  }
+
+	  voltage[n] = values[0];
+	  current[n] = values[1];
+	  current_count[n] = values[2];
+	  if (ncolumns >= 5)
+	       voltage_count[nvoltage++] = values[4];
+	  n++;
+     }
+     fclose(f);
+
+     double m, c;
+     if (calib_fit_line(current_count, current, n, &m, &c) == -1) {
+	  errno = EINVAL;
+	  return -1;
+     }
+     calib_set_channel(&cal->current, m, c);
+
+     if (nvoltage == n && nvoltage > 0) {
+	  if (calib_fit_line(voltage_count, voltage, n, &m, &c) == -1) {
+	       errno = EINVAL;
+	       return -1;
+	  }
+	  calib_set_channel(&cal->voltage, m, c);
+     } else {
+	  calib_set_channel(&cal->voltage, CALIB_NOMINAL_MV_PER_COUNT, 0.0);
+     }
+
+     return 0;
+}
+
+void energy_init(struct energy_meter *em, const struct calibration *cal)
+{
+     em->calibration = cal;
+     em->energy = 0;
+     em->power_prev = 0;
+     em->tfirst = 0;
+     em->tlast = 0;
+     em->samples = 0;
+}
+
+int64_t energy_interval(int64_t power_prev, int64_t power, uint64_t dt)
+{
+     /* The sum of both powers is twice the mean. uW*us = pJ, uW*ns = fJ;
+	the product of uW and whole ns could overflow after minutes. */
+     int64_t sum = power_prev+power;
+     int64_t us = (int64_t) (dt/1000);
+     int64_t ns = (int64_t) (dt%1000);
+     return sum*us/2 + sum*ns/2000;
+}
+
+int64_t energy_update(struct energy_meter *em, uint64_t t, int64_t voltage,
+		      int64_t current)
+{
+     /* uV*uA = pW */
+     int64_t power = voltage*current/1000000;
+
+     if (em->samples == 0) {
+	  em->tfirst = t;
+     } else {
+	  em->energy += energy_interval(em->power_prev, power, t-em->tlast);
+     }
+     
+     em->power_prev = power;
+     em->tlast = t;
+     em->samples++;
+
+     return power;
+}
@@ -0,0 +1,153 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CALIB_H
+#define CALIB_H
+
+#include <stdint.h>
+
+/* Calibration files use the format of calibration/{hall,shunt}/calibrate.dat:
+   lines starting with # are comments, all other lines hold comma-separated
+   values
+
+   V [mV], I [mA], mean ADC count (I), median ADC count (I)
+   [, mean ADC count (V), median ADC count (V)]
+
+   for one calibration point each. Current is calibrated by a least-squares
+   fit of I over the mean ADC count of the current channel. If the optional
+   columns for the voltage channel are present, voltage is calibrated the
+   same way; otherwise, the nominal translation of the measurement board
+   V = s*2.5V/4096 * 2 is used. */
+
+/* Nominal voltage translation in mV per ADC count */
+#define CALIB_NOMINAL_MV_PER_COUNT (2.0*2500.0/4096.0)
+
+/* Maximum number of calibration points in a calibration file */
+#define CALIB_MAX_POINTS 256
+
+/**
+ * Linear translation of ADC counts to micro units (uV, uA):
+ * value = (gain*count >> 16) + offset
+ */
+struct channel_calibration {
+     /* Micro units per ADC count, fixed-point with 16 fractional bits */
+     int64_t gain;
+     /* Micro units */
+     int64_t offset;
+};
+
+struct calibration {
+     struct channel_calibration current;
+     struct channel_calibration voltage;
+};
+
+/**
+ * Running energy integral over calibrated samples.
+ */
+struct energy_meter {
+     const struct calibration *calibration;
+     /* Energy in pJ */
+     int64_t energy;
+     /* Power of the previous sample in uW */
+     int64_t power_prev;
+     uint64_t tfirst;
+     uint64_t tlast;
+     uint64_t samples;
+};
+
+/**
+ * Fit a line y = m*x + c by least squares.
+ *
+ * @param x x values
+ * @param y y values
+ * @param n number of values (at least 2)
+ * @param m slope
+ * @param c intercept
+ * @return 0 on success; -1 if the line is undefined
+ */
+int calib_fit_line(const double *x, const double *y, unsigned int n,
+		   double *m, double *c);
+
+/**
+ * Set a channel calibration from a floating-point translation to milli
+ * units (mV, mA): value = m*count + c.
+ *
+ * @param cal the channel calibration
+ * @param m milli units per ADC count
+ * @param c offset in milli units
+ */
+void calib_set_channel(struct channel_calibration *cal, double m, double c);
+
+/**
+ * Load a calibration file.
+ *
+ * @param cal the calibration
+ * @param path path of the calibration file
+ * @return 0 on success; -1 on error (errno is set, EINVAL for an invalid
+ * file)
+ */
+int calib_load(struct calibration *cal, const char *path);
+
+/**
+ * Translate an ADC count to micro units.
+ *
+ * @param cal the channel calibration
+ * @param count ADC count
+ * @param frac_bits number of fractional bits of the count (0 unless the
+ * count is an oversampled value)
+ * @return value in micro units (uV, uA)
+ */
+static inline int64_t calib_apply(const struct channel_calibration *cal,
+				  uint16_t count, unsigned int frac_bits)
+{
+     return ((cal->gain*count) >> (16+frac_bits)) + cal->offset;
+}
+
+/**
+ * Initialize an energy meter.
+ *
+ * @param em the energy meter
+ * @param cal calibration to translate samples
+ */
+void energy_init(struct energy_meter *em, const struct calibration *cal);
+
+/**
+ * Get the energy between two samples (trapezoidal rule). The interval is
+ * split into whole microseconds and the rest before multiplying, so the
+ * product only overflows after days (more than 5 days at 10 W).
+ *
+ * @param power_prev power of the earlier sample in uW
+ * @param power power of the later sample in uW
+ * @param dt time between the samples in ns
+ * @return energy in pJ
+ */
+int64_t energy_interval(int64_t power_prev, int64_t power, uint64_t dt);
+
+/**
+ * Add a sample to the energy integral (trapezoidal rule).
+ *
+ * @param em the energy meter
+ * @param t timestamp of the sample in nanoseconds
+ * @param voltage voltage in uV
+ * @param current current in uA
+ * @return power in uW
+ */
+int64_t energy_update(struct energy_meter *em, uint64_t t, int64_t voltage,
+		      int64_t current);
+
+#endif
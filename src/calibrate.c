@@ -0,0 +1,488 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Calibration tool: computes statistics of all calibration logs in a
+   directory and fits the translation of ADC counts to current and voltage.
+
+   Usage: powermeter-calibrate [-m MANIFEST] [-j THREADS] [-o OUTFILE] DIR
+
+   Calibration logs are CSV logs written by powermeter while a known
+   voltage and current were applied. The true values are taken from file
+   names of the form log-<V>mV-<I>mA.dat, or from a manifest with lines
+   "file name, V [mV], I [mA]". Logs are mapped into memory and parsed in
+   parallel. The output is a calibration file in the format of
+   calibrate.dat, which can be passed to powermeter -C, with per-file
+   statistics and fit residuals as comments. */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "calib.h"
+
+#define MAX_LOGS CALIB_MAX_POINTS
+#define ADC_COUNTS 4096
+
+struct channel_stats {
+     double mean;
+     double median;
+     unsigned int min;
+     unsigned int max;
+};
+
+struct log {
+     char path[4096];
+     char name[256];
+     double voltage;
+     double current;
+
+     uint64_t samples;
+     uint64_t invalid_lines;
+     /* Channel 1 (current) and 2 (voltage) */
+     struct channel_stats stats[2];
+     bool failed;
+};
+
+struct log logs[MAX_LOGS];
+unsigned int log_count = 0;
+unsigned int next_log = 0;
+
+/**
+ * Compute statistics of a channel from its histogram of ADC counts.
+ *
+ * @param hist histogram
+ * @param n number of samples
+ * @param sum sum of samples
+ * @param stats statistics
+ */
+void histogram_stats(const uint64_t *hist, uint64_t n, uint64_t sum,
+		     struct channel_stats *stats)
+{
+     if (n == 0) {
+	  memset(stats, 0, sizeof(*stats));
+	  return;
+     }
+     
+     stats->mean = (double) sum/n;
+
+     unsigned int v = 0;
+     while (hist[v] == 0)
+	  v++;
+     stats->min = v;
+     v = ADC_COUNTS-1;
+     while (hist[v] == 0)
+	  v--;
+     stats->max = v;
+
+     /* Median is the mean of the values at ranks (n-1)/2 and n/2 */
+     uint64_t rank_lo = (n-1)/2;
+     uint64_t rank_hi = n/2;
+     int median_lo = -1;
+     int median_hi = -1;
+     uint64_t cumulated = 0;
+     for (v = 0; v < ADC_COUNTS && median_hi == -1; v++) {
+	  cumulated += hist[v];
+	  if (median_lo == -1 && cumulated > rank_lo)
+	       median_lo = v;
+	  if (cumulated > rank_hi)
+	       median_hi = v;
+     }
+     stats->median = (median_lo+median_hi)/2.0;
+}
+
+/**
+ * Parse an unsigned decimal number.
+ *
+ * @param p position of first digit; set to the first character behind
+ * the number
+ * @param end end of data
+ * @param value parsed value
+ * @return true if at least one digit was parsed
+ */
+static inline bool parse_uint(const char **p, const char *end,
+			      unsigned int *value)
+{
+     const char *q = *p;
+     unsigned int v = 0;
+     while (q < end && *q >= '0' && *q <= '9') {
+	  v = 10*v + (*q-'0');
+	  q++;
+     }
+     *value = v;
+     bool parsed = (q != *p);
+     *p = q;
+     
+     return parsed;
+}
+
+/**
+ * Parse a calibration log and compute its statistics.
+ *
+ * @param log the log
+ */
+void process_log(struct log *log)
+{
+     int fd = open(log->path, O_RDONLY);
+     if (fd == -1) {
+	  perror(log->path);
+	  log->failed = true;
+	  return;
+     }
+
+     struct stat st;
+     if (fstat(fd, &st) == -1 || st.st_size == 0) {
+	  close(fd);
+	  log->failed = true;
+	  return;
+     }
+
+     const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd,
+			     0);
+     close(fd);
+     if (data == MAP_FAILED) {
+	  perror(log->path);
+	  log->failed = true;
+	  return;
+     }
+     madvise((void *) data, st.st_size, MADV_SEQUENTIAL);
+
+     static __thread uint64_t hist[2][ADC_COUNTS];
+     memset(hist, 0, sizeof(hist));
+     uint64_t sum[2] = {0, 0};
+     uint64_t n = 0;
+     uint64_t invalid = 0;
+     
+     const char *p = data;
+     const char *end = data+st.st_size;
+     while (p < end) {
+	  /* Line format: timestamp,value1,value2[,...] */
+	  const char *eol = memchr(p, '\n', end-p);
+	  if (eol == NULL)
+	       eol = end;
+
+	  const char *q = memchr(p, ',', eol-p);
+	  unsigned int v1, v2;
+	  if (q != NULL) {
+	       q++;
+	       if (parse_uint(&q, eol, &v1) && q < eol && *q == ',') {
+		    q++;
+		    if (parse_uint(&q, eol, &v2) && v1 < ADC_COUNTS &&
+			v2 < ADC_COUNTS) {
+			 hist[0][v1]++;
+			 hist[1][v2]++;
+			 sum[0] += v1;
+			 sum[1] += v2;
+			 n++;
+			 p = eol+1;
+			 continue;
+		    }
+	       }
+	  }
+	  if (eol > p)
+	       invalid++;
+	  p = eol+1;
+     }
+
+     munmap((void *) data, st.st_size);
+
+     log->samples = n;
+     log->invalid_lines = invalid;
+     log->failed = (n == 0);
+     for (int c = 0; c < 2; c++)
+	  histogram_stats(hist[c], n, sum[c], &log->stats[c]);
+}
+
+/**
+ * Worker thread processing logs until all are done.
+ */
+void *worker_loop(void *args)
+{
+     while (true) {
+	  unsigned int i = __atomic_fetch_add(&next_log, 1, __ATOMIC_RELAXED);
+	  if (i >= log_count)
+	       break;
+	  process_log(&logs[i]);
+     }
+
+     return NULL;
+}
+
+/**
+ * Add a log to the list of logs.
+ *
+ * @param dir directory of the log
+ * @param name file name
+ * @param voltage true voltage [mV]
+ * @param current true current [mA]
+ * @return 0 on success; -1 if there are too many logs
+ */
+int add_log(const char *dir, const char *name, double voltage,
+	    double current)
+{
+     if (log_count == MAX_LOGS)
+	  return -1;
+     
+     struct log *log = &logs[log_count++];
+     snprintf(log->path, sizeof(log->path), "%s/%s", dir, name);
+     snprintf(log->name, sizeof(log->name), "%s", name);
+     log->voltage = voltage;
+     log->current = current;
+     log->failed = false;
+
+     return 0;
+}
+
+/**
+ * Find logs by file name (log-<V>mV-<I>mA.dat).
+ *
+ * @param dir directory
+ * @return 0 on success; -1 on error
+ */
+int scan_directory(const char *dir)
+{
+     DIR *d = opendir(dir);
+     if (d == NULL) {
+	  perror("Could not open directory");
+	  return -1;
+     }
+
+     struct dirent *de;
+     while ((de = readdir(d)) != NULL) {
+	  double voltage, current;
+	  int len;
+	  if (sscanf(de->d_name, "log-%lfmV-%lfmA.dat%n", &voltage, &current,
+		     &len) == 2 && de->d_name[len] == '\0') {
+	       if (add_log(dir, de->d_name, voltage, current) == -1) {
+		    fprintf(stderr, "Too many logs\n");
+		    closedir(d);
+		    return -1;
+	       }
+	  }
+     }
+     closedir(d);
+
+     return 0;
+}
+
+/**
+ * Read logs and their true values from a manifest.
+ *
+ * @param dir directory of the logs
+ * @param manifest path of the manifest
+ * @return 0 on success; -1 on error
+ */
+int read_manifest(const char *dir, const char *manifest)
+{
+     FILE *f = fopen(manifest, "r");
+     if (f == NULL) {
+	  perror("Could not open manifest");
+	  return -1;
+     }
+
+     char line[512];
+     while (fgets(line, sizeof(line), f) != NULL) {
+	  if (line[0] == '#')
+	       continue;
+	  char name[256];
+	  double voltage, current;
+	  if (sscanf(line, " %255[^, ] , %lf , %lf", name, &voltage,
+		     &current) != 3)
+	       continue;
+	  if (add_log(dir, name, voltage, current) == -1) {
+	       fprintf(stderr, "Too many logs\n");
+	       fclose(f);
+	       return -1;
+	  }
+     }
+     fclose(f);
+
+     return 0;
+}
+
+int compare_logs(const void *a, const void *b)
+{
+     const struct log *x = a;
+     const struct log *y = b;
+
+     if (x->current != y->current)
+	  return (x->current > y->current) - (x->current < y->current);
+     return (x->voltage > y->voltage) - (x->voltage < y->voltage);
+}
+
+/**
+ * Fit a channel and print the fit and its residuals as comments.
+ *
+ * @param fout output file
+ * @param label name of the fitted quantity
+ * @param unit unit of the fitted quantity
+ * @param x mean ADC counts
+ * @param y true values
+ * @param n number of values
+ */
+void fit_channel(FILE *fout, const char *label, const char *unit,
+		 const double *x, const double *y, unsigned int n)
+{
+     double m, c;
+     if (calib_fit_line(x, y, n, &m, &c) == -1) {
+	  fprintf(fout, "# %s: no fit possible\n", label);
+	  return;
+     }
+
+     fprintf(fout, "# %s [%s] = %.9g * count + %.9g\n", label, unit, m, c);
+
+     double sse = 0.0;
+     double max_residual = 0.0;
+     for (unsigned int i = 0; i < n; i++) {
+	  double residual = y[i] - (m*x[i]+c);
+	  sse += residual*residual;
+	  if (fabs(residual) > fabs(max_residual))
+	       max_residual = residual;
+	  fprintf(fout, "#   %s = %g %s: residual %.4f %s\n", label, y[i],
+		  unit, residual, unit);
+     }
+     fprintf(fout, "#   RMS residual %.4f %s, max. residual %.4f %s\n",
+	     sqrt(sse/n), unit, max_residual, unit);
+}
+
+void usage(const char *appl)
+{
+     fprintf(stderr, "%s [-m MANIFEST] [-j THREADS] [-o OUTFILE] DIR\n",
+	     appl);
+}
+
+int main(int argc, char *argv[])
+{
+     char *manifest = NULL;
+     char *outfile = NULL;
+     long threads = sysconf(_SC_NPROCESSORS_ONLN);
+     int c;
+     while ((c = getopt(argc, argv, "m:j:o:")) != -1) {
+	  switch (c) {
+	  case 'm' :
+	       manifest = optarg;
+	       break;
+	  case 'j' :
+	       threads = atol(optarg);
+	       break;
+	  case 'o' :
+	       outfile = optarg;
+	       break;
+	  default:
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (optind != argc-1) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+     const char *dir = argv[optind];
+     if (threads < 1)
+	  threads = 1;
+
+     int ret;
+     if (manifest != NULL)
+	  ret = read_manifest(dir, manifest);
+     else
+	  ret = scan_directory(dir);
+     if (ret == -1)
+	  exit(-1);
+     if (log_count < 2) {
+	  fprintf(stderr, "At least two calibration logs are required\n");
+	  exit(-1);
+     }
+     if (threads > log_count)
+	  threads = log_count;
+
+     pthread_t workers[threads];
+     for (long i = 0; i < threads; i++) {
+	  if (pthread_create(&workers[i], NULL, worker_loop, NULL)) {
+	       perror("Could not create worker thread");
+	       exit(-1);
+	  }
+     }
+     for (long i = 0; i < threads; i++)
+	  pthread_join(workers[i], NULL);
+
+     qsort(logs, log_count, sizeof(struct log), compare_logs);
+
+     FILE *fout = stdout;
+     if (outfile != NULL) {
+	  fout = fopen(outfile, "w");
+	  if (fout == NULL) {
+	       perror("Could not open output file");
+	       exit(-1);
+	  }
+     }
+
+     double voltage[MAX_LOGS];
+     double current[MAX_LOGS];
+     double voltage_count[MAX_LOGS];
+     double current_count[MAX_LOGS];
+     unsigned int n = 0;
+     
+     fprintf(fout, "# V [mV], I [mA], mean ADC count, median ADC count, "
+	     "mean ADC count (V), median ADC count (V)\n");
+     for (unsigned int i = 0; i < log_count; i++) {
+	  const struct log *log = &logs[i];
+	  if (log->failed) {
+	       fprintf(stderr, "Skipping %s: no samples\n", log->path);
+	       continue;
+	  }
+	  fprintf(fout, "%g, %g, %.4f, %g, %.4f, %g\n", log->voltage,
+		  log->current, log->stats[0].mean, log->stats[0].median,
+		  log->stats[1].mean, log->stats[1].median);
+	  voltage[n] = log->voltage;
+	  current[n] = log->current;
+	  current_count[n] = log->stats[0].mean;
+	  voltage_count[n] = log->stats[1].mean;
+	  n++;
+     }
+
+     fprintf(fout, "#\n# file, samples, invalid lines, "
+	     "min/max/p-p ADC count (I), min/max/p-p ADC count (V)\n");
+     for (unsigned int i = 0; i < log_count; i++) {
+	  const struct log *log = &logs[i];
+	  if (log->failed)
+	       continue;
+	  fprintf(fout, "# %s, %llu, %llu, %u/%u/%u, %u/%u/%u\n", log->name,
+		  (unsigned long long) log->samples,
+		  (unsigned long long) log->invalid_lines,
+		  log->stats[0].min, log->stats[0].max,
+		  log->stats[0].max-log->stats[0].min,
+		  log->stats[1].min, log->stats[1].max,
+		  log->stats[1].max-log->stats[1].min);
+     }
+
+     fprintf(fout, "#\n");
+     fit_channel(fout, "I", "mA", current_count, current, n);
+     fit_channel(fout, "V", "mV", voltage_count, voltage, n);
+
+     if (fout != stdout)
+	  fclose(fout);
+     
+     return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "control.h"
+
+int control_listen(const char *path)
+{
+     struct sockaddr_un address;
+     if (strlen(path) >= sizeof(address.sun_path)) {
+	  errno = ENAMETOOLONG;
+	  return -1;
+     }
+     memset(&address, 0, sizeof(address));
+     address.sun_family = AF_UNIX;
+     strcpy(address.sun_path, path);
+
+     int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+     if (fd == -1)
+	  return -1;
+     unlink(path);
+     if (bind(fd, (struct sockaddr *) &address, sizeof(address)) == -1 ||
+	 listen(fd, 4) == -1) {
+	  int error = errno;
+	  close(fd);
+	  errno = error;
+	  return -1;
+     }
+
+     return fd;
+}
+
+int control_parse(char *line, enum control_command *command, char **arg)
+{
+     static const struct {
+	  const char *name;
+	  enum control_command command;
+	  /* Argument required (1), not taken (0), or optional (-1) */
+	  int arg;
+     } commands[] = {
+	  {"start", CONTROL_START, 1},
+	  {"rotate", CONTROL_ROTATE, 1},
+	  {"stop", CONTROL_STOP, 0},
+	  {"status", CONTROL_STATUS, 0},
+	  {"quit", CONTROL_QUIT, 0},
+	  {"begin", CONTROL_BEGIN, 1},
+	  {"end", CONTROL_END, -1}
+     };
+
+     line[strcspn(line, "\r\n")] = '\0';
+     char *space = strchr(line, ' ');
+     *arg = NULL;
+     if (space != NULL) {
+	  *space = '\0';
+	  *arg = space+1;
+	  while (**arg == ' ')
+	       (*arg)++;
+	  if (**arg == '\0')
+	       *arg = NULL;
+     }
+
+     for (unsigned int i = 0; i < sizeof(commands)/sizeof(commands[0]);
+	  i++) {
+	  if (strcmp(line, commands[i].name) == 0) {
+	       if (commands[i].arg != -1 &&
+		   commands[i].arg != (*arg != NULL))
+		    return -1;
+	       *command = commands[i].command;
+	       return 0;
+	  }
+     }
+
+     return -1;
+}
+
+/* Pending request after control_close() */
+static struct control_request closed;
+
+int control_switch(struct control_request **pending,
+		   struct control_request *request)
+{
+     request->previous = NULL;
+     request->done = false;
+     struct control_request *none = NULL;
+     if (!__atomic_compare_exchange_n(pending, &none, request, false,
+				      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	  return -1;
+
+     struct timespec tpoll = {0, CONTROL_POLL_INTERVAL};
+     while (!__atomic_load_n(&request->done, __ATOMIC_ACQUIRE))
+	  clock_nanosleep(CLOCK_MONOTONIC, 0, &tpoll, NULL);
+
+     return 0;
+}
+
+struct control_request *control_due(struct control_request **pending,
+				    const uint64_t *timestamps,
+				    unsigned int n, unsigned int *first)
+{
+     struct control_request *request = __atomic_load_n(pending,
+						       __ATOMIC_ACQUIRE);
+     if (request == NULL || request == &closed)
+	  return NULL;
+
+     /* Scans arrive in order of their timestamps, so all scans before the
+	time of the request have been logged once a later one arrives. */
+     unsigned int k = 0;
+     while (k < n && timestamps[k] < request->time)
+	  k++;
+     if (k == n)
+	  return NULL;
+
+     *first = k;
+     __atomic_store_n(pending, NULL, __ATOMIC_RELAXED);
+     return request;
+}
+
+void control_done(struct control_request *request,
+		  struct recording *previous)
+{
+     request->previous = previous;
+     __atomic_store_n(&request->done, true, __ATOMIC_RELEASE);
+}
+
+struct control_request *control_close(struct control_request **pending)
+{
+     struct control_request *request = __atomic_exchange_n(pending, &closed,
+							   __ATOMIC_ACQUIRE);
+     return (request != &closed ? request : NULL);
+}
@@ -0,0 +1,146 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "recording.h"
+
+/* Control protocol of the daemon mode: a client connects to a Unix
+   stream socket and sends commands, one per line. Each command is
+   answered by one line starting with "ok" or "error".
+
+   start PATH   start a recording into the log file PATH
+   rotate PATH  continue the recording in the log file PATH
+   stop         stop the recording
+   status       "ok recording PATH SCANS" or "ok idle"
+   quit         stop the recording and terminate powermeter
+   begin NAME [TIMESTAMP]
+                begin phase NAME (see phase.h)
+   end [TIMESTAMP]
+                end the current phase
+
+   start, rotate, and stop take effect at the time the command is read:
+   all scans sampled before go to the previous log file (if any), all
+   scans sampled from then on to the next one (if any). rotate, stop, and
+   quit answer after the previous log file is closed, with its counters:
+   "ok scans=N gaps=N lost=N [events=N captured=N] [energy_mj=E]".
+   begin and end answer "ok" once the marker is queued; the phase ended
+   is reported when the logger thread reaches its end. */
+
+/* Maximum length of a command */
+#define CONTROL_MAX_LINE 4096
+
+/* The control thread checks every CONTROL_POLL_INTERVAL ns whether the
+   logger thread carried out a request. */
+#define CONTROL_POLL_INTERVAL 1000000
+
+enum control_command {
+     CONTROL_START,
+     CONTROL_ROTATE,
+     CONTROL_STOP,
+     CONTROL_STATUS,
+     CONTROL_QUIT,
+     CONTROL_BEGIN,
+     CONTROL_END
+};
+
+/**
+ * Request to the logger thread to switch to another recording.
+ */
+struct control_request {
+     /* Scans from this time on go to the next recording */
+     uint64_t time;
+     /* Recording to switch to (NULL to stop recording) */
+     struct recording *next;
+     /* Set by the logger thread to the recording switched from (NULL if
+	none) */
+     struct recording *previous;
+     /* Set by the logger thread when it switched */
+     bool done;
+};
+
+/**
+ * Create the control socket. An existing socket file is replaced.
+ *
+ * @param path path of the socket
+ * @return file descriptor of the listening socket; -1 on error (errno is
+ * set)
+ */
+int control_listen(const char *path);
+
+/**
+ * Parse a command.
+ *
+ * @param line the line of the command (modified)
+ * @param command set to the command
+ * @param arg set to the argument of start, rotate, begin, and end (NULL if
+ * none)
+ * @return 0 on success; -1 if the command is unknown or lacks its
+ * argument
+ */
+int control_parse(char *line, enum control_command *command, char **arg);
+
+/**
+ * Hand a request to the logger thread and wait until it has switched.
+ *
+ * @param pending pending request, read by the logger thread after each
+ * batch
+ * @param request the request (time and next must be set)
+ * @return 0 on success; -1 if requests are no longer taken
+ * (control_close())
+ */
+int control_switch(struct control_request **pending,
+		   struct control_request *request);
+
+/**
+ * Take the pending request if its time has come, i.e., if a batch holds a
+ * scan at or after its time. Must only be called by the logger thread.
+ *
+ * @param pending pending request
+ * @param timestamps timestamps of the scans of the batch
+ * @param n number of scans of the batch
+ * @param first set to the index of the first scan at or after the time of
+ * the request
+ * @return the request; NULL if none is due
+ */
+struct control_request *control_due(struct control_request **pending,
+				    const uint64_t *timestamps,
+				    unsigned int n, unsigned int *first);
+
+/**
+ * Tell the control thread that a request was carried out.
+ *
+ * @param request the request
+ * @param previous recording switched from
+ */
+void control_done(struct control_request *request,
+		  struct recording *previous);
+
+/**
+ * Stop taking requests once the logger thread has terminated.
+ *
+ * @param pending pending request
+ * @return the request pending (which must be carried out by the caller,
+ * since no scan after its time was logged); NULL if none
+ */
+struct control_request *control_close(struct control_request **pending);
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include "deadline.h"
+
+void deadline_queue_init(struct deadline_queue *q)
+{
+     q->length = 0;
+}
+
+/**
+ * Swap two elements of the heap.
+ */
+static void swap(struct deadline_queue *q, unsigned int i, unsigned int j)
+{
+     unsigned int task = q->tasks[i];
+     uint64_t deadline = q->deadlines[i];
+     
+     q->tasks[i] = q->tasks[j];
+     q->deadlines[i] = q->deadlines[j];
+     q->tasks[j] = task;
+     q->deadlines[j] = deadline;
+}
+
+int deadline_queue_push(struct deadline_queue *q, unsigned int task,
+			uint64_t deadline)
+{
+     if (q->length == DEADLINE_QUEUE_SIZE)
+	  return -1;
+
+     unsigned int i = q->length++;
+     q->tasks[i] = task;
+     q->deadlines[i] = deadline;
+
+     /* Sift up */
+     while (i > 0) {
+	  unsigned int parent = (i-1)/2;
+	  if (q->deadlines[parent] <= q->deadlines[i])
+	       break;
+	  swap(q, i, parent);
+	  i = parent;
+     }
+
+     return 0;
+}
+
+unsigned int deadline_queue_pop(struct deadline_queue *q, uint64_t *deadline)
+{
+     unsigned int task = q->tasks[0];
+     *deadline = q->deadlines[0];
+
+     q->length--;
+     q->tasks[0] = q->tasks[q->length];
+     q->deadlines[0] = q->deadlines[q->length];
+
+     /* Sift down */
+     unsigned int i = 0;
+     while (true) {
+	  unsigned int smallest = i;
+	  unsigned int left = 2*i+1;
+	  unsigned int right = 2*i+2;
+	  if (left < q->length && q->deadlines[left] < q->deadlines[smallest])
+	       smallest = left;
+	  if (right < q->length &&
+	      q->deadlines[right] < q->deadlines[smallest])
+	       smallest = right;
+	  if (smallest == i)
+	       break;
+	  swap(q, i, smallest);
+	  i = smallest;
+     }
+
+     return task;
+}
@@ -0,0 +1,76 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdint.h>
+
+/* Maximum number of tasks in a deadline queue */
+#define DEADLINE_QUEUE_SIZE 16
+
+/**
+ * Priority queue of tasks (identified by small integers) ordered by their
+ * absolute deadline, implemented as binary min-heap.
+ */
+struct deadline_queue {
+     unsigned int length;
+     unsigned int tasks[DEADLINE_QUEUE_SIZE];
+     uint64_t deadlines[DEADLINE_QUEUE_SIZE];
+};
+
+/**
+ * Initialize an empty deadline queue.
+ *
+ * @param q the queue
+ */
+void deadline_queue_init(struct deadline_queue *q);
+
+/**
+ * Add a task to a deadline queue.
+ *
+ * @param q the queue
+ * @param task task identifier
+ * @param deadline absolute deadline in nanoseconds
+ * @return 0 on success; -1 if the queue is full
+ */
+int deadline_queue_push(struct deadline_queue *q, unsigned int task,
+			uint64_t deadline);
+
+/**
+ * Remove the task with the earliest deadline from a non-empty deadline
+ * queue.
+ *
+ * @param q the queue
+ * @param deadline set to the deadline of the task
+ * @return task identifier
+ */
+unsigned int deadline_queue_pop(struct deadline_queue *q, uint64_t *deadline);
+
+/**
+ * Get the earliest deadline of a non-empty deadline queue.
+ *
+ * @param q the queue
+ * @return earliest deadline
+ */
+static inline uint64_t deadline_queue_next(const struct deadline_queue *q)
+{
+     return q->deadlines[0];
+}
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "decimate.h"
+
+int decimator_init(struct decimator *d, enum decimation_filter filter,
+		   unsigned int factor)
+{
+     if (factor == 0 || factor > DECIMATOR_MAX_FACTOR ||
+	 (factor & (factor-1)) != 0)
+	  return -1;
+
+     memset(d, 0, sizeof(*d));
+     d->filter = filter;
+     d->factor = factor;
+     while ((1u << d->factor_bits) < factor)
+	  d->factor_bits++;
+
+     if (filter == DECIMATE_FIR) {
+	  /* Hann window without the zero end points */
+	  double sum = 0.0;
+	  double w[DECIMATOR_MAX_FACTOR];
+	  for (unsigned int b = 0; b < factor; b++) {
+	       w[b] = 0.5-0.5*cos(2.0*M_PI*(b+1)/(factor+1));
+	       sum += w[b];
+	  }
+	  uint32_t total = 0;
+	  for (unsigned int b = 0; b < factor; b++) {
+	       d->taps[b] = (uint32_t) lround(w[b]/sum*65536.0);
+	       total += d->taps[b];
+	  }
+	  /* Put the rounding error into the center tap, so the filter has
+	     unity gain. */
+	  d->taps[factor/2] += 65536-total;
+     }
+
+     return 0;
+}
+
+/**
+ * Average the conversions of a burst.
+ */
+static void run_boxcar(const struct decimator *d, const uint16_t *burst,
+		       unsigned int count, uint16_t *values)
+{
+     uint32_t sums[DECIMATOR_MAX_INPUTS];
+
+     memset(sums, 0, count*sizeof(sums[0]));
+     for (unsigned int b = 0; b < d->factor; b++) {
+	  const uint16_t *x = &burst[b*count];
+	  for (unsigned int k = 0; k < count; k++)
+	       sums[k] += x[k];
+     }
+
+     /* sum/factor with DECIMATOR_FRAC_BITS fractional bits, rounded */
+     unsigned int shift = d->factor_bits;
+     for (unsigned int k = 0; k < count; k++) {
+	  uint32_t v = sums[k] << DECIMATOR_FRAC_BITS;
+	  values[k] = (v + ((1u << shift) >> 1)) >> shift;
+     }
+}
+
+/**
+ * Weight the conversions of a burst by the FIR coefficients.
+ */
+static void run_fir(const struct decimator *d, const uint16_t *burst,
+		    unsigned int count, uint16_t *values)
+{
+     uint32_t sums[DECIMATOR_MAX_INPUTS];
+
+     /* At most 4095*65536, so the sums fit into 32 bit. */
+     memset(sums, 0, count*sizeof(sums[0]));
+     for (unsigned int b = 0; b < d->factor; b++) {
+	  const uint16_t *x = &burst[b*count];
+	  uint32_t tap = d->taps[b];
+	  for (unsigned int k = 0; k < count; k++)
+	       sums[k] += tap*x[k];
+     }
+
+     unsigned int shift = 16-DECIMATOR_FRAC_BITS;
+     for (unsigned int k = 0; k < count; k++)
+	  values[k] = (sums[k] + (1u << (shift-1))) >> shift;
+}
+
+/**
+ * Run the integrators of a CIC filter over the conversions of a burst
+ * and the combs once at the end of the burst.
+ */
+static void run_cic(struct decimator *d, const uint16_t *burst,
+		    const unsigned int *inputs, unsigned int count,
+		    uint16_t *values)
+{
+     uint64_t integrators[DECIMATOR_CIC_ORDER][DECIMATOR_MAX_INPUTS];
+
+     for (unsigned int s = 0; s < DECIMATOR_CIC_ORDER; s++) {
+	  for (unsigned int k = 0; k < count; k++)
+	       integrators[s][k] = d->integrators[s][inputs[k]];
+     }
+
+     for (unsigned int b = 0; b < d->factor; b++) {
+	  const uint16_t *x = &burst[b*count];
+	  for (unsigned int k = 0; k < count; k++) {
+	       integrators[0][k] += x[k];
+	       integrators[1][k] += integrators[0][k];
+	       integrators[2][k] += integrators[1][k];
+	  }
+     }
+
+     /* The gain of the filter is factor^DECIMATOR_CIC_ORDER. */
+     unsigned int shift = DECIMATOR_CIC_ORDER*d->factor_bits;
+     for (unsigned int k = 0; k < count; k++) {
+	  unsigned int i = inputs[k];
+	  uint64_t y = integrators[DECIMATOR_CIC_ORDER-1][k];
+	  for (unsigned int s = 0; s < DECIMATOR_CIC_ORDER; s++) {
+	       uint64_t delayed = d->combs[s][i];
+	       d->combs[s][i] = y;
+	       y -= delayed;
+	  }
+	  for (unsigned int s = 0; s < DECIMATOR_CIC_ORDER; s++)
+	       d->integrators[s][i] = integrators[s][k];
+
+	  /* Transients after startup may exceed the range. */
+	  int64_t v = (int64_t) y;
+	  v = ((v << DECIMATOR_FRAC_BITS) + (((int64_t) 1 << shift) >> 1)) >>
+	       shift;
+	  if (v < 0)
+	       v = 0;
+	  else if (v > (4095 << DECIMATOR_FRAC_BITS))
+	       v = 4095 << DECIMATOR_FRAC_BITS;
+	  values[k] = v;
+     }
+}
+
+void decimator_run(struct decimator *d, const uint16_t *burst,
+		   const unsigned int *inputs, unsigned int count,
+		   uint16_t *values)
+{
+     switch (d->filter) {
+     case DECIMATE_BOXCAR:
+	  run_boxcar(d, burst, count, values);
+	  break;
+     case DECIMATE_FIR:
+	  run_fir(d, burst, count, values);
+	  break;
+     case DECIMATE_CIC:
+	  run_cic(d, burst, inputs, count, values);
+	  break;
+     }
+}
@@ -0,0 +1,99 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DECIMATE_H
+#define DECIMATE_H
+
+#include <stdint.h>
+
+/* Maximum number of inputs filtered at once */
+#define DECIMATOR_MAX_INPUTS 16
+
+/* Maximum oversampling factor (conversions per output value) */
+#define DECIMATOR_MAX_FACTOR 256
+
+/* Output values are fixed-point numbers with this many fractional bits,
+   i.e., 12 bit ADC counts scaled by 16. The largest value (4095*16) stays
+   below RING_NO_VALUE. */
+#define DECIMATOR_FRAC_BITS 4
+
+/* Number of integrator and comb stages of the CIC filter */
+#define DECIMATOR_CIC_ORDER 3
+
+enum decimation_filter {
+     /* Average of the conversions of a burst */
+     DECIMATE_BOXCAR,
+     /* Cascaded integrator-comb filter over the conversions of all bursts
+	of an input. The first DECIMATOR_CIC_ORDER-1 output values are
+	transients. */
+     DECIMATE_CIC,
+     /* Hann-windowed average of the conversions of a burst */
+     DECIMATE_FIR
+};
+
+/**
+ * Decimation filter reducing bursts of conversions of several inputs to
+ * one value per input.
+ *
+ * Bursts are stored conversion by conversion (all inputs of the first
+ * conversion, all inputs of the second conversion, ...), so every filter
+ * kernel runs an inner loop over the inputs of one conversion, which the
+ * compiler vectorizes (e.g., NEON or SSE). Filters only use integer
+ * arithmetic; the factor is a power of two, so normalization is a shift.
+ */
+struct decimator {
+     enum decimation_filter filter;
+     unsigned int factor;
+     unsigned int factor_bits;
+     /* FIR coefficients; they sum up to 1 << 16. */
+     uint32_t taps[DECIMATOR_MAX_FACTOR];
+     /* CIC integrators and delayed comb inputs of each input. Integers
+	wrap around, which does not affect the result of a CIC filter. */
+     uint64_t integrators[DECIMATOR_CIC_ORDER][DECIMATOR_MAX_INPUTS];
+     uint64_t combs[DECIMATOR_CIC_ORDER][DECIMATOR_MAX_INPUTS];
+};
+
+/**
+ * Initialize a decimator.
+ *
+ * @param d the decimator
+ * @param filter the filter
+ * @param factor number of conversions per output value; a power of two
+ * up to DECIMATOR_MAX_FACTOR
+ * @return 0 on success; -1 if the factor is invalid
+ */
+int decimator_init(struct decimator *d, enum decimation_filter filter,
+		   unsigned int factor);
+
+/**
+ * Reduce a burst of conversions to one value per input.
+ *
+ * @param d the decimator
+ * @param burst factor*count conversions: count values of the first
+ * conversion, count values of the second conversion, and so on
+ * @param inputs input (0 to DECIMATOR_MAX_INPUTS-1) of each of the count
+ * values of a conversion; selects the filter state of CIC filters
+ * @param count number of inputs
+ * @param values set to count output values with DECIMATOR_FRAC_BITS
+ * fractional bits
+ */
+void decimator_run(struct decimator *d, const uint16_t *burst,
+		   const unsigned int *inputs, unsigned int count,
+		   uint16_t *values);
+
+#endif
@@ -0,0 +1,209 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "feed.h"
+
+/**
+ * Get the slot of an entry.
+ *
+ * @param slots start of the slots
+ * @param h feed header
+ * @param n entry number
+ * @return the slot
+ */
+static inline struct feed_entry *slot(const uint8_t *slots,
+				      const struct feed_header *h,
+				      uint64_t n)
+{
+     return (struct feed_entry *) (slots +
+				   (size_t) (n & (h->size-1))*h->entry_size);
+}
+
+int feed_create(struct feed_writer *w, const char *name,
+		unsigned int channel_count, unsigned int size,
+		uint64_t sampling_interval, unsigned int frac_bits)
+{
+     if (channel_count == 0 || channel_count > FEED_MAX_CHANNELS ||
+	 size == 0 || size > (1u << 30)) {
+	  errno = EINVAL;
+	  return -1;
+     }
+
+     unsigned int n = 1;
+     while (n < size)
+	  n <<= 1;
+     size_t entry_size = (sizeof(struct feed_entry) +
+			  channel_count*sizeof(uint16_t) + 7) & ~((size_t) 7);
+     w->map_size = sizeof(struct feed_header) + n*entry_size;
+
+     /* Replace an old feed; its readers keep their (stale) mapping. */
+     shm_unlink(name);
+     int fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0644);
+     if (fd == -1)
+	  return -1;
+     if (ftruncate(fd, w->map_size) == -1) {
+	  close(fd);
+	  shm_unlink(name);
+	  return -1;
+     }
+     void *map = mmap(NULL, w->map_size, PROT_READ|PROT_WRITE, MAP_SHARED,
+		      fd, 0);
+     close(fd);
+     if (map == MAP_FAILED) {
+	  shm_unlink(name);
+	  return -1;
+     }
+     w->name = strdup(name);
+     w->header = map;
+     w->slots = (uint8_t *) map + sizeof(struct feed_header);
+     w->head = 0;
+
+     /* Touch all pages now rather than in the logger thread. */
+     memset(map, 0, w->map_size);
+     w->header->version = FEED_VERSION;
+     w->header->channel_count = channel_count;
+     w->header->size = n;
+     w->header->entry_size = entry_size;
+     w->header->sampling_interval = sampling_interval;
+     w->header->frac_bits = frac_bits;
+     /* Readers check the magic first. */
+     __atomic_thread_fence(__ATOMIC_RELEASE);
+     memcpy(w->header->magic, FEED_MAGIC, sizeof(FEED_MAGIC));
+
+     return 0;
+}
+
+void feed_publish(struct feed_writer *w, const uint64_t *timestamps,
+		  const uint16_t *values, unsigned int n)
+{
+     struct feed_header *h = w->header;
+     unsigned int cc = h->channel_count;
+
+     for (unsigned int i = 0; i < n; i++) {
+	  struct feed_entry *e = slot(w->slots, h, w->head);
+	  __atomic_store_n(&e->seq, 2*w->head+1, __ATOMIC_RELAXED);
+	  /* Readers must see the odd sequence number before any of the
+	     new data (store-store barrier). */
+	  __atomic_thread_fence(__ATOMIC_RELEASE);
+	  e->timestamp = timestamps[i];
+	  memcpy(e->values, &values[i*cc], cc*sizeof(uint16_t));
+	  __atomic_store_n(&e->seq, 2*w->head+2, __ATOMIC_RELEASE);
+	  w->head++;
+     }
+
+     __atomic_store_n(&h->head, w->head, __ATOMIC_RELEASE);
+}
+
+void feed_close(struct feed_writer *w)
+{
+     munmap(w->header, w->map_size);
+     free(w->name);
+}
+
+int feed_open(struct feed_reader *r, const char *name)
+{
+     int fd = shm_open(name, O_RDONLY, 0);
+     if (fd == -1)
+	  return -1;
+
+     struct stat st;
+     if (fstat(fd, &st) == -1) {
+	  close(fd);
+	  return -1;
+     }
+     r->map_size = st.st_size;
+     if (r->map_size < sizeof(struct feed_header)) {
+	  close(fd);
+	  errno = EINVAL;
+	  return -1;
+     }
+     void *map = mmap(NULL, r->map_size, PROT_READ, MAP_SHARED, fd, 0);
+     close(fd);
+     if (map == MAP_FAILED)
+	  return -1;
+     r->header = map;
+     r->slots = (const uint8_t *) map + sizeof(struct feed_header);
+
+     const struct feed_header *h = r->header;
+     bool valid = (memcmp(h->magic, FEED_MAGIC, sizeof(FEED_MAGIC)) == 0);
+     __atomic_thread_fence(__ATOMIC_ACQUIRE);
+     if (!valid || h->version != FEED_VERSION ||
+	 h->channel_count == 0 || h->channel_count > FEED_MAX_CHANNELS ||
+	 h->size == 0 || (h->size & (h->size-1)) != 0 ||
+	 h->entry_size < sizeof(struct feed_entry) +
+	 h->channel_count*sizeof(uint16_t) ||
+	 r->map_size < sizeof(struct feed_header) +
+	 (size_t) h->size*h->entry_size) {
+	  feed_reader_close(r);
+	  errno = EINVAL;
+	  return -1;
+     }
+
+     r->next = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+
+     return 0;
+}
+
+unsigned int feed_read(struct feed_reader *r, uint64_t *timestamps,
+		       uint16_t *values, unsigned int max, uint64_t *lost)
+{
+     const struct feed_header *h = r->header;
+     unsigned int cc = h->channel_count;
+     uint64_t head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+
+     *lost = 0;
+     unsigned int count = 0;
+     while (count < max && r->next < head) {
+	  uint64_t n = r->next;
+	  const struct feed_entry *e = slot(r->slots, h, n);
+	  uint64_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+	  if (seq == 2*n+2) {
+	       timestamps[count] = e->timestamp;
+	       memcpy(&values[count*cc], e->values, cc*sizeof(uint16_t));
+	       __atomic_thread_fence(__ATOMIC_ACQUIRE);
+	       if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == seq) {
+		    count++;
+		    r->next++;
+		    continue;
+	       }
+	  }
+
+	  /* The writer has overwritten the entry. Continue with the oldest
+	     entry that cannot be in the process of being overwritten. */
+	  head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+	  uint64_t oldest = (head >= h->size ? head-h->size+1 : 0);
+	  if (oldest <= n)
+	       oldest = n+1;
+	  *lost += oldest-n;
+	  r->next = oldest;
+     }
+
+     return count;
+}
+
+void feed_reader_close(struct feed_reader *r)
+{
+     munmap((void *) r->header, r->map_size);
+}
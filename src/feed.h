@@ -0,0 +1,166 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FEED_H
+#define FEED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Live feed of samples in POSIX shared memory
+
+   powermeter publishes every scan into a ring in a shared memory object
+   (/dev/shm/NAME), which any number of local readers map read-only. There
+   is a single writer and no lock: every slot has a sequence number, which
+   the writer sets to 2n+1 before and to 2n+2 after writing entry n into
+   the slot (n counts from 0). A reader copies entry n from its slot and
+   only accepts the copy if the sequence number was 2n+2 before and after
+   copying, like a seqlock. A larger sequence number means the writer has
+   overwritten the entry, i.e., the reader was too slow and lost entries
+   (overrun); it then continues with the oldest entry still available.
+   Readers never write to the shared memory, so they cannot delay the
+   writer or each other.
+
+   The object starts with struct feed_header, followed by size slots of
+   entry_size bytes (struct feed_entry with channel_count values). All
+   values are in host byte order. */
+
+#define FEED_MAGIC "PMFEED"
+#define FEED_VERSION 1
+
+/* Default number of entries of the ring (about 65 s at 1 kHz) */
+#define FEED_DEFAULT_SIZE 65536
+
+/* Maximum number of values per entry */
+#define FEED_MAX_CHANNELS 16
+
+struct feed_header {
+     char magic[8];
+     uint32_t version;
+     uint32_t channel_count;
+     /* Number of slots (power of two) and size of a slot in bytes */
+     uint32_t size;
+     uint32_t entry_size;
+     /* Nominal interval between entries in nanoseconds */
+     uint64_t sampling_interval;
+     /* Fractional bits of the values (oversampled inputs) */
+     uint32_t frac_bits;
+     uint32_t reserved;
+     /* Number of entries published so far */
+     uint64_t head __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+struct feed_entry {
+     /* 2n+1 while entry n is written, 2n+2 afterwards */
+     uint64_t seq;
+     uint64_t timestamp;
+     /* channel_count values (0xffff for inputs not sampled in a scan) */
+     uint16_t values[];
+};
+
+/**
+ * Writer side of a feed.
+ */
+struct feed_writer {
+     char *name;
+     struct feed_header *header;
+     uint8_t *slots;
+     size_t map_size;
+     uint64_t head;
+};
+
+/**
+ * Reader side of a feed.
+ */
+struct feed_reader {
+     const struct feed_header *header;
+     const uint8_t *slots;
+     size_t map_size;
+     /* Next entry to be read */
+     uint64_t next;
+};
+
+/**
+ * Create a feed. An existing feed of the same name is replaced; readers
+ * of the old feed must reopen the feed.
+ *
+ * @param w the writer
+ * @param name name of the shared memory object (e.g., "/powermeter")
+ * @param channel_count number of values per entry
+ * @param size number of entries (rounded up to a power of two)
+ * @param sampling_interval nominal interval between entries in ns
+ * @param frac_bits fractional bits of the values
+ * @return 0 on success; -1 on error (errno is set)
+ */
+int feed_create(struct feed_writer *w, const char *name,
+		unsigned int channel_count, unsigned int size,
+		uint64_t sampling_interval, unsigned int frac_bits);
+
+/**
+ * Publish entries. Never blocks.
+ *
+ * @param w the writer
+ * @param timestamps timestamps of the entries
+ * @param values channel_count values per entry
+ * @param n number of entries
+ */
+void feed_publish(struct feed_writer *w, const uint64_t *timestamps,
+		  const uint16_t *values, unsigned int n);
+
+/**
+ * Unmap a feed. The shared memory object persists, so readers can still
+ * read the last entries; it is replaced by the next feed_create().
+ *
+ * @param w the writer
+ */
+void feed_close(struct feed_writer *w);
+
+/**
+ * Map a feed for reading. Reading starts with the next entry published.
+ *
+ * @param r the reader
+ * @param name name of the shared memory object
+ * @return 0 on success; -1 on error (errno is set, EINVAL if the object
+ * is not a feed)
+ */
+int feed_open(struct feed_reader *r, const char *name);
+
+/**
+ * Read the entries published since the last call, up to a maximum number.
+ * Never blocks.
+ *
+ * @param r the reader
+ * @param timestamps array to copy the timestamps to
+ * @param values array to copy the values to (max*channel_count values)
+ * @param max maximum number of entries to be read
+ * @param lost set to the number of entries lost since the last call
+ * because the reader was too slow
+ * @return number of entries read (0 if no new entries are available)
+ */
+unsigned int feed_read(struct feed_reader *r, uint64_t *timestamps,
+		       uint16_t *values, unsigned int max, uint64_t *lost);
+
+/**
+ * Unmap a feed.
+ *
+ * @param r the reader
+ */
+void feed_reader_close(struct feed_reader *r);
+
+#endif
@@ -0,0 +1,105 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Example consumer of the live feed of powermeter (-L NAME): prints the
+   entries of the feed in the CSV format of powermeter as they are
+   published, and a line "# lost N" if the consumer was too slow and N
+   entries were overwritten before it could read them.
+
+   Usage: feedcat [-n ENTRIES] NAME
+
+   Build with the client library: cc feedcat.c libpmfeed.a -lrt */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include "feed.h"
+
+/* Maximum number of entries read at once */
+#define BATCH 256
+
+/* Time to wait if no new entries are available */
+#define POLL_INTERVAL_NS 10000000
+
+void usage(const char *appl)
+{
+     fprintf(stderr, "%s [-n ENTRIES] NAME\n", appl);
+}
+
+int main(int argc, char *argv[])
+{
+     unsigned long entries_total = 0;
+     int c;
+     while ((c = getopt(argc, argv, "n:")) != -1) {
+	  switch (c) {
+	  case 'n' :
+	       entries_total = strtoul(optarg, NULL, 10);
+	       break;
+	  default:
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (optind != argc-1) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     struct feed_reader reader;
+     if (feed_open(&reader, argv[optind]) == -1) {
+	  perror("Could not open feed");
+	  exit(-1);
+     }
+     unsigned int cc = reader.header->channel_count;
+
+     uint64_t timestamps[BATCH];
+     uint16_t values[BATCH*FEED_MAX_CHANNELS];
+     unsigned long entries = 0;
+     while (entries_total == 0 || entries < entries_total) {
+	  uint64_t lost;
+	  unsigned int n = feed_read(&reader, timestamps, values, BATCH,
+				     &lost);
+	  if (lost > 0)
+	       printf("# lost %llu\n", (unsigned long long) lost);
+	  if (n == 0) {
+	       fflush(stdout);
+	       struct timespec t = {0, POLL_INTERVAL_NS};
+	       nanosleep(&t, NULL);
+	       continue;
+	  }
+	  
+	  for (unsigned int i = 0; i < n; i++) {
+	       printf("%llu", (unsigned long long) timestamps[i]);
+	       for (unsigned int k = 0; k < cc; k++) {
+		    uint16_t v = values[i*cc+k];
+		    if (v == 0xffff)
+			 printf(",");
+		    else
+			 printf(",%u", v);
+	       }
+	       printf("\n");
+	       if (++entries == entries_total)
+		    break;
+	  }
+     }
+
+     feed_reader_close(&reader);
+
+     return 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "histogram.h"
+
+/* Percentiles printed by histogram_print() */
+static const double percentiles[] = {50.0, 90.0, 99.0, 99.9, 99.99};
+
+#define PERCENTILE_COUNT (sizeof(percentiles)/sizeof(percentiles[0]))
+
+void histogram_init(struct histogram *h, const char *name)
+{
+     memset(h, 0, sizeof(*h));
+     h->name = name;
+     h->min = UINT64_MAX;
+}
+
+void histogram_snapshot(const struct histogram *h,
+			struct histogram *snapshot)
+{
+     snapshot->name = h->name;
+     /* The count is read first, so the buckets hold at least count
+	values. */
+     snapshot->count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+     snapshot->sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+     snapshot->min = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+     snapshot->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+     for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	  snapshot->buckets[i] = __atomic_load_n(&h->buckets[i],
+						 __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the largest value counted in a bucket.
+ *
+ * @param bucket index of the bucket
+ * @return upper bound of the bucket
+ */
+static uint64_t bucket_upper_bound(unsigned int bucket)
+{
+     if (bucket < HISTOGRAM_SUB_BUCKETS)
+	  return bucket;
+
+     unsigned int shift = bucket/HISTOGRAM_SUB_BUCKETS - 1;
+     uint64_t sub = bucket%HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+     return ((sub+1) << shift) - 1;
+}
+
+uint64_t histogram_percentile(const struct histogram *h, double percentile)
+{
+     if (h->count == 0)
+	  return 0;
+
+     /* Rank of the percentile, counting from 1 */
+     uint64_t rank = (uint64_t) (percentile/100.0*h->count + 0.5);
+     if (rank == 0)
+	  rank = 1;
+
+     uint64_t n = 0;
+     for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+	  n += h->buckets[i];
+	  if (n >= rank) {
+	       uint64_t bound = bucket_upper_bound(i);
+	       return (bound < h->max ? bound : h->max);
+	  }
+     }
+
+     return h->max;
+}
+
+void histogram_print_header(FILE *f)
+{
+     fprintf(f, "%-16s %10s %10s", "[ns]", "count", "min");
+     for (unsigned int i = 0; i < PERCENTILE_COUNT; i++) {
+	  char name[16];
+	  snprintf(name, sizeof(name), "p%g", percentiles[i]);
+	  fprintf(f, " %10s", name);
+     }
+     fprintf(f, " %10s %10s\n", "max", "mean");
+}
+
+void histogram_print(FILE *f, const struct histogram *h)
+{
+     fprintf(f, "%-16s %10llu %10llu", h->name,
+	     (unsigned long long) h->count,
+	     (unsigned long long) (h->count > 0 ? h->min : 0));
+     for (unsigned int i = 0; i < PERCENTILE_COUNT; i++)
+	  fprintf(f, " %10llu", (unsigned long long)
+		  histogram_percentile(h, percentiles[i]));
+     fprintf(f, " %10llu %10llu\n", (unsigned long long) h->max,
+	     (unsigned long long) (h->count > 0 ? h->sum/h->count : 0));
+}
@@ -0,0 +1,131 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Values are counted in buckets of logarithmically growing width: each
+   power of two is split into 2^HISTOGRAM_SUB_BITS buckets, so the relative
+   error of a percentile is below 1/2^HISTOGRAM_SUB_BITS. Values below
+   2^HISTOGRAM_SUB_BITS are counted exactly, values of 2^HISTOGRAM_MAX_BITS
+   and more (about 18 minutes in nanoseconds) in the last bucket. */
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS-HISTOGRAM_SUB_BITS+1)* \
+			   HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * Histogram of values with a single writer.
+ *
+ * The writer never takes a lock; every counter is updated by a relaxed
+ * atomic store, so other threads can take snapshots at any time (a
+ * snapshot may miss the value recorded concurrently).
+ */
+struct histogram {
+     const char *name;
+     uint64_t count;
+     uint64_t sum;
+     uint64_t min;
+     uint64_t max;
+     uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Initialize an empty histogram.
+ *
+ * @param h the histogram
+ * @param name name printed with the histogram
+ */
+void histogram_init(struct histogram *h, const char *name);
+
+/**
+ * Get the bucket of a value.
+ *
+ * @param value the value
+ * @return index of the bucket
+ */
+static inline unsigned int histogram_bucket(uint64_t value)
+{
+     if (value < HISTOGRAM_SUB_BUCKETS)
+	  return value;
+     if (value >= (1ull << HISTOGRAM_MAX_BITS))
+	  return HISTOGRAM_BUCKETS-1;
+
+     unsigned int msb = 63-__builtin_clzll(value);
+     unsigned int shift = msb-HISTOGRAM_SUB_BITS;
+     return (shift+1)*HISTOGRAM_SUB_BUCKETS +
+	  (value >> shift) - HISTOGRAM_SUB_BUCKETS;
+}
+
+/**
+ * Record a value. Must only be called by the single writer.
+ *
+ * @param h the histogram
+ * @param value the value
+ */
+static inline void histogram_record(struct histogram *h, uint64_t value)
+{
+     unsigned int i = histogram_bucket(value);
+     __atomic_store_n(&h->buckets[i], h->buckets[i]+1, __ATOMIC_RELAXED);
+     __atomic_store_n(&h->sum, h->sum+value, __ATOMIC_RELAXED);
+     if (value < h->min)
+	  __atomic_store_n(&h->min, value, __ATOMIC_RELAXED);
+     if (value > h->max)
+	  __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+     __atomic_store_n(&h->count, h->count+1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Copy a histogram while it may be written.
+ *
+ * @param h the histogram
+ * @param snapshot the copy
+ */
+void histogram_snapshot(const struct histogram *h,
+			struct histogram *snapshot);
+
+/**
+ * Get a percentile of the recorded values.
+ *
+ * @param h the histogram (a snapshot if the histogram is being written)
+ * @param percentile the percentile (0-100)
+ * @return upper bound of the bucket holding the percentile; 0 if the
+ * histogram is empty
+ */
+uint64_t histogram_percentile(const struct histogram *h, double percentile);
+
+/**
+ * Print the column names of histogram_print().
+ *
+ * @param f the stream
+ */
+void histogram_print_header(FILE *f);
+
+/**
+ * Print count, min, percentiles, and max of a histogram in one line.
+ *
+ * @param f the stream
+ * @param h the histogram (a snapshot if the histogram is being written)
+ */
+void histogram_print(FILE *f, const struct histogram *h);
+
+#endif
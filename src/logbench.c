@@ -0,0 +1,267 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Benchmark of the logger thread: log size and CPU time of the CSV,
+   binary, and compressed formats.
+
+   Usage: logbench [-n SCANS] [-o LOGFILE] CSVLOG
+
+   The raw samples of CSVLOG (e.g., calibration/hall/log-*.dat) are logged
+   over and over until SCANS scans have been logged, once per format and
+   sampling frequency (1 kHz and 10 kHz). Timestamps advance by the
+   sampling interval plus the jitter of the timestamps of CSVLOG. The log
+   is written to LOGFILE (/dev/null by default, to leave out the storage).
+   Printed are the log size per hour and the CPU time of the logger as
+   share of one core at the respective sampling frequency. */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "logger.h"
+#include "binlog.h"
+
+/* Maximum length of a line of the CSV log */
+#define MAX_LINE 512
+
+/* The logger is called with batches of this many scans, as by the logger
+   thread of powermeter with the default wakeup batch. */
+#define BATCH 64
+
+unsigned long scans_total = 1000000;
+const char *logfile = "/dev/null";
+
+/* Scans of the CSV log: timestamp jitter (deviation of the interval from
+   the median interval) and values */
+unsigned long row_count = 0;
+unsigned int channel_count = 0;
+int64_t *jitter;
+uint16_t *row_values;
+
+uint64_t cpu_time_ns(void)
+{
+     struct timespec t;
+     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+     return 1000000000ull*t.tv_sec + t.tv_nsec;
+}
+
+int compare_i64(const void *a, const void *b)
+{
+     int64_t x = *((const int64_t *) a);
+     int64_t y = *((const int64_t *) b);
+
+     return (x > y) - (x < y);
+}
+
+/**
+ * Load the CSV log.
+ *
+ * @param path path of the log
+ * @return 0 on success; -1 on error
+ */
+int load(const char *path)
+{
+     FILE *f = fopen(path, "r");
+     if (f == NULL)
+	  return -1;
+
+     unsigned long capacity = 0;
+     uint64_t *timestamps = NULL;
+     char line[MAX_LINE];
+     while (fgets(line, sizeof(line), f) != NULL) {
+	  if (line[0] == '#')
+	       continue;
+	  if (row_count == capacity) {
+	       capacity = (capacity == 0 ? 4096 : 2*capacity);
+	       timestamps = realloc(timestamps, capacity*sizeof(uint64_t));
+	       row_values = realloc(row_values, capacity*RING_MAX_CHANNELS*
+				    sizeof(uint16_t));
+	       if (timestamps == NULL || row_values == NULL) {
+		    fclose(f);
+		    return -1;
+	       }
+	  }
+
+	  char *p;
+	  timestamps[row_count] = strtoull(line, &p, 10);
+	  unsigned int n = 0;
+	  uint16_t *v = &row_values[row_count*RING_MAX_CHANNELS];
+	  while (*p == ',' && n < RING_MAX_CHANNELS) {
+	       char *s = p+1;
+	       unsigned long value = strtoul(s, &p, 10);
+	       v[n++] = (p == s ? RING_NO_VALUE : value);
+	  }
+	  if (channel_count == 0)
+	       channel_count = n;
+	  if (n != channel_count) {
+	       fclose(f);
+	       return -1;
+	  }
+	  row_count++;
+     }
+     fclose(f);
+
+     if (row_count < 2) {
+	  free(timestamps);
+	  return -1;
+     }
+
+     /* Keep the values of the channels compact. */
+     for (unsigned long i = 1; i < row_count; i++)
+	  memmove(&row_values[i*channel_count],
+		  &row_values[i*RING_MAX_CHANNELS],
+		  channel_count*sizeof(uint16_t));
+
+     jitter = malloc(row_count*sizeof(int64_t));
+     if (jitter == NULL) {
+	  free(timestamps);
+	  return -1;
+     }
+     jitter[0] = 0;
+     for (unsigned long i = 1; i < row_count; i++)
+	  jitter[i] = (int64_t) (timestamps[i]-timestamps[i-1]);
+     int64_t *sorted = malloc(row_count*sizeof(int64_t));
+     if (sorted == NULL) {
+	  free(timestamps);
+	  return -1;
+     }
+     memcpy(sorted, &jitter[1], (row_count-1)*sizeof(int64_t));
+     qsort(sorted, row_count-1, sizeof(int64_t), compare_i64);
+     int64_t median = sorted[(row_count-1)/2];
+     for (unsigned long i = 1; i < row_count; i++)
+	  jitter[i] -= median;
+
+     free(sorted);
+     free(timestamps);
+
+     return 0;
+}
+
+/**
+ * Log all scans in one format and print the log size and CPU time.
+ *
+ * @param name name of the format
+ * @param format log format
+ * @param compressed true to compress binary logs
+ * @param frequency sampling frequency in Hz
+ */
+void run(const char *name, enum log_format format, bool compressed,
+	 double frequency)
+{
+     uint64_t interval = (uint64_t) (1000000000.0/frequency + 0.5);
+
+     struct binlog_header header;
+     if (format == LOG_BINARY) {
+	  uint8_t adc_channels[RING_MAX_CHANNELS];
+	  uint8_t spi_channels[RING_MAX_CHANNELS];
+	  for (unsigned int c = 0; c < channel_count; c++) {
+	       adc_channels[c] = c;
+	       spi_channels[c] = 0;
+	  }
+	  binlog_header_init(&header, BINLOG_DEFAULT_BLOCK_SIZE, interval,
+			     channel_count, adc_channels, NULL, spi_channels,
+			     0);
+	  if (compressed)
+	       binlog_header_set_compressed(&header);
+     }
+
+     struct logger logger;
+     if (logger_open(&logger, logfile, format, channel_count, &header,
+		     LOGGER_DEFAULT_CHUNK_SIZE, false, 0) == -1) {
+	  perror("Could not open log file");
+	  exit(-1);
+     }
+
+     uint64_t timestamps[BATCH];
+     uint16_t values[BATCH*RING_MAX_CHANNELS];
+     uint64_t t = 1000000000ull;
+     unsigned long row = 0;
+     uint64_t cpu_time = 0;
+     for (unsigned long i = 0; i < scans_total; i += BATCH) {
+	  unsigned int n = 0;
+	  while (n < BATCH && i+n < scans_total) {
+	       int64_t dt = (int64_t) interval + jitter[row];
+	       t += (dt > 0 ? dt : 0);
+	       timestamps[n] = t;
+	       memcpy(&values[n*channel_count],
+		      &row_values[row*channel_count],
+		      channel_count*sizeof(uint16_t));
+	       row = (row+1)%row_count;
+	       n++;
+	  }
+
+	  uint64_t tstart = cpu_time_ns();
+	  logger_log(&logger, timestamps, values, NULL, n);
+	  cpu_time += cpu_time_ns()-tstart;
+     }
+     uint64_t tstart = cpu_time_ns();
+     logger_close(&logger);
+     cpu_time += cpu_time_ns()-tstart;
+
+     double bytes_per_scan = (double) logger.bytes_written/scans_total;
+     double cpu_per_scan = cpu_time/1000000000.0/scans_total;
+     printf("%-12s %8.0f %12.2f %12.1f %10.3f\n", name, frequency,
+	    bytes_per_scan, bytes_per_scan*frequency*3600.0/1000000.0,
+	    100.0*cpu_per_scan*frequency);
+}
+
+void usage(const char *appl)
+{
+     fprintf(stderr, "%s [-n SCANS] [-o LOGFILE] CSVLOG\n", appl);
+}
+
+int main(int argc, char *argv[])
+{
+     int c;
+     while ((c = getopt(argc, argv, "n:o:")) != -1) {
+	  switch (c) {
+	  case 'n' :
+	       scans_total = strtoul(optarg, NULL, 10);
+	       break;
+	  case 'o' :
+	       logfile = optarg;
+	       break;
+	  default:
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+
+     if (optind != argc-1 || scans_total == 0) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     if (load(argv[optind]) == -1) {
+	  fprintf(stderr, "Could not load CSV log\n");
+	  exit(-1);
+     }
+
+     printf("%lu scans of %u inputs\n", scans_total, channel_count);
+     printf("%-12s %8s %12s %12s %10s\n", "format", "[Hz]", "bytes/scan",
+	    "MB/hour", "CPU [%]");
+     const double frequencies[] = {1000.0, 10000.0};
+     for (unsigned int i = 0; i < 2; i++) {
+	  run("csv", LOG_CSV, false, frequencies[i]);
+	  run("binary", LOG_BINARY, false, frequencies[i]);
+	  run("compressed", LOG_BINARY, true, frequencies[i]);
+     }
+
+     return 0;
+}
@@ -0,0 +1,710 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "logger.h"
+
+/* Channels without value are passed from the ring to the binary log. */
+#if RING_NO_VALUE != BINLOG_NO_VALUE
+#error "RING_NO_VALUE and BINLOG_NO_VALUE differ"
+#endif
+
+/**
+ * Get current time.
+ *
+ * @return monotonic time in nanoseconds
+ */
+static uint64_t now(void)
+{
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return 1000000000ull*t.tv_sec + t.tv_nsec;
+}
+
+/**
+ * Format an unsigned 32 bit integer as decimal.
+ *
+ * @param p destination
+ * @param v value
+ * @return pointer behind the last digit
+ */
+static char *format_u32(char *p, uint32_t v)
+{
+     char digits[10];
+     int n = 0;
+
+     do {
+	  digits[n++] = '0' + v%10;
+	  v /= 10;
+     } while (v != 0);
+
+     while (n > 0)
+	  *p++ = digits[--n];
+
+     return p;
+}
+
+/**
+ * Format an unsigned 64 bit integer as decimal. 64 bit divisions are
+ * expensive on 32 bit ARM, so we only do one to split off the lower
+ * nine digits.
+ *
+ * @param p destination
+ * @param v value
+ * @return pointer behind the last digit
+ */
+static char *format_u64(char *p, uint64_t v)
+{
+     if (v <= UINT32_MAX)
+	  return format_u32(p, (uint32_t) v);
+
+     uint64_t hi = v/1000000000ull;
+     uint32_t lo = (uint32_t) (v - hi*1000000000ull);
+
+     p = format_u64(p, hi);
+     for (int i = 8; i >= 0; i--) {
+	  p[i] = '0' + lo%10;
+	  lo /= 10;
+     }
+
+     return p+9;
+}
+
+/**
+ * Format a value given in micro units in milli units with three decimal
+ * places.
+ *
+ * @param p destination
+ * @param v value in micro units
+ * @return pointer behind the last digit
+ */
+static char *format_milli(char *p, int64_t v)
+{
+     if (v < 0) {
+	  *p++ = '-';
+	  v = -v;
+     }
+     if (v > UINT32_MAX)
+	  v = UINT32_MAX;
+
+     uint32_t u = (uint32_t) v;
+     p = format_u32(p, u/1000);
+     *p++ = '.';
+     u %= 1000;
+     p[0] = '0' + u/100;
+     p[1] = '0' + (u/10)%10;
+     p[2] = '0' + u%10;
+
+     return p+3;
+}
+
+/**
+ * Write data from the start of the buffer and move the remaining data to
+ * the start of the buffer.
+ *
+ * @param l the logger
+ * @param size number of bytes to write
+ */
+static void write_buffer(struct logger *l, size_t size)
+{
+     size_t written = 0;
+     while (written < size) {
+	  ssize_t ret = write(l->fd, l->buffer+written, size-written);
+	  if (ret == -1) {
+	       if (errno == EINTR)
+		    continue;
+	       /* We cannot do much about it in the logger thread; count
+		  the error and drop the data. */
+	       l->write_errors++;
+	       break;
+	  }
+	  written += ret;
+     }
+     __atomic_store_n(&l->bytes_written, l->bytes_written+written,
+		      __ATOMIC_RELAXED);
+
+     memmove(l->buffer, l->buffer+size, l->fill-size);
+     l->fill -= size;
+     l->binlog.block = l->buffer+l->fill;
+     l->last_flush = now();
+}
+
+int logger_open(struct logger *l, const char *path, enum log_format format,
+		unsigned int channel_count, const struct binlog_header *header,
+		size_t chunk_size, bool direct, uint64_t flush_interval)
+{
+     if (channel_count == 0 || channel_count > RING_MAX_CHANNELS ||
+	 chunk_size == 0 || chunk_size%LOGGER_ALIGNMENT != 0 ||
+	 (format == LOG_BINARY && chunk_size%header->block_size != 0)) {
+	  errno = EINVAL;
+	  return -1;
+     }
+     
+     l->format = format;
+     l->channel_count = channel_count;
+     l->direct = direct;
+     l->chunk_size = chunk_size;
+     l->fill = 0;
+     l->flush_interval = flush_interval;
+     l->bytes_written = 0;
+     l->write_errors = 0;
+     l->gaps = 0;
+     l->lost_scans = 0;
+     l->scans = 0;
+     l->segment = false;
+     l->preallocated = 0;
+     l->writeback_started = 0;
+     l->writeback_done = 0;
+     l->trigger = NULL;
+     l->rollup = NULL;
+     l->index = NULL;
+     l->phases = NULL;
+     l->calibration = NULL;
+     l->calibrated_columns = false;
+     l->frac_bits = 0;
+
+     /* Beyond a chunk, the buffer must hold a CSV line or a block. */
+     size_t slack = LOGGER_MAX_LINE;
+     if (format == LOG_BINARY && header->block_size > slack)
+	  slack = header->block_size;
+     slack = (slack+LOGGER_ALIGNMENT-1) & ~((size_t) LOGGER_ALIGNMENT-1);
+     l->buffer_size = chunk_size+slack;
+     
+     if (posix_memalign((void **) &l->buffer, LOGGER_ALIGNMENT,
+			l->buffer_size) != 0) {
+	  errno = ENOMEM;
+	  return -1;
+     }
+     /* Touch all pages now rather than in the logger thread. */
+     memset(l->buffer, 0, l->buffer_size);
+
+     int flags = O_WRONLY|O_CREAT|O_TRUNC;
+     if (direct)
+	  flags |= O_DIRECT;
+     l->fd = open(path, flags, 0644);
+     if (l->fd == -1) {
+	  free(l->buffer);
+	  return -1;
+     }
+
+     if (format == LOG_BINARY) {
+	  binlog_writer_init(&l->binlog, header, l->buffer);
+	  binlog_writer_header_block(&l->binlog, l->buffer);
+	  l->fill = header->block_size;
+	  l->binlog.block = l->buffer+l->fill;
+     }
+
+     l->last_flush = now();
+
+     return 0;
+}
+
+/**
+ * Finish the current block of a binary log.
+ *
+ * @param l the logger
+ */
+static void finish_block(struct logger *l)
+{
+     if (binlog_writer_finish_block(&l->binlog) > 0) {
+	  l->fill += l->binlog.header.block_size;
+	  l->binlog.block = l->buffer+l->fill;
+     }
+}
+
+void logger_set_calibration(struct logger *l, const struct calibration *cal,
+			    bool calibrated_columns)
+{
+     l->calibration = cal;
+     l->calibrated_columns = calibrated_columns;
+     l->current_sample = RING_NO_VALUE;
+     l->voltage_sample = RING_NO_VALUE;
+     energy_init(&l->energy, cal);
+}
+
+/**
+ * Mark scans lost before the next sample in the log.
+ *
+ * @param l the logger
+ * @param lost number of lost scans
+ */
+static void log_gap(struct logger *l, uint32_t lost)
+{
+     l->gaps++;
+     l->lost_scans += lost;
+
+     if (l->format == LOG_CSV) {
+	  char *p = (char *) l->buffer+l->fill;
+	  memcpy(p, "# gap ", 6);
+	  p = format_u32(p+6, lost);
+	  *p++ = '\n';
+	  l->fill = (uint8_t *) p-l->buffer;
+     } else {
+	  /* Records of a block are spaced by the sampling interval, so a
+	     gap always starts a new block. */
+	  finish_block(l);
+	  binlog_writer_add_gap(&l->binlog, lost);
+     }
+
+     if (l->fill >= l->chunk_size)
+	  write_buffer(l, l->chunk_size);
+}
+
+void logger_set_frac_bits(struct logger *l, unsigned int frac_bits)
+{
+     l->frac_bits = frac_bits;
+}
+
+int logger_set_trigger(struct logger *l, struct trigger *t,
+		       unsigned int history_size, uint64_t summary_interval)
+{
+     l->history = malloc(history_size*sizeof(struct logger_sample));
+     if (l->history == NULL)
+	  return -1;
+     /* Fault the history in before sampling starts. */
+     memset(l->history, 0, history_size*sizeof(struct logger_sample));
+     l->history_size = history_size;
+     l->history_first = 0;
+     l->history_count = 0;
+     l->trigger = t;
+     l->summary_interval = summary_interval;
+     l->summary.scans = 0;
+     l->captured_scans = 0;
+
+     return 0;
+}
+
+/**
+ * Add an index entry for a scan if one is due. The line or block of the
+ * scan must start at the end of the buffer.
+ *
+ * @param l the logger
+ * @param t timestamp of the scan
+ */
+static void index_scan(struct logger *l, uint64_t t)
+{
+     uint64_t offset = l->bytes_written+l->fill;
+     if (l->index != NULL && logindex_due(l->index, offset))
+	  logindex_add(l->index, t, offset);
+}
+
+/**
+ * Format a sample and write all full chunks.
+ *
+ * @param l the logger
+ * @param t timestamp
+ * @param v channel_count values
+ * @param voltage calibrated voltage
+ * @param current calibrated current
+ * @param power calibrated power
+ */
+static void write_sample(struct logger *l, uint64_t t, const uint16_t *v,
+			 int64_t voltage, int64_t current, int64_t power)
+{
+     unsigned int cc = l->channel_count;
+     
+     if (l->format == LOG_CSV) {
+	  index_scan(l, t);
+	  char *p = (char *) l->buffer+l->fill;
+	  p = format_u64(p, t);
+	  for (unsigned int c = 0; c < cc; c++) {
+	       *p++ = ',';
+	       if (v[c] != RING_NO_VALUE)
+		    p = format_u32(p, v[c]);
+	  }
+	  if (l->calibrated_columns) {
+	       *p++ = ',';
+	       p = format_milli(p, voltage);
+	       *p++ = ',';
+	       p = format_milli(p, current);
+	       *p++ = ',';
+	       p = format_milli(p, power);
+	  }
+	  *p++ = '\n';
+	  l->fill = (uint8_t *) p-l->buffer;
+     } else {
+	  if (l->binlog.record_count == 0)
+	       index_scan(l, t);
+	  if (binlog_writer_add(&l->binlog, t, v) == -1) {
+	       finish_block(l);
+	       if (l->fill >= l->chunk_size)
+		    write_buffer(l, l->chunk_size);
+	       index_scan(l, t);
+	       binlog_writer_add(&l->binlog, t, v);
+	  }
+	  if (binlog_writer_full(&l->binlog))
+	       finish_block(l);
+     }
+
+     if (l->fill >= l->chunk_size)
+	  write_buffer(l, l->chunk_size);
+}
+
+/**
+ * Log the summary of the samples not captured since the last summary and
+ * start a new summary.
+ *
+ * @param l the logger
+ */
+static void write_summary(struct logger *l)
+{
+     struct logger_summary *s = &l->summary;
+     unsigned int cc = l->channel_count;
+     if (s->scans == 0)
+	  return;
+
+     uint16_t means[RING_MAX_CHANNELS];
+     for (unsigned int c = 0; c < cc; c++)
+	  means[c] = (s->counts[c] > 0 ?
+		      (s->sums[c] + s->counts[c]/2)/s->counts[c] :
+		      RING_NO_VALUE);
+     
+     if (l->format == LOG_CSV) {
+	  char *p = (char *) l->buffer+l->fill;
+	  memcpy(p, "# summary ", 10);
+	  p = format_u64(p+10, s->tfirst);
+	  *p++ = ',';
+	  p = format_u64(p, s->tlast);
+	  *p++ = ',';
+	  p = format_u64(p, s->scans);
+	  for (unsigned int c = 0; c < cc; c++) {
+	       *p++ = ',';
+	       if (s->counts[c] > 0)
+		    p = format_u32(p, s->min[c]);
+	       *p++ = ',';
+	       if (s->counts[c] > 0)
+		    p = format_u32(p, means[c]);
+	       *p++ = ',';
+	       if (s->counts[c] > 0)
+		    p = format_u32(p, s->max[c]);
+	  }
+	  *p++ = '\n';
+	  l->fill = (uint8_t *) p-l->buffer;
+	  if (l->fill >= l->chunk_size)
+	       write_buffer(l, l->chunk_size);
+     } else {
+	  /* A summary is a block of its own (the file header is larger
+	     than block header and summary, so it fits). */
+	  finish_block(l);
+	  struct binlog_summary bs;
+	  bs.tfirst = s->tfirst;
+	  bs.tlast = s->tlast;
+	  bs.scans = s->scans;
+	  for (unsigned int c = 0; c < BINLOG_MAX_CHANNELS; c++) {
+	       bool valid = (c < cc && s->counts[c] > 0);
+	       bs.min[c] = (valid ? s->min[c] : BINLOG_NO_VALUE);
+	       bs.mean[c] = (valid ? means[c] : BINLOG_NO_VALUE);
+	       bs.max[c] = (valid ? s->max[c] : BINLOG_NO_VALUE);
+	  }
+	  binlog_writer_summary(&l->binlog, &bs);
+	  l->fill += l->binlog.header.block_size;
+	  l->binlog.block = l->buffer+l->fill;
+	  if (l->fill >= l->chunk_size)
+	       write_buffer(l, l->chunk_size);
+     }
+
+     s->scans = 0;
+}
+
+/**
+ * Add a sample not captured to the summary.
+ *
+ * @param l the logger
+ * @param t timestamp
+ * @param v channel_count values
+ */
+static void summarize(struct logger *l, uint64_t t, const uint16_t *v)
+{
+     struct logger_summary *s = &l->summary;
+     unsigned int cc = l->channel_count;
+
+     if (s->scans == 0) {
+	  s->tfirst = t;
+	  for (unsigned int c = 0; c < cc; c++) {
+	       s->counts[c] = 0;
+	       s->sums[c] = 0;
+	       s->min[c] = UINT16_MAX;
+	       s->max[c] = 0;
+	  }
+     }
+     s->tlast = t;
+     s->scans++;
+     for (unsigned int c = 0; c < cc; c++) {
+	  if (v[c] == RING_NO_VALUE)
+	       continue;
+	  s->counts[c]++;
+	  s->sums[c] += v[c];
+	  if (v[c] < s->min[c])
+	       s->min[c] = v[c];
+	  if (v[c] > s->max[c])
+	       s->max[c] = v[c];
+     }
+
+     if (t-s->tfirst >= l->summary_interval)
+	  write_summary(l);
+}
+
+/**
+ * Pass a sample through the trigger: log it if it is captured, otherwise
+ * keep it in history for the pre-trigger window. Samples leaving the
+ * history uncaptured are summarized.
+ *
+ * @param l the logger
+ * @param sample the sample
+ */
+static void trigger_sample(struct logger *l,
+			   const struct logger_sample *sample)
+{
+     struct trigger *trigger = l->trigger;
+     bool capturing = trigger->capturing;
+
+     if (trigger_check(trigger, sample->timestamp, sample->values)) {
+	  if (!capturing) {
+	       /* New capture: log the summary so far and the pre-trigger
+		  window. */
+	       unsigned int k = 0;
+	       for (; k < l->history_count; k++) {
+		    const struct logger_sample *h =
+			 &l->history[(l->history_first+k)%l->history_size];
+		    if (sample->timestamp-h->timestamp <= trigger->pre_window)
+			 break;
+		    summarize(l, h->timestamp, h->values);
+	       }
+	       write_summary(l);
+	       for (; k < l->history_count; k++) {
+		    const struct logger_sample *h =
+			 &l->history[(l->history_first+k)%l->history_size];
+		    write_sample(l, h->timestamp, h->values, h->voltage,
+				 h->current, h->power);
+		    l->captured_scans++;
+	       }
+	       l->history_count = 0;
+	  }
+	  write_sample(l, sample->timestamp, sample->values,
+		       sample->voltage, sample->current, sample->power);
+	  l->captured_scans++;
+	  return;
+     }
+
+     if (l->history_count == l->history_size) {
+	  const struct logger_sample *h = &l->history[l->history_first];
+	  summarize(l, h->timestamp, h->values);
+	  l->history_first = (l->history_first+1)%l->history_size;
+	  l->history_count--;
+     }
+     l->history[(l->history_first+l->history_count)%l->history_size] =
+	  *sample;
+     l->history_count++;
+}
+
+void logger_set_rollup(struct logger *l, struct rollup *r)
+{
+     l->rollup = r;
+}
+
+void logger_set_index(struct logger *l, struct logindex_writer *w)
+{
+     l->index = w;
+}
+
+void logger_set_phases(struct logger *l, struct phase_meter *p)
+{
+     l->phases = p;
+}
+
+/**
+ * Log a finished phase (CSV only). Phases end rarely, so the line is
+ * formatted by snprintf().
+ *
+ * @param l the logger
+ * @param r the phase
+ */
+static void log_phase(struct logger *l, const struct phase_result *r)
+{
+     if (l->format != LOG_CSV)
+	  return;
+
+     char *p = (char *) l->buffer+l->fill;
+     int n = snprintf(p, LOGGER_MAX_LINE, "# phase %s,%llu,%llu,%llu",
+		      r->name, (unsigned long long) r->tbegin,
+		      (unsigned long long) r->tend,
+		      (unsigned long long) r->scans);
+     if (r->power_samples > 0)
+	  n += snprintf(p+n, LOGGER_MAX_LINE-n, ",%.3f,%.3f,%.3f",
+			r->energy/1000000000.0, phase_mean_power(r),
+			r->peak_power/1000.0);
+     else
+	  n += snprintf(p+n, LOGGER_MAX_LINE-n, ",,,");
+     p[n++] = '\n';
+     l->fill += n;
+     if (l->fill >= l->chunk_size)
+	  write_buffer(l, l->chunk_size);
+}
+
+void logger_end_phase(struct logger *l)
+{
+     const struct phase_result *r = phase_end(l->phases);
+     if (r != NULL)
+	  log_phase(l, r);
+}
+
+void logger_log(struct logger *l, const uint64_t *timestamps,
+		const uint16_t *values, const uint32_t *gaps, unsigned int n)
+{
+     unsigned int cc = l->channel_count;
+     
+     /* The previous samples accounted to the phases were logged to another
+	recording, possibly long ago. */
+     if (l->phases != NULL && l->scans == 0)
+	  phase_interrupt(l->phases);
+     __atomic_store_n(&l->scans, l->scans+n, __ATOMIC_RELAXED);
+     for (unsigned int i = 0; i < n; i++) {
+	  uint64_t t = timestamps[i];
+	  const uint16_t *v = &values[i*cc];
+
+	  if (gaps != NULL && gaps[i] > 0)
+	       log_gap(l, gaps[i]);
+
+	  int64_t voltage = 0;
+	  int64_t current = 0;
+	  int64_t power = 0;
+	  bool calibrated = false;
+	  if (l->calibration != NULL) {
+	       if (v[0] != RING_NO_VALUE)
+		    l->current_sample = v[0];
+	       if (v[1] != RING_NO_VALUE)
+		    l->voltage_sample = v[1];
+	       if (l->current_sample != RING_NO_VALUE &&
+		   l->voltage_sample != RING_NO_VALUE) {
+		    current = calib_apply(&l->calibration->current,
+					  l->current_sample, l->frac_bits);
+		    voltage = calib_apply(&l->calibration->voltage,
+					  l->voltage_sample, l->frac_bits);
+		    power = energy_update(&l->energy, t, voltage, current);
+		    calibrated = true;
+	       }
+	  }
+
+	  if (l->phases != NULL) {
+	       while (phase_due(l->phases, t)) {
+		    const struct phase_result *r = phase_advance(l->phases);
+		    if (r != NULL)
+			 log_phase(l, r);
+	       }
+	       phase_add(l->phases, t, calibrated, power);
+	  }
+
+	  if (l->rollup != NULL)
+	       rollup_add(l->rollup, t, v, calibrated ? &power : NULL);
+
+	  if (l->trigger != NULL) {
+	       struct logger_sample sample;
+	       sample.timestamp = t;
+	       sample.voltage = voltage;
+	       sample.current = current;
+	       sample.power = power;
+	       memcpy(sample.values, v, cc*sizeof(uint16_t));
+	       trigger_sample(l, &sample);
+	  } else {
+	       write_sample(l, t, v, voltage, current, power);
+	  }
+     }
+
+     if (l->flush_interval > 0 && now()-l->last_flush >= l->flush_interval)
+	  logger_flush(l);
+}
+
+void logger_flush(struct logger *l)
+{
+     if (l->format == LOG_BINARY)
+	  finish_block(l);
+     
+     size_t size = l->fill;
+     if (l->direct)
+	  size &= ~((size_t) LOGGER_ALIGNMENT-1);
+
+     if (size > 0)
+	  write_buffer(l, size);
+
+     if (l->rollup != NULL)
+	  rollup_flush(l->rollup);
+     if (l->index != NULL)
+	  logindex_flush(l->index);
+}
+
+void logger_set_segment(struct logger *l, uint64_t size)
+{
+     l->segment = true;
+     if (size > 0 && fallocate(l->fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0)
+	  l->preallocated = size;
+}
+
+void logger_writeback(struct logger *l)
+{
+     uint64_t end = __atomic_load_n(&l->bytes_written, __ATOMIC_RELAXED);
+     if (end == l->writeback_started)
+	  return;
+
+     sync_file_range(l->fd, l->writeback_started, end-l->writeback_started,
+		     SYNC_FILE_RANGE_WRITE);
+     if (l->writeback_started > l->writeback_done)
+	  sync_file_range(l->fd, l->writeback_done,
+			  l->writeback_started-l->writeback_done,
+			  SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|
+			  SYNC_FILE_RANGE_WAIT_AFTER);
+     l->writeback_done = l->writeback_started;
+     l->writeback_started = end;
+}
+
+void logger_close(struct logger *l)
+{
+     if (l->trigger != NULL) {
+	  for (unsigned int k = 0; k < l->history_count; k++) {
+	       const struct logger_sample *h =
+		    &l->history[(l->history_first+k)%l->history_size];
+	       summarize(l, h->timestamp, h->values);
+	  }
+	  write_summary(l);
+	  free(l->history);
+     }
+     
+     if (l->format == LOG_BINARY)
+	  finish_block(l);
+
+     /* The tail of the file is not aligned. */
+     if (l->direct)
+	  fcntl(l->fd, F_SETFL, fcntl(l->fd, F_GETFL) & ~O_DIRECT);
+
+     if (l->fill > 0)
+	  write_buffer(l, l->fill);
+
+     if (l->segment) {
+	  if (l->preallocated > l->bytes_written)
+	       ftruncate(l->fd, l->bytes_written);
+	  fdatasync(l->fd);
+     }
+
+     close(l->fd);
+     free(l->buffer);
+}
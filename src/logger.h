@@ -0,0 +1,289 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "ring.h"
+#include "binlog.h"
+#include "calib.h"
+#include "trigger.h"
+#include "rollup.h"
+#include "logindex.h"
+#include "phase.h"
+
+/* Samples are formatted into a page-aligned buffer, which is written to the
+   log file in chunks of fixed size. */
+#define LOGGER_ALIGNMENT 4096
+#define LOGGER_DEFAULT_CHUNK_SIZE (64*1024)
+
+/* Maximum length of a CSV line (including summary lines) */
+#define LOGGER_MAX_LINE 512
+
+/* Log file formats */
+enum log_format {LOG_CSV, LOG_BINARY};
+
+/* Sample kept for the pre-trigger window */
+struct logger_sample {
+     uint64_t timestamp;
+     int64_t voltage;
+     int64_t current;
+     int64_t power;
+     uint16_t values[RING_MAX_CHANNELS];
+};
+
+/* Statistics of the samples not captured by a trigger */
+struct logger_summary {
+     uint64_t tfirst;
+     uint64_t tlast;
+     uint64_t scans;
+     uint64_t counts[RING_MAX_CHANNELS];
+     uint64_t sums[RING_MAX_CHANNELS];
+     uint16_t min[RING_MAX_CHANNELS];
+     uint16_t max[RING_MAX_CHANNELS];
+};
+
+struct logger {
+     int fd;
+     enum log_format format;
+     unsigned int channel_count;
+     bool direct;
+
+     uint8_t *buffer;
+     size_t buffer_size;
+     size_t chunk_size;
+     size_t fill;
+
+     /* Maximum time in nanoseconds data may stay in the buffer before it
+	is written; 0 to only write full chunks. */
+     uint64_t flush_interval;
+     uint64_t last_flush;
+
+     struct binlog_writer binlog;
+
+     /* If calibrated, samples are translated to V, I, P and integrated. */
+     const struct calibration *calibration;
+     bool calibrated_columns;
+     struct energy_meter energy;
+     /* Latest current and voltage samples. If channels are sampled at
+	different rates, the latest sample of each is held. */
+     uint16_t current_sample;
+     uint16_t voltage_sample;
+     /* Fractional bits of sample values (oversampled inputs) */
+     unsigned int frac_bits;
+
+     /* Bytes written to the log file (read by the I/O thread) */
+     uint64_t bytes_written;
+     uint64_t write_errors;
+
+     /* A segment is preallocated, and synced to disk and truncated to its
+	size when closed. */
+     bool segment;
+     uint64_t preallocated;
+     /* Writeback (logger_writeback()) was started for the log file up to
+	writeback_started and has completed up to writeback_done. */
+     uint64_t writeback_started;
+     uint64_t writeback_done;
+     /* Number of gaps in the log and of scans lost in these gaps */
+     uint64_t gaps;
+     uint64_t lost_scans;
+     /* Number of scans passed to logger_log() */
+     uint64_t scans;
+
+     /* With a trigger, only captures are logged: the samples of the
+	pre-trigger window (kept in history, a circular buffer), and the
+	samples until the post-trigger window has passed. Between
+	captures, a summary is logged every summary_interval ns. */
+     struct trigger *trigger;
+     struct logger_sample *history;
+     unsigned int history_size;
+     unsigned int history_first;
+     unsigned int history_count;
+     uint64_t summary_interval;
+     struct logger_summary summary;
+     uint64_t captured_scans;
+
+     /* Rollups of all samples, captured or not (NULL if none) */
+     struct rollup *rollup;
+
+     /* Sparse time index of the log (NULL if none) */
+     struct logindex_writer *index;
+
+     /* Phase accounting of all samples (NULL if none) */
+     struct phase_meter *phases;
+};
+
+/**
+ * Create the log file and allocate the logger buffer.
+ *
+ * @param l the logger
+ * @param path path of the log file
+ * @param format log file format
+ * @param channel_count number of values per sample
+ * @param header file header for binary logs; NULL for CSV
+ * @param chunk_size size of writes in bytes; must be a multiple of 
+ * LOGGER_ALIGNMENT (and of the block size for binary logs)
+ * @param direct true to bypass the page cache (O_DIRECT)
+ * @param flush_interval maximum time in nanoseconds data is buffered; 0 to
+ * only write full chunks
+ * @return 0 on success; -1 on error (errno is set)
+ */
+int logger_open(struct logger *l, const char *path, enum log_format format,
+		unsigned int channel_count, const struct binlog_header *header,
+		size_t chunk_size, bool direct, uint64_t flush_interval);
+
+/**
+ * Translate samples to voltage, current, and power, and integrate energy.
+ * The first value of each sample is the current sample, the second the
+ * voltage sample. Energy is integrated from the first scan on that has
+ * both a current and a voltage sample.
+ *
+ * @param l the logger
+ * @param cal calibration
+ * @param calibrated_columns true to add voltage [mV], current [mA], and
+ * power [mW] to each line of CSV logs
+ */
+void logger_set_calibration(struct logger *l, const struct calibration *cal,
+			    bool calibrated_columns);
+
+/**
+ * Declare sample values as fixed-point numbers, as produced by
+ * oversampling. Only affects the translation to voltage and current.
+ *
+ * @param l the logger
+ * @param frac_bits number of fractional bits
+ */
+void logger_set_frac_bits(struct logger *l, unsigned int frac_bits);
+
+/**
+ * Only log samples captured by a trigger, and summaries in between.
+ *
+ * @param l the logger
+ * @param t the trigger
+ * @param history_size number of samples to keep for the pre-trigger
+ * window (at least the number of scans within the window)
+ * @param summary_interval interval of summaries between captures in ns
+ * @return 0 on success; -1 if memory could not be allocated
+ */
+int logger_set_trigger(struct logger *l, struct trigger *t,
+		       unsigned int history_size, uint64_t summary_interval);
+
+/**
+ * Add all samples to rollups (including samples not logged because of a
+ * trigger). The rollups are flushed with the logger but not closed.
+ *
+ * @param l the logger
+ * @param r the rollups
+ */
+void logger_set_rollup(struct logger *l, struct rollup *r);
+
+/**
+ * Add entries to a time index while logging. The index is flushed with
+ * the logger but not closed.
+ *
+ * @param l the logger
+ * @param w the index
+ */
+void logger_set_index(struct logger *l, struct logindex_writer *w);
+
+/**
+ * Account all samples to the phases marked (including samples not logged
+ * because of a trigger). The phase meter is shared by the recordings
+ * following each other, so a phase may span several log files; finished
+ * phases are logged to CSV logs.
+ *
+ * @param l the logger
+ * @param p the phase meter
+ */
+void logger_set_phases(struct logger *l, struct phase_meter *p);
+
+/**
+ * Format a batch of samples taken from the ring and write all full chunks.
+ *
+ * @param l the logger
+ * @param timestamps timestamps of the samples
+ * @param values channel_count values per sample (RING_NO_VALUE for channels
+ * not sampled)
+ * @param gaps number of samples lost right before each sample; NULL if
+ * none were lost. A gap is marked in the log by a "# gap N" line (CSV)
+ * or by starting a new block (binary).
+ * @param n number of samples
+ *
+ * With a trigger, summaries are logged as CSV comment lines
+ * "# summary TFIRST,TLAST,SCANS" followed by ",MIN,MEAN,MAX" of each
+ * channel, or as a summary block of binary logs (struct
+ * binlog_summary).
+ *
+ * With phases, each finished phase is logged to CSV logs as a comment line
+ * "# phase NAME,TBEGIN,TEND,SCANS" followed by ",ENERGY,MEAN,PEAK" (energy
+ * in mJ, mean and peak power in mW; empty without calibration) before the
+ * first sample of the next phase.
+ */
+void logger_log(struct logger *l, const uint64_t *timestamps,
+		const uint16_t *values, const uint32_t *gaps, unsigned int n);
+
+/**
+ * End the current phase at the last sample and log it, e.g., when the
+ * last recording ends. Must not be called concurrently with logger_log().
+ *
+ * @param l the logger (with phases)
+ */
+void logger_end_phase(struct logger *l);
+
+/**
+ * Write all buffered data, also if less than a chunk. With O_DIRECT, data
+ * beyond the last multiple of LOGGER_ALIGNMENT stays in the buffer.
+ *
+ * @param l the logger
+ */
+void logger_flush(struct logger *l);
+
+/**
+ * Make the log a segment of a longer recording: preallocate disk space
+ * for it (fallocate() keeping the file size, so readers only see data),
+ * and sync it to disk and release the space not used when it is closed.
+ * Preallocation is skipped if the file system does not support it.
+ *
+ * @param l the logger
+ * @param size bytes to preallocate (0 for none)
+ */
+void logger_set_segment(struct logger *l, uint64_t size);
+
+/**
+ * Write back the log file to disk steadily rather than in large bursts of
+ * dirty pages: start writeback of the data written since the last call,
+ * and wait until the data written before the last call is on disk. Thus,
+ * at most the data written during two calls is dirty. Must not be called
+ * by the logger thread, since it waits for the disk; the log file must
+ * not be closed concurrently.
+ *
+ * @param l the logger
+ */
+void logger_writeback(struct logger *l);
+
+/**
+ * Write all buffered data, close the log file, and free the buffer.
+ *
+ * @param l the logger
+ */
+void logger_close(struct logger *l);
+
+#endif
@@ -0,0 +1,170 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logindex.h"
+
+/**
+ * Get the time of a clock in nanoseconds.
+ *
+ * @param clock the clock
+ * @return the time
+ */
+static int64_t clock_ns(clockid_t clock)
+{
+     struct timespec t;
+     clock_gettime(clock, &t);
+     return 1000000000ll*t.tv_sec + t.tv_nsec;
+}
+
+int logindex_create(struct logindex_writer *w, const char *path,
+		    uint32_t interval)
+{
+     if (interval == 0) {
+	  errno = EINVAL;
+	  return -1;
+     }
+     w->interval = interval;
+     w->next_offset = 0;
+     w->fill = 0;
+     w->write_errors = 0;
+
+     w->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+     if (w->fd == -1)
+	  return -1;
+
+     struct logindex_header h;
+     memset(&h, 0, sizeof(h));
+     memcpy(h.magic, LOGINDEX_MAGIC, sizeof(h.magic));
+     h.version = LOGINDEX_VERSION;
+     h.interval = interval;
+     h.realtime_offset = clock_ns(CLOCK_REALTIME)-clock_ns(CLOCK_MONOTONIC);
+     if (write(w->fd, &h, sizeof(h)) != sizeof(h)) {
+	  close(w->fd);
+	  return -1;
+     }
+
+     return 0;
+}
+
+void logindex_add(struct logindex_writer *w, uint64_t timestamp,
+		  uint64_t offset)
+{
+     if (w->fill == LOGINDEX_BUFFER_ENTRIES)
+	  logindex_flush(w);
+     w->entries[w->fill].timestamp = timestamp;
+     w->entries[w->fill].offset = offset;
+     w->fill++;
+     w->next_offset = offset - offset%w->interval + w->interval;
+}
+
+void logindex_flush(struct logindex_writer *w)
+{
+     size_t size = w->fill*sizeof(struct logindex_entry);
+     size_t written = 0;
+     while (written < size) {
+	  ssize_t ret = write(w->fd, (const uint8_t *) w->entries+written,
+			      size-written);
+	  if (ret == -1) {
+	       if (errno == EINTR)
+		    continue;
+	       w->write_errors++;
+	       break;
+	  }
+	  written += ret;
+     }
+     w->fill = 0;
+}
+
+void logindex_close(struct logindex_writer *w)
+{
+     logindex_flush(w);
+     close(w->fd);
+}
+
+int logindex_open(struct logindex_reader *r, const char *path)
+{
+     r->fd = open(path, O_RDONLY);
+     if (r->fd == -1)
+	  return -1;
+
+     struct stat st;
+     if (fstat(r->fd, &st) == -1) {
+	  close(r->fd);
+	  return -1;
+     }
+     r->size = st.st_size;
+     if (r->size < sizeof(struct logindex_header)) {
+	  close(r->fd);
+	  errno = EINVAL;
+	  return -1;
+     }
+
+     r->map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+     if (r->map == MAP_FAILED) {
+	  close(r->fd);
+	  return -1;
+     }
+     memcpy(&r->header, r->map, sizeof(r->header));
+     if (memcmp(r->header.magic, LOGINDEX_MAGIC,
+		sizeof(r->header.magic)) != 0 ||
+	 r->header.version != LOGINDEX_VERSION) {
+	  logindex_reader_close(r);
+	  errno = EINVAL;
+	  return -1;
+     }
+     r->entries = (const struct logindex_entry *)
+	  (r->map+sizeof(struct logindex_header));
+     /* A partly written last entry is ignored. */
+     r->entry_count = (r->size-sizeof(struct logindex_header))/
+	  sizeof(struct logindex_entry);
+
+     return 0;
+}
+
+uint64_t logindex_find(const struct logindex_reader *r, uint64_t timestamp)
+{
+     if (r->entry_count == 0)
+	  return 0;
+
+     /* First entry with a timestamp after timestamp */
+     uint64_t low = 0;
+     uint64_t high = r->entry_count;
+     while (low < high) {
+	  uint64_t middle = low+(high-low)/2;
+	  if (r->entries[middle].timestamp <= timestamp)
+	       low = middle+1;
+	  else
+	       high = middle;
+     }
+
+     return r->entries[low > 0 ? low-1 : 0].offset;
+}
+
+void logindex_reader_close(struct logindex_reader *r)
+{
+     munmap((void *) r->map, r->size);
+     close(r->fd);
+}
@@ -0,0 +1,163 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LOGINDEX_H
+#define LOGINDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Sparse time index of a log
+
+   The index of a log (CSV or binary) is a side file LOGFILE.idx starting
+   with struct logindex_header, followed by struct logindex_entry entries
+   in order of time. Each entry holds the timestamp of a scan and the byte
+   offset in the log of the line (CSV) or block (binary) starting with this
+   scan. An entry is added for the first scan starting at or after each
+   multiple of interval bytes, so a search for a timestamp by binary
+   search over the entries reads at most about interval bytes of the log
+   before reaching the scan. All values are little-endian.
+
+   Timestamps of the log are CLOCK_MONOTONIC; realtime_offset is the
+   difference CLOCK_REALTIME - CLOCK_MONOTONIC in ns when the log was
+   started, so timestamps can be converted to wall-clock time. */
+
+#define LOGINDEX_MAGIC "PMINDEX"
+#define LOGINDEX_VERSION 1
+
+/* Default number of log bytes between index entries */
+#define LOGINDEX_DEFAULT_INTERVAL (64*1024)
+
+/* Entries are written in chunks of this many entries */
+#define LOGINDEX_BUFFER_ENTRIES 256
+
+struct logindex_header {
+     char magic[8];
+     uint16_t version;
+     uint16_t reserved;
+     uint32_t interval;
+     int64_t realtime_offset;
+} __attribute__((packed));
+
+struct logindex_entry {
+     uint64_t timestamp;
+     uint64_t offset;
+} __attribute__((packed));
+
+/**
+ * Writer of an index, used by a single thread.
+ */
+struct logindex_writer {
+     int fd;
+     uint32_t interval;
+     /* Offset at or after which the next entry is due */
+     uint64_t next_offset;
+     struct logindex_entry entries[LOGINDEX_BUFFER_ENTRIES];
+     unsigned int fill;
+     uint64_t write_errors;
+};
+
+/**
+ * Reader mapping an index into memory.
+ */
+struct logindex_reader {
+     int fd;
+     const uint8_t *map;
+     size_t size;
+     struct logindex_header header;
+     const struct logindex_entry *entries;
+     uint64_t entry_count;
+};
+
+/**
+ * Create the index of a log.
+ *
+ * @param w the writer
+ * @param path path of the index
+ * @param interval number of log bytes between entries
+ * @return 0 on success; -1 on error (errno is set)
+ */
+int logindex_create(struct logindex_writer *w, const char *path,
+		    uint32_t interval);
+
+/**
+ * Check whether an entry is due for a scan.
+ *
+ * @param w the writer
+ * @param offset offset of the scan in the log
+ * @return true if the scan should be indexed
+ */
+static inline bool logindex_due(const struct logindex_writer *w,
+				uint64_t offset)
+{
+     return offset >= w->next_offset;
+}
+
+/**
+ * Add an entry.
+ *
+ * @param w the writer
+ * @param timestamp timestamp of the scan
+ * @param offset offset of the line or block of the scan in the log
+ */
+void logindex_add(struct logindex_writer *w, uint64_t timestamp,
+		  uint64_t offset);
+
+/**
+ * Write the buffered entries.
+ *
+ * @param w the writer
+ */
+void logindex_flush(struct logindex_writer *w);
+
+/**
+ * Write the buffered entries and close the index.
+ *
+ * @param w the writer
+ */
+void logindex_close(struct logindex_writer *w);
+
+/**
+ * Open an index for reading.
+ *
+ * @param r the reader
+ * @param path path of the index
+ * @return 0 on success; -1 on error (errno is set; EINVAL if the file is
+ * not an index)
+ */
+int logindex_open(struct logindex_reader *r, const char *path);
+
+/**
+ * Find where to start reading the log for a timestamp (binary search).
+ *
+ * @param r the reader
+ * @param timestamp the timestamp
+ * @return offset of the last entry with a timestamp before or at
+ * timestamp; offset of the first entry if there is none
+ */
+uint64_t logindex_find(const struct logindex_reader *r, uint64_t timestamp);
+
+/**
+ * Close an index.
+ *
+ * @param r the reader
+ */
+void logindex_reader_close(struct logindex_reader *r);
+
+#endif
@@ -29,21 +29,52 @@
 const uint8_t startbit = 0x80;
 const uint8_t sebit = 0x40;
 
+#ifdef BCM2835LIB
+/* SPI channel currently selected by the chip select bits */
+static int selected_spi_channel = -1;
+#endif
+
+void mcp320x_request(uint8_t *data, const struct mcp320x_input *input)
+{
+     /* The channel enumerations match the channel configuration bits of
+	the data sheet. */
+     data[0] = startbit | (input->channel << 3);
+     if (!input->differential)
+	  data[0] |= sebit;
+     data[1] = 0;
+     data[2] = 0;
+}
+
+uint16_t mcp320x_decode(const uint8_t *data)
+{
+     /* 12 bit sample is returned most-significant bit first, 7 bit
+	times after sending the config bits. */
+     uint16_t s = ((uint16_t) (data[0]&0x01)) << 11;
+     s |= (uint16_t) (data[1]) << 3;
+     s |= (uint16_t) ((data[2]&0xe0) >> 5);
+
+     return s;
+}
+
 /**
  * Request a sample from MCP320x.
  * 
  * @param channel_config the 3 channel configuration bits as defined
  * in the MCP3204/3208 data sheet.
+ * @param single_ended true for single-ended, false for differential mode
  * @param spi_channel the SPI channel to communicate with MCP320x
  * @return 12 bit sample value, or -1 in case of an error.
  */
-int16_t sample(uint8_t channel_config, int spi_channel)
+int16_t sample(uint8_t channel_config, bool single_ended, int spi_channel)
 {
-     uint8_t config = startbit | sebit | (channel_config << 3);
+     uint8_t config = startbit | (channel_config << 3);
+     if (single_ended)
+	  config |= sebit;
 
-     uint16_t s;
      uint8_t data[3];
      data[0] = config;
+     data[1] = 0;
+     data[2] = 0;
      
 #ifdef WIRINGPI
      int ret;
@@ -56,17 +87,19 @@ int16_t sample(uint8_t channel_config, int spi_channel)
 #endif
 
 #ifdef BCM2835LIB
+     /* ADCs on both SPI channels may be sampled in turn. Only switch the
+	chip select if the ADC differs from the previous transaction. */
+     if (spi_channel != selected_spi_channel) {
+	  bcm2835_spi_chipSelect(spi_channel == 0 ? BCM2835_SPI_CS0 :
+				 BCM2835_SPI_CS1);
+	  selected_spi_channel = spi_channel;
+     }
+     
      /* This function will overwrite the given data with the received data. */
      bcm2835_spi_transfern((char *) data, 3);
 #endif
 
-     /* 12 bit sample is returned most-significant bit first, 7 bit
-	times after sending the config bits. */
-     s = ((uint16_t) (data[0]&0x01)) << 11;
-     s |= (uint16_t) (data[1]) << 3;
-     s |= (uint16_t) ((data[2]&0xe0) >> 5);
-
-     return ((int16_t) s);
+     return ((int16_t) mcp320x_decode(data));
 }
 
 int16_t get_sample_singleended(enum channel_singleended adc_channel,
@@ -102,7 +135,7 @@ int16_t get_sample_singleended(enum channel_singleended adc_channel,
 	  return -1;
      }
 
-     return sample(channel, spi_channel);
+     return sample(channel, true, spi_channel);
 }
 
 int16_t get_sample_diff(enum channel_differential adc_channel,
@@ -138,5 +171,91 @@ int16_t get_sample_diff(enum channel_differential adc_channel,
 	  return -1;
      }
 
-     return sample(channel, spi_channel);
+     return sample(channel, false, spi_channel);
+}
+
+int16_t get_sample(const struct mcp320x_input *input, int spi_channel)
+{
+     if (input->differential)
+	  return get_sample_diff(input->channel, spi_channel);
+     else
+	  return get_sample_singleended(input->channel, spi_channel);
+}
+
+#ifdef BCM2835LIB
+/**
+ * Run the conversions of a scan in one pass over the SPI registers.
+ * MCP320x ends a conversion when CS is deasserted, so each conversion
+ * still is a transfer of its own. However, the FIFOs are cleared only once
+ * per scan, and each transfer is started by a single register write that
+ * also selects the ADC.
+ *
+ * @param data 3 bytes to be sent per conversion, overwritten with the
+ * received bytes
+ * @param spi_channels SPI channel of each conversion
+ * @param count number of conversions
+ */
+static void transfer_scan(uint8_t *data, const uint8_t *spi_channels,
+			  unsigned int count)
+{
+     volatile uint32_t *cs = bcm2835_spi0 + BCM2835_SPI0_CS/4;
+     volatile uint32_t *fifo = bcm2835_spi0 + BCM2835_SPI0_FIFO/4;
+
+     bcm2835_peri_set_bits(cs, BCM2835_SPI0_CS_CLEAR, BCM2835_SPI0_CS_CLEAR);
+     for (unsigned int i = 0; i < count; i++) {
+	  uint8_t *d = &data[3*i];
+	  uint32_t select = (spi_channels[i] == 0 ? BCM2835_SPI_CS0 :
+			     BCM2835_SPI_CS1);
+	  bcm2835_peri_set_bits(cs, BCM2835_SPI0_CS_TA | select,
+				BCM2835_SPI0_CS_TA | BCM2835_SPI0_CS_CS);
+	  
+	  /* A conversion easily fits into the 16 byte FIFO. */
+	  bcm2835_peri_write_nb(fifo, d[0]);
+	  bcm2835_peri_write_nb(fifo, d[1]);
+	  bcm2835_peri_write_nb(fifo, d[2]);
+	  while (!(bcm2835_peri_read_nb(cs) & BCM2835_SPI0_CS_DONE))
+	       ;
+	  d[0] = bcm2835_peri_read_nb(fifo);
+	  d[1] = bcm2835_peri_read_nb(fifo);
+	  d[2] = bcm2835_peri_read_nb(fifo);
+	  
+	  bcm2835_peri_set_bits(cs, 0, BCM2835_SPI0_CS_TA);
+     }
+     if (count > 0)
+	  selected_spi_channel = spi_channels[count-1];
+}
+#endif
+
+int get_samples(const struct mcp320x_input *inputs,
+		const uint8_t *spi_channels, unsigned int count,
+		uint16_t *values)
+{
+     if (count > MCP320X_MAX_SCAN)
+	  return -1;
+
+     /* Build the requests of all conversions, ... */
+     uint8_t data[3*MCP320X_MAX_SCAN];
+     for (unsigned int i = 0; i < count; i++) {
+	  if (inputs[i].channel >= MCP320X_CHANNELS)
+	       return -1;
+	  mcp320x_request(&data[3*i], &inputs[i]);
+     }
+
+     /* ... run them back to back, ... */
+#ifdef WIRINGPI
+     for (unsigned int i = 0; i < count; i++) {
+	  if (wiringPiSPIDataRW(spi_channels[i], &data[3*i], 3) < 0)
+	       return -1;
+     }
+#endif
+
+#ifdef BCM2835LIB
+     transfer_scan(data, spi_channels, count);
+#endif
+
+     /* ... and decode all results. */
+     for (unsigned int i = 0; i < count; i++)
+	  values[i] = mcp320x_decode(&data[3*i]);
+
+     return 0;
 }
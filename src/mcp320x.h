@@ -20,6 +20,14 @@
 #define MCP320X_H
 
 #include <stdint.h>
+#include <stdbool.h>
+
+/* Number of channels of the MCP3208 */
+#define MCP320X_CHANNELS 8
+
+/* Maximum number of inputs sampled by one call of get_samples(): all
+   channels of the ADCs on both SPI channels */
+#define MCP320X_MAX_SCAN (2*MCP320X_CHANNELS)
 
 /**
  * MCP320x channels in single-ended mode.
@@ -34,6 +42,33 @@ enum channel_singleended {CH0, CH1, CH2, CH3, CH4, CH5, CH6, CH7};
 enum channel_differential {CH0CH1, CH1CH0, CH2CH3, CH3CH2, CH4CH5, CH5CH4,
 			   CH6CH7, CH7CH6};
 
+/**
+ * An input of the MCP320x: either a single-ended channel or a differential
+ * channel pair.
+ */
+struct mcp320x_input {
+     bool differential;
+     /* enum channel_singleended if single-ended, 
+	enum channel_differential otherwise */
+     uint8_t channel;
+};
+
+/**
+ * Build the request of a conversion.
+ *
+ * @param data the 3 bytes to be sent to MCP320x
+ * @param input the MCP320x input to be sampled
+ */
+void mcp320x_request(uint8_t *data, const struct mcp320x_input *input);
+
+/**
+ * Decode the 12 bit sample value of a conversion.
+ *
+ * @param data the 3 bytes received from MCP320x
+ * @return 12 bit sample value
+ */
+uint16_t mcp320x_decode(const uint8_t *data);
+
 /**
  * Sample a channel in single-ended mode.
  *
@@ -54,4 +89,29 @@ int16_t get_sample_singleended(enum channel_singleended adc_channel,
 int16_t get_sample_diff(enum channel_differential channel,
 			int spi_channel);
 
+/**
+ * Sample an input in single-ended or differential mode.
+ *
+ * @param input the MCP320x input to be sampled
+ * @param spi_channel the SPI channel to be used. RPi has two channels (0, 1).
+ * @return 12 bit sample value, or -1 in case of an error. 
+ */
+int16_t get_sample(const struct mcp320x_input *input, int spi_channel);
+
+/**
+ * Sample several inputs in one scan. The requests of all inputs are built
+ * into one transfer buffer, the conversions run back to back, and all
+ * results are decoded in one pass. This avoids most of the per-call
+ * overhead of get_sample().
+ *
+ * @param inputs the MCP320x inputs to be sampled, in this order
+ * @param spi_channels the SPI channel (0, 1) of the ADC of each input
+ * @param count number of inputs (at most MCP320X_MAX_SCAN)
+ * @param values 12 bit sample value of each input
+ * @return 0 on success; -1 in case of an error.
+ */
+int get_samples(const struct mcp320x_input *inputs,
+		const uint8_t *spi_channels, unsigned int count,
+		uint16_t *values);
+
 #endif
@@ -0,0 +1,218 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "calib.h"
+#include "phase.h"
+
+void phase_init(struct phase_meter *p)
+{
+     memset(p, 0, sizeof(*p));
+}
+
+int phase_parse_marker(bool begin, char *arg, uint64_t tnow,
+		       struct phase_marker *m)
+{
+     m->name[0] = '\0';
+     m->time = tnow;
+
+     char *s = (arg != NULL ? arg : "");
+     if (begin) {
+	  size_t length = strcspn(s, " ");
+	  /* Names end up in CSV comments. */
+	  if (length == 0 || length >= PHASE_MAX_NAME ||
+	      memchr(s, ',', length) != NULL)
+	       return -1;
+	  memcpy(m->name, s, length);
+	  m->name[length] = '\0';
+	  s += length;
+     }
+
+     while (*s == ' ')
+	  s++;
+     if (*s != '\0') {
+	  char *end;
+	  m->time = strtoull(s, &end, 10);
+	  while (*end == ' ')
+	       end++;
+	  if (end == s || *end != '\0')
+	       return -1;
+     }
+
+     return 0;
+}
+
+int phase_parse(char *line, uint64_t tnow, struct phase_marker *m)
+{
+     line[strcspn(line, "\r\n")] = '\0';
+     char *arg = NULL;
+     char *space = strchr(line, ' ');
+     if (space != NULL) {
+	  *space = '\0';
+	  arg = space+1;
+	  while (*arg == ' ')
+	       arg++;
+     }
+
+     if (strcmp(line, "begin") == 0)
+	  return phase_parse_marker(true, arg, tnow, m);
+     if (strcmp(line, "end") == 0)
+	  return phase_parse_marker(false, arg, tnow, m);
+     return -1;
+}
+
+int phase_mark(struct phase_meter *p, const struct phase_marker *m)
+{
+     if (m->time < p->tlast_marker) {
+	  errno = EINVAL;
+	  return -1;
+     }
+     unsigned int tail = __atomic_load_n(&p->marker_tail, __ATOMIC_ACQUIRE);
+     if (p->marker_head-tail == PHASE_QUEUE_SIZE) {
+	  errno = EAGAIN;
+	  return -1;
+     }
+
+     p->markers[p->marker_head%PHASE_QUEUE_SIZE] = *m;
+     __atomic_store_n(&p->marker_head, p->marker_head+1, __ATOMIC_RELEASE);
+     p->tlast_marker = m->time;
+     return 0;
+}
+
+/**
+ * End the current phase and pass it to phase_take().
+ *
+ * @param p the phase meter
+ * @param tend end of the phase
+ * @return the phase ended
+ */
+static const struct phase_result *finish(struct phase_meter *p,
+					 uint64_t tend)
+{
+     p->ended = p->current;
+     p->ended.tend = tend;
+     p->active = false;
+
+     unsigned int tail = __atomic_load_n(&p->result_tail, __ATOMIC_ACQUIRE);
+     if (p->result_head-tail == PHASE_QUEUE_SIZE) {
+	  __atomic_store_n(&p->results_lost, p->results_lost+1,
+			   __ATOMIC_RELAXED);
+     } else {
+	  p->results[p->result_head%PHASE_QUEUE_SIZE] = p->ended;
+	  __atomic_store_n(&p->result_head, p->result_head+1,
+			   __ATOMIC_RELEASE);
+     }
+
+     return &p->ended;
+}
+
+const struct phase_result *phase_advance(struct phase_meter *p)
+{
+     const struct phase_marker *m =
+	  &p->markers[p->marker_tail%PHASE_QUEUE_SIZE];
+     const struct phase_result *ended = NULL;
+     if (p->active)
+	  ended = finish(p, m->time);
+
+     if (m->name[0] != '\0') {
+	  memset(&p->current, 0, sizeof(p->current));
+	  strcpy(p->current.name, m->name);
+	  p->current.tbegin = m->time;
+	  p->active = true;
+     }
+
+     __atomic_store_n(&p->marker_tail, p->marker_tail+1, __ATOMIC_RELEASE);
+     return ended;
+}
+
+void phase_add(struct phase_meter *p, uint64_t t, bool calibrated,
+	       int64_t power)
+{
+     p->tprevious = t;
+     if (!calibrated) {
+	  if (p->active)
+	       p->current.scans++;
+	  return;
+     }
+
+     if (p->active) {
+	  struct phase_result *r = &p->current;
+	  r->scans++;
+	  if (p->have_power) {
+	       r->energy += energy_interval(p->power_previous, power,
+					    t-p->tpower);
+	       r->tintegrated += t-p->tpower;
+	  }
+	  if (r->power_samples == 0 || power > r->peak_power)
+	       r->peak_power = power;
+	  r->power_samples++;
+     }
+
+     p->have_power = true;
+     p->tpower = t;
+     p->power_previous = power;
+}
+
+void phase_interrupt(struct phase_meter *p)
+{
+     p->have_power = false;
+}
+
+const struct phase_result *phase_end(struct phase_meter *p)
+{
+     if (!p->active)
+	  return NULL;
+
+     uint64_t tend = (p->current.scans > 0 ? p->tprevious :
+		      p->current.tbegin);
+     return finish(p, tend);
+}
+
+bool phase_take(struct phase_meter *p, struct phase_result *r)
+{
+     unsigned int head = __atomic_load_n(&p->result_head, __ATOMIC_ACQUIRE);
+     if (head == p->result_tail)
+	  return false;
+
+     *r = p->results[p->result_tail%PHASE_QUEUE_SIZE];
+     __atomic_store_n(&p->result_tail, p->result_tail+1, __ATOMIC_RELEASE);
+     return true;
+}
+
+double phase_mean_power(const struct phase_result *r)
+{
+     /* pJ/ns = mW; a single scan has no energy. */
+     return (r->tintegrated > 0 ? (double) r->energy/r->tintegrated :
+	     r->peak_power/1000.0);
+}
+
+void phase_print(FILE *f, const struct phase_result *r)
+{
+     fprintf(f, "phase %s begin=%llu end=%llu duration_s=%.3f scans=%llu",
+	     r->name, (unsigned long long) r->tbegin,
+	     (unsigned long long) r->tend, (r->tend-r->tbegin)/1000000000.0,
+	     (unsigned long long) r->scans);
+     if (r->power_samples > 0) {
+	  fprintf(f, " energy_mj=%.3f mean_mw=%.3f peak_mw=%.3f",
+		  r->energy/1000000000.0, phase_mean_power(r),
+		  r->peak_power/1000.0);
+     }
+     fputc('\n', f);
+}
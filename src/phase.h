@@ -0,0 +1,231 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PHASE_H
+#define PHASE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Phases of a test (e.g., idle, screen on, upload) are marked while
+   recording, so energy and power of each phase are known as soon as it
+   ends. A marker is a line
+
+   begin NAME [TIMESTAMP]  end the current phase (if any) and begin phase
+                           NAME
+   end [TIMESTAMP]         end the current phase
+
+   TIMESTAMP is a time of CLOCK_MONOTONIC in ns, the clock of the
+   timestamps of the log; without it, the marker takes effect when it is
+   read. A scan belongs to the phase begun last at or before its time,
+   and the energy between two scans to the phase of the later scan.
+
+   Markers are passed to the logger thread, which accounts each scan to
+   the current phase, through a queue without locks, and finished phases
+   are passed back through another one. */
+
+/* Maximum length of the name of a phase (including '\0') */
+#define PHASE_MAX_NAME 64
+
+/* Number of markers and of finished phases that can be queued (a power of
+   two) */
+#define PHASE_QUEUE_SIZE 64
+
+struct phase_marker {
+     uint64_t time;
+     /* Name of the phase begun (empty to only end the current phase) */
+     char name[PHASE_MAX_NAME];
+};
+
+/**
+ * Energy and power of a phase. Energy and power are only accounted for
+ * scans with calibrated power.
+ */
+struct phase_result {
+     char name[PHASE_MAX_NAME];
+     /* Time of the markers beginning and ending the phase (of the last
+	scan if the phase ended with the recording) */
+     uint64_t tbegin;
+     uint64_t tend;
+     uint64_t scans;
+     /* Energy in pJ over integrated time in ns */
+     int64_t energy;
+     uint64_t tintegrated;
+     /* Peak power in uW */
+     int64_t peak_power;
+     /* Number of scans with calibrated power */
+     uint64_t power_samples;
+};
+
+/**
+ * Phase accounting, shared by the threads reading markers, the logger
+ * thread, and the thread printing finished phases.
+ */
+struct phase_meter {
+     /* Markers not yet taken by the logger thread, in order of their
+	time */
+     struct phase_marker markers[PHASE_QUEUE_SIZE];
+     unsigned int marker_head;
+     unsigned int marker_tail;
+     uint64_t tlast_marker;
+
+     /* Finished phases not yet taken by phase_take() */
+     struct phase_result results[PHASE_QUEUE_SIZE];
+     unsigned int result_head;
+     unsigned int result_tail;
+     /* Finished phases dropped since the queue was full */
+     uint64_t results_lost;
+
+     /* Current phase and the phase ended last (only accessed by the
+	logger thread) */
+     bool active;
+     struct phase_result current;
+     struct phase_result ended;
+     /* Time of the previous scan, and time and power of the previous scan
+	with calibrated power (if continued by the next scan) */
+     uint64_t tprevious;
+     bool have_power;
+     uint64_t tpower;
+     int64_t power_previous;
+};
+
+/**
+ * Initialize phase accounting without a current phase.
+ *
+ * @param p the phase meter
+ */
+void phase_init(struct phase_meter *p);
+
+/**
+ * Parse a marker line.
+ *
+ * @param line the line (modified)
+ * @param tnow current time in ns, the time of a marker without timestamp
+ * @param m set to the marker
+ * @return 0 on success; -1 if the line is no valid marker
+ */
+int phase_parse(char *line, uint64_t tnow, struct phase_marker *m);
+
+/**
+ * Parse the arguments of a marker.
+ *
+ * @param begin true for a begin marker, false for an end marker
+ * @param arg "NAME [TIMESTAMP]" for begin markers, "[TIMESTAMP]" for end
+ * markers (NULL for none; modified)
+ * @param tnow current time in ns, the time of a marker without timestamp
+ * @param m set to the marker
+ * @return 0 on success; -1 if the arguments are invalid
+ */
+int phase_parse_marker(bool begin, char *arg, uint64_t tnow,
+		       struct phase_marker *m);
+
+/**
+ * Queue a marker for the logger thread. Markers must be queued in order
+ * of their time, by one thread at a time.
+ *
+ * @param p the phase meter
+ * @param m the marker
+ * @return 0 on success; -1 if the marker is earlier than the previous one
+ * (errno is EINVAL) or the queue is full (errno is EAGAIN)
+ */
+int phase_mark(struct phase_meter *p, const struct phase_marker *m);
+
+/**
+ * Check whether a marker takes effect at a scan. Must only be called by
+ * the logger thread.
+ *
+ * @param p the phase meter
+ * @param t timestamp of the scan
+ * @return true if the next marker is due
+ */
+static inline bool phase_due(const struct phase_meter *p, uint64_t t)
+{
+     unsigned int head = __atomic_load_n(&p->marker_head, __ATOMIC_ACQUIRE);
+     return (head != p->marker_tail &&
+	     p->markers[p->marker_tail%PHASE_QUEUE_SIZE].time <= t);
+}
+
+/**
+ * Take the next marker, ending the current phase and beginning the next
+ * one. Must only be called by the logger thread.
+ *
+ * @param p the phase meter
+ * @return the phase ended (valid until the next call); NULL if no phase
+ * was active
+ */
+const struct phase_result *phase_advance(struct phase_meter *p);
+
+/**
+ * Account a scan to the current phase. Must only be called by the logger
+ * thread.
+ *
+ * @param p the phase meter
+ * @param t timestamp of the scan
+ * @param calibrated true if power is calibrated
+ * @param power power in uW
+ */
+void phase_add(struct phase_meter *p, uint64_t t, bool calibrated,
+	       int64_t power);
+
+/**
+ * Mark a discontinuity of the scans accounted, e.g., between two
+ * recordings not following each other, so no energy is integrated across
+ * it. Must only be called by the logger thread.
+ *
+ * @param p the phase meter
+ */
+void phase_interrupt(struct phase_meter *p);
+
+/**
+ * End the current phase at the last scan, e.g., when the recording ends.
+ * Must not be called concurrently with the logger thread.
+ *
+ * @param p the phase meter
+ * @return the phase ended (valid until the next call); NULL if no phase
+ * was active
+ */
+const struct phase_result *phase_end(struct phase_meter *p);
+
+/**
+ * Take a finished phase. Must only be called by one thread.
+ *
+ * @param p the phase meter
+ * @param r set to the phase
+ * @return true if a phase was taken; false if none was finished
+ */
+bool phase_take(struct phase_meter *p, struct phase_result *r);
+
+/**
+ * Get the mean power of a finished phase.
+ *
+ * @param r the phase (with calibrated power)
+ * @return mean power in mW
+ */
+double phase_mean_power(const struct phase_result *r);
+
+/**
+ * Print a finished phase in one line "phase NAME begin=T end=T
+ * duration_s=D scans=N [energy_mj=E mean_mw=P peak_mw=P]".
+ *
+ * @param f the stream
+ * @param r the phase
+ */
+void phase_print(FILE *f, const struct phase_result *r);
+
+#endif
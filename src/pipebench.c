@@ -0,0 +1,393 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* End-to-end benchmark of the sampling pipeline: a synthetic sample
+   generator puts scans into the ring like the sampling thread, and a
+   consumer thread drains the ring into the logger like the logger thread.
+
+   Usage: pipebench [-n SCANS] [-c CHANNELS] [-F FREQUENCIES] [-m FORMATS]
+   [-r RING_SIZE] [-o LOGFILE]
+
+   Every combination of the comma-separated lists of channel counts
+   (default 2,8,16), frequencies in Hz (default 0,10000,100000), and
+   formats (csv, binary, compressed; default all) is run with SCANS scans
+   (default 1000000). Frequency 0 puts scans as fast as possible and waits
+   while the ring is full, so the achieved rate is the maximum sustainable
+   rate of the pipeline. Other frequencies put the scans due every
+   millisecond in a burst and drop scans if the ring is full, like the
+   sampling thread. The generator produces sine waves with noise and
+   timestamps with jitter on the sampling grid.
+
+   One CSV line per run is printed: rate of scans logged [scans/s], dropped
+   scans, ring high-water mark [entries], bytes/s written, CPU time of the
+   consumer [ns/scan], and the time the producer waited for a full ring
+   [ns]. */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "ring.h"
+#include "logger.h"
+#include "binlog.h"
+
+/* Scans are drained in batches of up to this many scans. */
+#define DRAIN_BATCH 8192
+
+/* Nominal interval of the timestamps of runs as fast as possible */
+#define FAST_INTERVAL 10000
+
+/* Number of entries of the sine table of the generator */
+#define SINE_TABLE_SIZE 1024
+
+/* Maximum number of entries of the lists of the options */
+#define MAX_LIST 16
+
+unsigned long scans_total = 1000000;
+unsigned int ring_size = RING_DEFAULT_SIZE;
+const char *logfile = "/dev/null";
+
+int16_t sine_table[SINE_TABLE_SIZE];
+
+struct ring the_ring;
+struct logger the_logger;
+
+/* Parameters and results of the current run */
+unsigned int channel_count;
+double frequency;
+volatile bool producer_done;
+uint64_t scans_put;
+uint64_t scans_dropped;
+uint64_t scans_logged;
+unsigned int high_water;
+uint64_t stall_time;
+
+uint64_t timestamps[DRAIN_BATCH];
+uint16_t values[DRAIN_BATCH*RING_MAX_CHANNELS];
+uint32_t gaps[DRAIN_BATCH];
+
+uint64_t now_ns(void)
+{
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return 1000000000ull*t.tv_sec + t.tv_nsec;
+}
+
+/**
+ * Generate the next pseudo-random number (xorshift).
+ *
+ * @param state state of the generator
+ * @return the number
+ */
+static inline uint32_t next_random(uint32_t *state)
+{
+     uint32_t x = *state;
+     x ^= x << 13;
+     x ^= x >> 17;
+     x ^= x << 5;
+     *state = x;
+     return x;
+}
+
+/**
+ * Generate a scan: channel c is a sine wave with a period of 64 << c
+ * scans and noise of +-8 counts, the timestamp deviates from the grid by
+ * up to +-1 us.
+ *
+ * @param i index of the scan
+ * @param interval nominal sampling interval
+ * @param random state of the random number generator
+ * @param timestamp set to the timestamp
+ * @param scan set to the values
+ */
+static void generate(uint64_t i, uint64_t interval, uint32_t *random,
+		     uint64_t *timestamp, uint16_t *scan)
+{
+     *timestamp = 1000000000ull + i*interval + next_random(random)%2000 - 1000;
+     for (unsigned int c = 0; c < channel_count; c++) {
+	  unsigned int phase = ((i << 4) >> (c%8)) % SINE_TABLE_SIZE;
+	  scan[c] = 2048 + sine_table[phase] +
+	       (int) (next_random(random)%17) - 8;
+     }
+}
+
+/**
+ * Put all scans into the ring, as fast as possible or at the frequency of
+ * the run.
+ */
+void *producer_loop(void *args)
+{
+     uint32_t random = 2463534242u;
+     uint64_t interval = (frequency > 0.0 ?
+			  (uint64_t) (1000000000.0/frequency + 0.5) :
+			  FAST_INTERVAL);
+     uint64_t tstart = now_ns();
+     uint64_t i = 0;
+     while (i < scans_total) {
+	  /* Number of scans due now */
+	  uint64_t due = scans_total;
+	  if (frequency > 0.0) {
+	       uint64_t tnow = now_ns();
+	       due = (tnow-tstart)/interval + 1;
+	       if (due > scans_total)
+		    due = scans_total;
+	  }
+
+	  for (; i < due; i++) {
+	       uint64_t timestamp;
+	       uint16_t scan[RING_MAX_CHANNELS];
+	       generate(i, interval, &random, &timestamp, scan);
+	       if (frequency == 0.0 && ring_full(&the_ring)) {
+		    uint64_t tstall = now_ns();
+		    while (ring_full(&the_ring))
+			 sched_yield();
+		    stall_time += now_ns()-tstall;
+	       }
+	       if (ring_put(&the_ring, timestamp, scan) == 0)
+		    scans_put++;
+	       else
+		    scans_dropped++;
+	       unsigned int count = ring_count(&the_ring);
+	       if (count > high_water)
+		    high_water = count;
+	  }
+
+	  if (i < scans_total) {
+	       /* Sleep until the next millisecond */
+	       uint64_t tnext = now_ns()+1000000;
+	       struct timespec tsleep;
+	       tsleep.tv_sec = tnext/1000000000ull;
+	       tsleep.tv_nsec = tnext%1000000000ull;
+	       clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tsleep, NULL);
+	  }
+     }
+
+     producer_done = true;
+     ring_wakeup(&the_ring);
+
+     return NULL;
+}
+
+/**
+ * Drain the ring into the logger until canceled.
+ */
+void *consumer_loop(void *args)
+{
+     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+     while (true) {
+	  pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	  unsigned int n = ring_get_many(&the_ring, timestamps, values, gaps,
+					 DRAIN_BATCH);
+	  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	  logger_log(&the_logger, timestamps, values, gaps, n);
+	  __atomic_store_n(&scans_logged, scans_logged+n, __ATOMIC_RELEASE);
+     }
+
+     return NULL;
+}
+
+/**
+ * Run the pipeline for one configuration and print the results.
+ *
+ * @param format_name name of the log format
+ */
+void run(const char *format_name)
+{
+     enum log_format format = LOG_CSV;
+     bool compressed = false;
+     if (strcmp(format_name, "binary") == 0) {
+	  format = LOG_BINARY;
+     } else if (strcmp(format_name, "compressed") == 0) {
+	  format = LOG_BINARY;
+	  compressed = true;
+     }
+
+     uint64_t interval = (frequency > 0.0 ?
+			  (uint64_t) (1000000000.0/frequency + 0.5) :
+			  FAST_INTERVAL);
+     struct binlog_header header;
+     if (format == LOG_BINARY) {
+	  uint8_t adc_channels[RING_MAX_CHANNELS] = {0};
+	  uint8_t spi_channels[RING_MAX_CHANNELS] = {0};
+	  for (unsigned int c = 0; c < channel_count; c++) {
+	       adc_channels[c] = c%8;
+	       spi_channels[c] = c/8;
+	  }
+	  binlog_header_init(&header, BINLOG_DEFAULT_BLOCK_SIZE, interval,
+			     channel_count, adc_channels, NULL, spi_channels,
+			     0);
+	  if (compressed)
+	       binlog_header_set_compressed(&header);
+     }
+     if (logger_open(&the_logger, logfile, format, channel_count, &header,
+		     LOGGER_DEFAULT_CHUNK_SIZE, false, 0) == -1) {
+	  perror("Could not open log file");
+	  exit(-1);
+     }
+     if (ring_init(&the_ring, channel_count, ring_size, RING_DROP_NEWEST,
+		   false) == -1) {
+	  perror("Could not allocate ring");
+	  exit(-1);
+     }
+
+     producer_done = false;
+     scans_put = 0;
+     scans_dropped = 0;
+     scans_logged = 0;
+     high_water = 0;
+     stall_time = 0;
+
+     pthread_t producer, consumer;
+     uint64_t tstart = now_ns();
+     pthread_create(&consumer, NULL, consumer_loop, NULL);
+     pthread_create(&producer, NULL, producer_loop, NULL);
+     pthread_join(producer, NULL);
+     while (__atomic_load_n(&scans_logged, __ATOMIC_ACQUIRE) < scans_put)
+	  sched_yield();
+     double duration = (now_ns()-tstart)/1000000000.0;
+
+     clockid_t consumer_clock;
+     struct timespec consumer_time = {0, 0};
+     if (pthread_getcpuclockid(consumer, &consumer_clock) == 0)
+	  clock_gettime(consumer_clock, &consumer_time);
+     pthread_cancel(consumer);
+     pthread_join(consumer, NULL);
+     logger_close(&the_logger);
+     ring_destroy(&the_ring);
+
+     double cpu_time = consumer_time.tv_sec*1000000000.0 +
+	  consumer_time.tv_nsec;
+     printf("%s,%u,%.0f,%lu,%.0f,%llu,%u,%u,%.0f,%.1f,%llu\n", format_name,
+	    channel_count, frequency, scans_total, scans_put/duration,
+	    (unsigned long long) scans_dropped, high_water, ring_size,
+	    the_logger.bytes_written/duration,
+	    scans_put > 0 ? cpu_time/scans_put : 0.0,
+	    (unsigned long long) stall_time);
+     fflush(stdout);
+}
+
+/**
+ * Split a comma-separated list.
+ *
+ * @param list the list (modified)
+ * @param items set to the items
+ * @return number of items
+ */
+unsigned int split(char *list, char **items)
+{
+     unsigned int n = 0;
+     char *saveptr;
+     for (char *item = strtok_r(list, ",", &saveptr);
+	  item != NULL && n < MAX_LIST;
+	  item = strtok_r(NULL, ",", &saveptr))
+	  items[n++] = item;
+
+     return n;
+}
+
+void usage(const char *appl)
+{
+     fprintf(stderr, "%s [-n SCANS] [-c CHANNELS] [-F FREQUENCIES] "
+	     "[-m FORMATS] [-r RING_SIZE] [-o LOGFILE]\n", appl);
+}
+
+int main(int argc, char *argv[])
+{
+     char channels_list[256] = "2,8,16";
+     char frequencies_list[256] = "0,10000,100000";
+     char formats_list[256] = "csv,binary,compressed";
+     int c;
+     while ((c = getopt(argc, argv, "n:c:F:m:r:o:")) != -1) {
+	  switch (c) {
+	  case 'n' :
+	       scans_total = strtoul(optarg, NULL, 10);
+	       break;
+	  case 'c' :
+	       snprintf(channels_list, sizeof(channels_list), "%s", optarg);
+	       break;
+	  case 'F' :
+	       snprintf(frequencies_list, sizeof(frequencies_list), "%s",
+			optarg);
+	       break;
+	  case 'm' :
+	       snprintf(formats_list, sizeof(formats_list), "%s", optarg);
+	       break;
+	  case 'r' :
+	       ring_size = strtoul(optarg, NULL, 10);
+	       break;
+	  case 'o' :
+	       logfile = optarg;
+	       break;
+	  default:
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (optind != argc || scans_total == 0 || ring_size == 0 ||
+	 ring_size > RING_MAX_SIZE) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     char *channels[MAX_LIST];
+     char *frequencies[MAX_LIST];
+     char *formats[MAX_LIST];
+     unsigned int channels_count = split(channels_list, channels);
+     unsigned int frequencies_count = split(frequencies_list, frequencies);
+     unsigned int formats_count = split(formats_list, formats);
+     for (unsigned int k = 0; k < formats_count; k++) {
+	  if (strcmp(formats[k], "csv") != 0 &&
+	      strcmp(formats[k], "binary") != 0 &&
+	      strcmp(formats[k], "compressed") != 0) {
+	       fprintf(stderr, "Formats must be csv, binary, or "
+		       "compressed\n");
+	       exit(-1);
+	  }
+     }
+
+     for (unsigned int i = 0; i < SINE_TABLE_SIZE; i++)
+	  sine_table[i] = (int16_t) (1500.0*sin(2.0*M_PI*i/SINE_TABLE_SIZE));
+
+     /* The ring size is rounded up to a power of two. */
+     unsigned int size = 1;
+     while (size < ring_size)
+	  size <<= 1;
+     ring_size = size;
+
+     printf("format,channels,frequency,scans,rate,dropped,high_water,"
+	    "ring_size,bytes_per_s,logger_ns_per_scan,producer_stall_ns\n");
+     for (unsigned int i = 0; i < channels_count; i++) {
+	  channel_count = atoi(channels[i]);
+	  if (channel_count == 0 || channel_count > RING_MAX_CHANNELS) {
+	       fprintf(stderr, "Channel counts must be in range 1 to %d\n",
+		       RING_MAX_CHANNELS);
+	       exit(-1);
+	  }
+	  for (unsigned int j = 0; j < frequencies_count; j++) {
+	       frequency = strtod(frequencies[j], NULL);
+	       for (unsigned int k = 0; k < formats_count; k++)
+		    run(formats[k]);
+	  }
+     }
+
+     return 0;
+}
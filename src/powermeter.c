@@ -22,48 +22,268 @@
    - BCM2835LIB for bcm2835 library (http://www.airspayce.com/mikem/bcm2835/)
 */
 
-#ifdef BCM2835LIB
-#include <bcm2835.h>
-#endif
-
-#ifdef WIRINGPI
-#include <wiringPiSPI.h>
-#endif
-
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <stdbool.h>
 #include <signal.h>
 #include <sched.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <malloc.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
 #include "mcp320x.h"
+#include "adc.h"
 #include "ring.h"
+#include "binlog.h"
+#include "logger.h"
+#include "deadline.h"
+#include "histogram.h"
+#include "decimate.h"
+#include "feed.h"
+#include "trigger.h"
+#include "rollup.h"
+#include "logindex.h"
+#include "timing.h"
+#include "rtcheck.h"
+#include "recording.h"
+#include "control.h"
+#include "phase.h"
+
+/* Default trigger windows in ms and summary interval in s */
+#define DEFAULT_PRE_TRIGGER 100
+#define DEFAULT_POST_TRIGGER 1000
+#define DEFAULT_SUMMARY_INTERVAL 60
 
 /* Default task priority */
 #define DEFAULT_TASK_PRIORITY 49
 
-/* Estimated maximum stack size */
-#define MAX_STACK_SIZE (RING_SIZE*sizeof(struct ring_entry) + 1024) 
+/* Maximum number of inputs of a scan: all channels of the ADCs on both
+   SPI channels (CE0, CE1) */
+#define MAX_SCAN_INPUTS MCP320X_MAX_SCAN
+
+#if MAX_SCAN_INPUTS > DECIMATOR_MAX_INPUTS
+#error "Decimator cannot filter all inputs of a scan"
+#endif
+
+#if DECIMATOR_FRAC_BITS != BINLOG_OVERSAMPLED_FRAC_BITS
+#error "DECIMATOR_FRAC_BITS and BINLOG_OVERSAMPLED_FRAC_BITS differ"
+#endif
+
+/* Maximum number of entries the logger thread takes from the ring at
+   once */
+#define DRAIN_BATCH 8192
+
+/* Size of the stacks of the sampling and logger thread, which are
+   allocated and prefaulted before the threads start, and of the part of
+   the stack of the main thread that is prefaulted. The largest frames are
+   the line buffers of the logger, far below this size. */
+#define THREAD_STACK_SIZE (256*1024)
+
+/* The sampling thread updates its page fault counters once per this
+   interval in ns */
+#define FAULT_CHECK_INTERVAL 1000000000ull
+
+/* The I/O thread checks every IO_INTERVAL ns whether the current segment
+   is full */
+#define IO_INTERVAL 100000000ull
+
+/* Default writeback interval of segments in ms */
+#define DEFAULT_SYNC_INTERVAL 1000
+
+/* The phase thread checks every PHASE_POLL_INTERVAL ms for finished
+   phases */
+#define PHASE_POLL_INTERVAL 100
 
-FILE *fout = NULL;
+/* Maximum length of a phase marker line */
+#define PHASE_MAX_LINE 256
+
+/* Value of the long option --rt-check returned by getopt_long() */
+#define RT_CHECK_OPTION 256
+
+/* The logger thread logs into the current recording (NULL while the
+   daemon is not recording) */
+struct recording *recording = NULL;
+struct recording the_recording;
+struct recording_config recording_config;
+
+/* In daemon mode, the control thread serves the control socket, opens and
+   closes recordings, and hands them to the logger thread. */
+char *control_path = NULL;
+int control_fd = -1;
+struct control_request *control_pending = NULL;
+/* Recording handed to the logger thread last (NULL if none). Only the
+   control and I/O thread switch recordings, holding recording_mutex. */
+struct recording *control_recording = NULL;
+pthread_mutex_t recording_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The I/O thread starts new segments and writes back the current log file
+   every sync_interval ns (0 for never) */
+uint64_t sync_interval = 0;
+
+/* Phase markers are read from phase_fd (-1 if none, e.g., if they are
+   only sent to the control socket) by the phase thread, which also prints
+   the finished phases. The phase thread and the control thread queue
+   markers holding phase_mutex. */
+struct phase_meter *phases = NULL;
+struct phase_meter the_phases;
+int phase_fd = -1;
+pthread_mutex_t phase_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+struct calibration calibration;
+
+struct adc *adc = NULL;
+struct adc the_adc;
 
 int task_priority;
+
+/* The sampling thread waits for deadlines in this mode */
+struct timing timing;
+/* CPUs the sampling and logger thread are pinned to (-1 if none) */
+int sampling_cpu = -1;
+int logger_cpu = -1;
 struct timespec sampling_interval;
 int spi_channel;
 int spi_frequency;
-enum channel_singleended adc_channel1;
-enum channel_singleended adc_channel2;
 double sampling_frequency;
 
+/* ADC inputs logged with every scan, in this order, and the SPI channel
+   of the ADC of each input */
+struct mcp320x_input scan_list[MAX_SCAN_INPUTS];
+uint8_t scan_spi_channels[MAX_SCAN_INPUTS];
+unsigned int scan_length = 0;
+/* Order in which the inputs are sampled within a scan */
+unsigned int scan_order[MAX_SCAN_INPUTS];
+/* Sampling frequency of each input (0 for the default frequency) and the
+   resulting sampling interval in nanoseconds */
+double scan_frequencies[MAX_SCAN_INPUTS];
+uint64_t scan_intervals[MAX_SCAN_INPUTS];
+
+/* With oversampling, every scan takes this many conversions of each input
+   in a burst, and the decimator reduces them to one value per input. */
+unsigned int oversampling = 1;
+struct decimator decimator;
+uint16_t burst_samples[DECIMATOR_MAX_FACTOR*MAX_SCAN_INPUTS];
+
 struct ring the_ring;
+unsigned int ring_size = RING_DEFAULT_SIZE;
+enum ring_policy ring_policy = RING_DROP_NEWEST;
+bool ring_huge_pages = false;
+/* The logger thread drains the ring into these arrays */
+uint64_t logger_timestamps[DRAIN_BATCH];
+uint16_t logger_values[DRAIN_BATCH*RING_MAX_CHANNELS];
+uint32_t logger_gaps[DRAIN_BATCH];
+
+/* The logger thread publishes all scans to this live feed */
+struct feed_writer *feed = NULL;
+struct feed_writer the_feed;
+
+/* With a trigger, the logger only logs captures around trigger events.
+   Each recording starts with a copy of this trigger. */
+struct trigger the_trigger;
 
 pthread_t sampling_thread;
 pthread_t logger_thread;
+pthread_t stats_thread;
+bool stats_thread_started = false;
+pthread_t control_thread;
+bool control_thread_started = false;
+pthread_t io_thread;
+bool io_thread_started = false;
+pthread_t phase_thread;
+bool phase_thread_started = false;
+
+/* Timing statistics are written to this file every stats_interval
+   seconds */
+FILE *stats_file = NULL;
+unsigned int stats_interval = 10;
 
-uint64_t max_delta = 0;
+uint64_t scans = 0;
+uint64_t tfirst_scan = 0;
+uint64_t tlast_scan = 0;
+/* Timing of the sampling thread in nanoseconds: time between the sampling
+   deadline and waking up, duration of the SPI transactions of a scan, and
+   time between consecutive scans */
+struct histogram lateness_histogram;
+struct histogram scan_duration_histogram;
+struct histogram scan_interval_histogram;
+/* Number of scans dropped because the ring was full (new scans with
+   RING_DROP_NEWEST, old scans with RING_DROP_OLDEST) */
+uint64_t ring_overflows = 0;
+/* Number of times inputs were sampled so late that their next deadline
+   had already passed, and the number of deadlines skipped thereby */
+uint64_t overruns = 0;
+uint64_t skipped_ticks[MAX_SCAN_INPUTS];
+/* Page faults of the sampling and logger thread since they started their
+   loops. The sampling thread must not fault; with --rt-check, it stops at
+   the first fault and powermeter fails. */
+struct page_faults sampling_faults;
+struct page_faults logger_faults;
+bool rt_check = false;
+bool sampling_faulted = false;
+
+/**
+ * Print the timing statistics and counters of the sampling thread. The
+ * sampling thread may still be running.
+ *
+ * @param f the stream
+ */
+void print_stats(FILE *f)
+{
+     struct histogram snapshot;
+     
+     histogram_print_header(f);
+     histogram_snapshot(&lateness_histogram, &snapshot);
+     histogram_print(f, &snapshot);
+     histogram_snapshot(&scan_duration_histogram, &snapshot);
+     histogram_print(f, &snapshot);
+     histogram_snapshot(&scan_interval_histogram, &snapshot);
+     histogram_print(f, &snapshot);
+     
+     fprintf(f, "%llu scans dropped due to full ring\n", (unsigned long long)
+	     __atomic_load_n(&ring_overflows, __ATOMIC_RELAXED));
+     fprintf(f, "%llu scheduler overruns\n", (unsigned long long)
+	     __atomic_load_n(&overruns, __ATOMIC_RELAXED));
+     for (unsigned int i = 0; i < scan_length; i++) {
+	  uint64_t skipped = __atomic_load_n(&skipped_ticks[i],
+					     __ATOMIC_RELAXED);
+	  if (skipped > 0)
+	       fprintf(f, "Input %u skipped %llu sampling deadlines\n", i,
+		       (unsigned long long) skipped);
+     }
+
+     /* CPU time spent spinning per second of sampling */
+     uint64_t tfirst = __atomic_load_n(&tfirst_scan, __ATOMIC_RELAXED);
+     uint64_t tlast = __atomic_load_n(&tlast_scan, __ATOMIC_RELAXED);
+     if (timing.mode != TIMING_SLEEP && tlast > tfirst) {
+	  uint64_t spin_time = __atomic_load_n(&timing.spin_time,
+					       __ATOMIC_RELAXED);
+	  fprintf(f, "%.0f us/s spent spinning", spin_time/1000.0/
+		  ((tlast-tfirst)/1000000000.0));
+	  if (timing.mode == TIMING_HYBRID)
+	       fprintf(f, ", slack %llu ns", (unsigned long long)
+		       __atomic_load_n(&timing.slack, __ATOMIC_RELAXED));
+	  fputc('\n', f);
+     }
+
+     fprintf(f, "Page faults: sampling thread %llu minor, %llu major; "
+	     "logger thread %llu minor, %llu major\n",
+	     (unsigned long long) __atomic_load_n(&sampling_faults.minor,
+						  __ATOMIC_RELAXED),
+	     (unsigned long long) __atomic_load_n(&sampling_faults.major,
+						  __ATOMIC_RELAXED),
+	     (unsigned long long) __atomic_load_n(&logger_faults.minor,
+						  __ATOMIC_RELAXED),
+	     (unsigned long long) __atomic_load_n(&logger_faults.major,
+						  __ATOMIC_RELAXED));
+}
 
 /**
  * Gracefully terminate the process.
@@ -72,26 +292,45 @@ uint64_t max_delta = 0;
  */
 void die(int status)
 {
-     if (fout != NULL)
-	  fclose(fout);
+     if (recording != NULL) {
+	  recording_close(recording);
+	  recording_report(recording, stdout, stderr);
+     }
 
-     printf("Max. sampling interval was %llu ns\n", max_delta);
+     if (control_fd != -1) {
+	  close(control_fd);
+	  unlink(control_path);
+     }
+     
+     if (scans > 1) {
+	  double duration = (tlast_scan-tfirst_scan)/1000000000.0;
+	  printf("%llu scans in %.3f s (%.0f scans/s)\n",
+		 (unsigned long long) scans, duration, (scans-1)/duration);
+     }
+     print_stats(stdout);
+     if (stats_file != NULL) {
+	  fprintf(stats_file, "# end\n");
+	  print_stats(stats_file);
+	  fclose(stats_file);
+     }
 
-#ifdef BCM2835LIB
-     bcm2835_spi_end();
-     bcm2835_close();
-#endif
+     if (feed != NULL)
+	  feed_close(feed);
+     
+     if (adc != NULL)
+	  adc_close(adc);
      
      exit(status);
 }
 
 /**
- * SIGINT signal handler.
+ * SIGINT signal handler. Only the sampling thread is canceled; the logger
+ * thread is canceled once the sampling thread has terminated, and
+ * terminates after it has drained the ring.
  */
 void sig_int(int signo)
 {
      pthread_cancel(sampling_thread);
-     pthread_cancel(logger_thread);
 }
 
 /**
@@ -99,9 +338,21 @@ void sig_int(int signo)
  */
 void usage(const char *appl)
 {
-     fprintf(stderr, "%s -s SPI_CHANNEL -f SPI_FREQUENCY -a ADC_CHANNEL1 "
-	     "-b ADC_CHANNEL2 -F SAMPLING_FREQUENCY "
-	     "-o LOGFILE [-p TASK_PRIORITY] \n", appl);
+     fprintf(stderr, "%s -s SPI_CHANNEL -f SPI_FREQUENCY "
+	     "(-a ADC_CHANNEL1 -b ADC_CHANNEL2 | -l ADC_INPUTS) "
+	     "-F SAMPLING_FREQUENCY "
+	     "(-o LOGFILE | -U CONTROL_SOCKET) [-m csv|binary|compressed] "
+	     "[-c CHUNK_SIZE] [-d] "
+	     "[-t FLUSH_INTERVAL] [-C CALIBRATION_FILE [-P]] "
+	     "[-p TASK_PRIORITY] [-w WAKEUP_BATCH] [-B BACKEND] "
+	     "[-S STATS_FILE [-I STATS_INTERVAL]] [-r RING_SIZE] "
+	     "[-O drop-newest|drop-oldest] [-H] "
+	     "[-X OVERSAMPLING [-D boxcar|cic|fir]] [-L FEED_NAME] "
+	     "[-T CONDITIONS [-W PRE_MS[:POST_MS]] [-Y SUMMARY_INTERVAL]] "
+	     "[-R ROLLUP_TIERS] [-i INDEX_INTERVAL] "
+	     "[-A SAMPLING_CPU[:LOGGER_CPU]] [-M sleep|poll|hybrid] "
+	     "[-G SEGMENT] [-J SYNC_INTERVAL] [-E PHASE_INPUT] [--rt-check]\n",
+	     appl);
 }
 
 /**
@@ -109,11 +360,125 @@ void usage(const char *appl)
  */
 void stack_prefault(void)
 {
-     unsigned char dummy[MAX_STACK_SIZE];
-     memset(dummy, 0, MAX_STACK_SIZE);
+     unsigned char dummy[THREAD_STACK_SIZE];
+     memset(dummy, 0, THREAD_STACK_SIZE);
      return;
 }
 
+/**
+ * Create a thread on a stack of its own that is allocated and prefaulted
+ * beforehand (and locked by mlockall()), so the thread never takes a page
+ * fault on its stack. A page below the stack guards against overflows.
+ *
+ * @param thread set to the thread
+ * @param loop main function of the thread
+ * @return 0 on success; -1 on error (errno is set)
+ */
+int create_prefaulted_thread(pthread_t *thread, void *(*loop)(void *))
+{
+     size_t page_size = sysconf(_SC_PAGESIZE);
+     unsigned char *stack = mmap(NULL, page_size+THREAD_STACK_SIZE,
+				 PROT_READ|PROT_WRITE,
+				 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+     if (stack == MAP_FAILED)
+	  return -1;
+     if (mprotect(stack, page_size, PROT_NONE) == -1) {
+	  munmap(stack, page_size+THREAD_STACK_SIZE);
+	  return -1;
+     }
+     memset(stack+page_size, 0, THREAD_STACK_SIZE);
+
+     pthread_attr_t attr;
+     pthread_attr_init(&attr);
+     pthread_attr_setstack(&attr, stack+page_size, THREAD_STACK_SIZE);
+     int ret = pthread_create(thread, &attr, loop, NULL);
+     pthread_attr_destroy(&attr);
+     if (ret != 0) {
+	  munmap(stack, page_size+THREAD_STACK_SIZE);
+	  errno = ret;
+	  return -1;
+     }
+
+     return 0;
+}
+
+/**
+ * Create a thread running at normal priority.
+ *
+ * @param thread set to the thread
+ * @param loop main function of the thread
+ * @return 0 on success; -1 on error (errno is set)
+ */
+int create_background_thread(pthread_t *thread, void *(*loop)(void *))
+{
+     pthread_attr_t attr;
+     pthread_attr_init(&attr);
+     pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+     pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+     struct sched_param schedparam;
+     schedparam.sched_priority = 0;
+     pthread_attr_setschedparam(&attr, &schedparam);
+     int ret = pthread_create(thread, &attr, loop, NULL);
+     pthread_attr_destroy(&attr);
+     if (ret != 0) {
+	  errno = ret;
+	  return -1;
+     }
+
+     return 0;
+}
+
+/**
+ * Update the page faults the calling thread took since it started its
+ * loop.
+ *
+ * @param start page faults of the thread when it started its loop
+ * @param faults set to the page faults since then
+ * @return true if the thread took page faults since the last update
+ */
+bool update_faults(const struct page_faults *start, struct page_faults *faults)
+{
+     struct page_faults now;
+     if (rtcheck_thread_faults(&now) == -1)
+	  return false;
+
+     uint64_t minor = now.minor-start->minor;
+     uint64_t major = now.major-start->major;
+     bool faulted = (minor != faults->minor || major != faults->major);
+     __atomic_store_n(&faults->minor, minor, __ATOMIC_RELAXED);
+     __atomic_store_n(&faults->major, major, __ATOMIC_RELAXED);
+
+     return faulted;
+}
+
+/**
+ * Check whether the system is ready for deterministic sampling: a
+ * PREEMPT_RT kernel, SCHED_FIFO at the priority of the sampling thread,
+ * and all memory locked. Prints the result of each check.
+ *
+ * @return true if all checks passed
+ */
+bool check_realtime(void)
+{
+     bool preempt_rt = rtcheck_preempt_rt();
+     bool fifo = rtcheck_fifo(task_priority);
+     uint64_t locked_kb, unlocked_kb;
+     bool locked = rtcheck_memory_locked(&locked_kb, &unlocked_kb);
+
+     printf("PREEMPT_RT kernel: %s\n", preempt_rt ? "yes" : "NO");
+     printf("SCHED_FIFO at priority %d: %s\n", task_priority,
+	    fifo ? "yes" : "NO");
+     printf("Memory locked: %s (%llu kB locked, %llu kB not locked)\n",
+	    locked ? "yes" : "NO", (unsigned long long) locked_kb,
+	    (unsigned long long) unlocked_kb);
+     if (sampling_cpu >= 0)
+	  printf("CPU %d isolated: %s\n", sampling_cpu,
+		 timing_cpu_isolated(sampling_cpu) ? "yes" : "no");
+     fflush(stdout);
+
+     return (preempt_rt && fifo && locked);
+}
+
 /**
  * Convert a frequency value to a time interval.
  *
@@ -135,31 +500,6 @@ struct timespec frequency_to_interval(double frequency)
      return itimespec;
 }
 
-/**
- * Calculate timestamp of next sample.
- *
- * @param tlast time of last sample
- * @param interval sampling interval
- * @return time of next sample
- * 
- */
-struct timespec next_sampling_time(struct timespec tlast,
-				   struct timespec interval)
-{
-     struct timespec tnext;
-     
-     tnext.tv_sec = tlast.tv_sec+interval.tv_sec;
-     tnext.tv_nsec = tlast.tv_nsec+interval.tv_nsec;
-
-     /* Normalize */
-     if (tnext.tv_nsec >= 1000000000l) {
-	  tnext.tv_sec++;
-	  tnext.tv_nsec -= 1000000000l;
-     }
-
-     return tnext;
-}
-
 /**
  * Convert timespec values (sec, ns) to plain 64 bit nanosecond value.
  *
@@ -175,29 +515,44 @@ uint64_t to_nanosec(struct timespec t)
 }
 
 /**
- * Write timestamped samples as to log file.
+ * Convert plain 64 bit nanosecond value to timespec values (sec, ns).
  *
- * Format: comma-separated values 
- * timestamp [nanoseconds], value 
+ * @param t_ns value in nanoseconds
+ * @return timespec values corresponding to nanosecond value
+ */
+struct timespec to_timespec(uint64_t t_ns)
+{
+     struct timespec t;
+     t.tv_sec = t_ns/1000000000ull;
+     t.tv_nsec = t_ns%1000000000ull;
+
+     return t;
+}
+
+/**
+ * Sample the inputs of a scan, or oversample them and reduce the
+ * conversions of each input to one value by the decimation filter.
  *
- * @param fout output file
- * @param sample sample value
- * @param tsample timestamp of sample
+ * @param indices inputs to be sampled
+ * @param count number of inputs
+ * @param samples set to the value of each input
+ * @return 0 on success; -1 on error; ADC_END if the source has no more
+ * samples
  */
-void log_sample(FILE *fout, int16_t sample1, int16_t sample2, uint64_t t)
+int scan_inputs(const unsigned int *indices, unsigned int count,
+		uint16_t *samples)
 {
-     fprintf(fout, "%llu,%d,%d\n", t, sample1, sample2);
+     if (oversampling == 1)
+	  return adc_scan(adc, indices, count, samples);
 
-     /*
-     uint8_t buffer[10];
-     memcpy(buffer, &t, 8);
-     memcpy(&buffer[8], &sample, 2);
-     fwrite(buffer, 1, 10, fout);
-     */
+     for (unsigned int b = 0; b < oversampling; b++) {
+	  int ret = adc_scan(adc, indices, count, &burst_samples[b*count]);
+	  if (ret != 0)
+	       return ret;
+     }
+     decimator_run(&decimator, burst_samples, indices, count, samples);
 
-     /*
-     fflush(fout);
-     */
+     return 0;
 }
 
 /**
@@ -213,41 +568,551 @@ void *sampling_thread_loop(void *args)
 	  perror("sched_setscheduler failed");
 	  die(-1);
      }
+     if (sampling_cpu >= 0 && timing_pin(sampling_cpu) == -1) {
+	  perror("Could not pin sampling thread");
+	  die(-1);
+     }
     
-     /* Start sampling in an infinite loop (until thread is canceled) */
+     /* Start sampling in an infinite loop (until thread is canceled).
+	Each input has its own sampling deadline; all inputs are due now. */
+
+     struct timespec tstart;
+     clock_gettime(CLOCK_MONOTONIC, &tstart);
+     uint64_t tprevious_ns = to_nanosec(tstart);
+
+     struct deadline_queue queue;
+     deadline_queue_init(&queue);
+     for (unsigned int i = 0; i < scan_length; i++)
+	  deadline_queue_push(&queue, i, tprevious_ns);
+
+     struct page_faults faults_start;
+     rtcheck_thread_faults(&faults_start);
+     uint64_t tfault_check = tprevious_ns+FAULT_CHECK_INTERVAL;
      
-     struct timespec tsample;
-     clock_gettime(CLOCK_MONOTONIC, &tsample);
-     uint64_t tprevious_ns = to_nanosec(tsample);
      while (true) {
-	  // Take a sample 
-	  int16_t sample1 = get_sample_singleended(adc_channel1, spi_channel);
-	  int16_t sample2 = get_sample_singleended(adc_channel2, spi_channel);
+	  /* Polling for the deadline and putting into the ring make no
+	     system call that is a cancellation point, so SIGINT and quit
+	     could not stop the thread otherwise. */
+	  pthread_testcancel();
+
+	  // Sleep until the next input is due
+	  uint64_t tdue = deadline_queue_next(&queue);
+	  if (!adc->paced)
+	       timing_wait(&timing, tdue);
+	  struct timespec twake;
+	  clock_gettime(CLOCK_MONOTONIC, &twake);
+	  uint64_t twake_ns = to_nanosec(twake);
+	  if (!adc->paced)
+	       histogram_record(&lateness_histogram,
+				twake_ns > tdue ? twake_ns-tdue : 0);
+
+	  // Scan all inputs due at this deadline
+	  unsigned int due = 0;
+	  uint64_t deadlines[MAX_SCAN_INPUTS];
+	  while (queue.length > 0 && deadline_queue_next(&queue) <= tdue) {
+	       uint64_t deadline;
+	       unsigned int i = deadline_queue_pop(&queue, &deadline);
+	       due |= 1u << i;
+	       deadlines[i] = deadline;
+	  }
+	  
+	  unsigned int indices[MAX_SCAN_INPUTS];
+	  unsigned int count = 0;
+	  for (unsigned int k = 0; k < scan_length; k++) {
+	       unsigned int i = scan_order[k];
+	       if (due & (1u << i))
+		    indices[count++] = i;
+	  }
 	  
-	  // Timestamp sample
+	  uint16_t samples[MAX_SCAN_INPUTS];
+	  int ret = scan_inputs(indices, count, samples);
+	  if (ret == ADC_END) {
+	       /* The source has no more samples. The logger thread
+		  terminates after it has drained the ring (see main()). */
+	       update_faults(&faults_start, &sampling_faults);
+	       return NULL;
+	  }
+	  bool error = (ret == -1);
+	  uint16_t values[MAX_SCAN_INPUTS];
+	  for (unsigned int i = 0; i < scan_length; i++)
+	       values[i] = RING_NO_VALUE;
+	  for (unsigned int k = 0; k < count; k++)
+	       values[indices[k]] = samples[k];
+	  
+	  // Timestamp scan
 	  struct timespec tnow;
       	  clock_gettime(CLOCK_MONOTONIC , &tnow);
 
 	  uint64_t tnow_ns = to_nanosec(tnow);
-	  uint64_t delta = tnow_ns-tprevious_ns;
-	  if (delta > max_delta) {
-	       max_delta = delta;
-	  }
+	  histogram_record(&scan_duration_histogram, tnow_ns-twake_ns);
+	  if (scans > 0)
+	       histogram_record(&scan_interval_histogram,
+				tnow_ns-tprevious_ns);
 	  tprevious_ns = tnow_ns;
+	  if (scans == 0)
+	       __atomic_store_n(&tfirst_scan, tnow_ns, __ATOMIC_RELAXED);
+	  __atomic_store_n(&tlast_scan, tnow_ns, __ATOMIC_RELAXED);
+	  __atomic_store_n(&scans, scans+1, __ATOMIC_RELAXED);
 
-	  if (sample1 == -1 || sample2 == -1) {
+	  /* Counting page faults takes a system call, so only once per
+	     interval. */
+	  if (tnow_ns >= tfault_check) {
+	       tfault_check = tnow_ns+FAULT_CHECK_INTERVAL;
+	       if (update_faults(&faults_start, &sampling_faults)) {
+		    fprintf(stderr, "Sampling thread took page faults "
+			    "(%llu minor, %llu major in total)\n",
+			    (unsigned long long) sampling_faults.minor,
+			    (unsigned long long) sampling_faults.major);
+		    if (rt_check) {
+			 sampling_faulted = true;
+			 return NULL;
+		    }
+	       }
+	  }
+
+	  if (error) {
 	       fprintf(stderr, "Error while taking sample\n");
 	  } else {
-	       struct ring_entry entry;
-	       entry.timestamp = to_nanosec(tnow);
-	       entry.value1 = sample1;
-	       entry.value2 = sample2;
-	       ring_put(&the_ring, &entry);
+	       /* Never block the sampling thread. If the logger cannot keep
+		  up, a scan is lost according to the ring policy, and the
+		  logger records a gap. Sources pacing themselves (replayed
+		  logs) have no deadlines, so they wait for the logger. */
+	       while (adc->paced && ring_full(&the_ring)) {
+		    struct timespec tretry = {0, 100000};
+		    clock_nanosleep(CLOCK_MONOTONIC, 0, &tretry, NULL);
+	       }
+	       if (ring_put(&the_ring, tnow_ns, values) != 0)
+		    __atomic_store_n(&ring_overflows, ring_overflows+1,
+				     __ATOMIC_RELAXED);
 	  }
-	  
-	  // Sleep until next sampling time
-	  tsample = next_sampling_time(tsample, sampling_interval);
-	  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tsample, NULL);
+
+	  // Schedule next samples of scanned inputs
+	  for (unsigned int i = 0; i < scan_length; i++) {
+	       if (!(due & (1u << i)))
+		    continue;
+	       uint64_t next = deadlines[i]+scan_intervals[i];
+	       /* Deadlines of sources pacing themselves are virtual and
+		  cannot be missed. */
+	       if (next <= tnow_ns && !adc->paced) {
+		    /* Overrun: we are already past the next deadline. Skip
+		       all deadlines that have passed rather than sampling
+		       in a burst to catch up. */
+		    uint64_t missed = (tnow_ns-next)/scan_intervals[i] + 1;
+		    next += missed*scan_intervals[i];
+		    __atomic_store_n(&skipped_ticks[i], skipped_ticks[i]+missed,
+				     __ATOMIC_RELAXED);
+		    __atomic_store_n(&overruns, overruns+1, __ATOMIC_RELAXED);
+	       }
+	       deadline_queue_push(&queue, i, next);
+	  }
+     }
+}
+
+/**
+ * Main loop of statistics thread, writing the timing statistics to the
+ * statistics file periodically.
+ */
+void *stats_thread_loop(void *args)
+{
+     struct timespec tstart;
+     clock_gettime(CLOCK_MONOTONIC, &tstart);
+     uint64_t tnext_ns = to_nanosec(tstart);
+     
+     while (true) {
+	  tnext_ns += 1000000000ull*stats_interval;
+	  struct timespec tnext = to_timespec(tnext_ns);
+	  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tnext, NULL);
+
+	  /* Do not leave a partial report behind if canceled. */
+	  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	  fprintf(stats_file, "# %.3f s\n",
+		  (tnext_ns-to_nanosec(tstart))/1000000000.0);
+	  print_stats(stats_file);
+	  fflush(stats_file);
+	  pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+     }
+}
+
+/**
+ * Log a batch of scans taken from the ring into the current recording. If
+ * a switch of the recording is due, the scans before its time go to the
+ * current recording and the others to the next one.
+ *
+ * @param n number of scans
+ */
+void log_batch(unsigned int n)
+{
+     unsigned int first = 0;
+     struct control_request *request = control_due(&control_pending,
+						   logger_timestamps, n,
+						   &first);
+     if (request != NULL) {
+	  if (recording != NULL)
+	       logger_log(&recording->logger, logger_timestamps,
+			  logger_values, logger_gaps, first);
+	  struct recording *previous = recording;
+	  recording = request->next;
+	  control_done(request, previous);
+     }
+
+     if (recording != NULL && first < n)
+	  logger_log(&recording->logger, &logger_timestamps[first],
+		     &logger_values[first*scan_length], &logger_gaps[first],
+		     n-first);
+}
+
+/**
+ * Switch the logger thread to another recording at the current time. Must
+ * be called with recording_mutex held.
+ *
+ * @param next the recording to switch to (NULL to stop recording)
+ * @param previous set to the recording switched from (NULL if none)
+ * @return 0 on success; -1 if the logger thread has terminated
+ */
+int switch_recording(struct recording *next, struct recording **previous)
+{
+     struct timespec tnow;
+     clock_gettime(CLOCK_MONOTONIC, &tnow);
+     struct control_request request;
+     request.time = to_nanosec(tnow);
+     request.next = next;
+     if (next != NULL)
+	  next->tstart = request.time;
+     if (control_switch(&control_pending, &request) == -1)
+	  return -1;
+
+     control_recording = next;
+     *previous = request.previous;
+     return 0;
+}
+
+/**
+ * Continue the current recording in its next segment. The next segment
+ * is opened and preallocated before the logger thread switches to it, and
+ * the previous one is closed and renamed afterwards. If the next segment
+ * cannot be opened, the current one grows until the next attempt. Must be
+ * called with recording_mutex held.
+ */
+void next_segment(void)
+{
+     struct recording *current = control_recording;
+     /* Without a size limit, a segment probably takes as much as the
+	previous one. */
+     uint64_t preallocate = recording_config.segment_size;
+     if (preallocate == 0)
+	  preallocate = __atomic_load_n(&current->logger.bytes_written,
+					__ATOMIC_RELAXED);
+     struct recording *next = malloc(sizeof(*next));
+     if (next == NULL)
+	  return;
+     if (recording_open(next, &recording_config, current->path,
+			current->segment+1, preallocate) == -1) {
+	  recording_perror(next, stderr);
+	  free(next);
+	  return;
+     }
+
+     struct recording *previous;
+     if (switch_recording(next, &previous) == -1) {
+	  recording_close(next);
+	  free(next);
+	  return;
+     }
+     recording_close(previous);
+     recording_report(previous, stdout, stderr);
+     if (previous != &the_recording)
+	  free(previous);
+}
+
+/**
+ * Main loop of I/O thread, which starts new segments and writes back the
+ * current log file steadily.
+ */
+void *io_thread_loop(void *args)
+{
+     struct timespec tstart;
+     clock_gettime(CLOCK_MONOTONIC, &tstart);
+     uint64_t tnext_ns = to_nanosec(tstart);
+     uint64_t tsync_ns = tnext_ns+sync_interval;
+
+     while (true) {
+	  tnext_ns += IO_INTERVAL;
+	  struct timespec tnext = to_timespec(tnext_ns);
+	  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tnext, NULL);
+
+	  /* A segment is always switched and closed completely. */
+	  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	  pthread_mutex_lock(&recording_mutex);
+	  struct recording *r = control_recording;
+	  if (r != NULL && recording_segmented(&recording_config) &&
+	      recording_segment_full(r, &recording_config, tnext_ns))
+	       next_segment();
+	  else if (r != NULL && sync_interval > 0 && tnext_ns >= tsync_ns)
+	       logger_writeback(&r->logger);
+	  pthread_mutex_unlock(&recording_mutex);
+	  pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+	  if (tnext_ns >= tsync_ns)
+	       tsync_ns = tnext_ns+sync_interval;
+     }
+}
+
+/**
+ * Print the counters of a recording closed by a command as the answer.
+ *
+ * @param f stream of the answer
+ * @param r the recording
+ */
+void answer_recording(FILE *f, const struct recording *r)
+{
+     const struct logger *l = &r->logger;
+     fprintf(f, "ok scans=%llu gaps=%llu lost=%llu",
+	     (unsigned long long) l->scans, (unsigned long long) l->gaps,
+	     (unsigned long long) l->lost_scans);
+     if (l->trigger != NULL)
+	  fprintf(f, " events=%llu captured=%llu",
+		  (unsigned long long) l->trigger->events,
+		  (unsigned long long) l->captured_scans);
+     if (l->calibration != NULL && l->energy.samples > 1)
+	  fprintf(f, " energy_mj=%.3f", l->energy.energy/1000000000.0);
+     if (l->write_errors > 0)
+	  fprintf(f, " write_errors=%llu",
+		  (unsigned long long) l->write_errors);
+     fputc('\n', f);
+}
+
+/**
+ * Queue a phase marker for the logger thread.
+ *
+ * @param m the marker
+ * @return NULL on success; otherwise the reason the marker was rejected
+ */
+const char *mark_phase(const struct phase_marker *m)
+{
+     pthread_mutex_lock(&phase_mutex);
+     int ret = phase_mark(phases, m);
+     int error = errno;
+     pthread_mutex_unlock(&phase_mutex);
+     if (ret == 0)
+	  return NULL;
+     return (error == EINVAL ? "marker earlier than the previous one" :
+	     "too many markers queued");
+}
+
+/**
+ * Carry out a command of the control socket (see control.h).
+ *
+ * @param line the command (modified)
+ * @param f stream of the answer
+ */
+void control_command(char *line, FILE *f)
+{
+     enum control_command command;
+     char *path;
+     if (control_parse(line, &command, &path) == -1) {
+	  fprintf(f, "error unknown command\n");
+	  return;
+     }
+
+     if (command == CONTROL_BEGIN || command == CONTROL_END) {
+	  struct timespec tnow;
+	  clock_gettime(CLOCK_MONOTONIC, &tnow);
+	  struct phase_marker marker;
+	  const char *error = "invalid marker";
+	  if (phase_parse_marker(command == CONTROL_BEGIN, path,
+				 to_nanosec(tnow), &marker) == 0)
+	       error = mark_phase(&marker);
+	  if (error != NULL)
+	       fprintf(f, "error %s\n", error);
+	  else
+	       fprintf(f, "ok\n");
+	  return;
+     }
+     if (command == CONTROL_STATUS) {
+	  if (control_recording != NULL)
+	       fprintf(f, "ok recording %s %llu\n", control_recording->path,
+		       (unsigned long long) __atomic_load_n(
+			    &control_recording->logger.scans,
+			    __ATOMIC_RELAXED));
+	  else
+	       fprintf(f, "ok idle\n");
+	  return;
+     }
+     if (command == CONTROL_START && control_recording != NULL) {
+	  fprintf(f, "error already recording\n");
+	  return;
+     }
+     if ((command == CONTROL_ROTATE || command == CONTROL_STOP) &&
+	 control_recording == NULL) {
+	  fprintf(f, "error not recording\n");
+	  return;
+     }
+
+     /* The next recording is opened here, so the logger thread only
+	switches pointers. */
+     struct recording *next = NULL;
+     if (command == CONTROL_START || command == CONTROL_ROTATE) {
+	  next = malloc(sizeof(*next));
+	  if (next == NULL) {
+	       fprintf(f, "error out of memory\n");
+	       return;
+	  }
+	  if (recording_open(next, &recording_config, path, 0,
+			     recording_config.segment_size) == -1) {
+	       fprintf(f, "error ");
+	       recording_perror(next, f);
+	       free(next);
+	       return;
+	  }
+     }
+
+     if (command != CONTROL_QUIT || control_recording != NULL) {
+	  struct recording *previous;
+	  if (switch_recording(next, &previous) == -1) {
+	       fprintf(f, "error terminating\n");
+	       if (next != NULL) {
+		    recording_close(next);
+		    free(next);
+	       }
+	       return;
+	  }
+
+	  if (previous != NULL) {
+	       recording_close(previous);
+	       answer_recording(f, previous);
+	       if (previous != &the_recording)
+		    free(previous);
+	  } else {
+	       fprintf(f, "ok\n");
+	  }
+     } else {
+	  fprintf(f, "ok\n");
+     }
+
+     if (command == CONTROL_QUIT) {
+	  fflush(f);
+	  pthread_cancel(sampling_thread);
+     }
+}
+
+/**
+ * Read the phase marker lines available from phase_fd and queue the
+ * markers. A marker without timestamp takes effect when it is read. At
+ * the end of the input, phase_fd is closed.
+ *
+ * @param line buffer holding the start of a line not read completely
+ * (PHASE_MAX_LINE bytes)
+ * @param fill length of the start of the line
+ */
+void read_phase_markers(char *line, size_t *fill)
+{
+     ssize_t n = read(phase_fd, line+*fill, PHASE_MAX_LINE-1-*fill);
+     if (n == -1 && (errno == EINTR || errno == EAGAIN))
+	  return;
+     if (n <= 0) {
+	  close(phase_fd);
+	  phase_fd = -1;
+	  return;
+     }
+     struct timespec tnow;
+     clock_gettime(CLOCK_MONOTONIC, &tnow);
+     *fill += n;
+
+     char *start = line;
+     char *newline;
+     while ((newline = memchr(start, '\n', line+*fill-start)) != NULL) {
+	  *newline = '\0';
+	  struct phase_marker marker;
+	  const char *error = "invalid marker";
+	  if (start[strspn(start, " \r")] == '\0')
+	       error = NULL;
+	  else if (phase_parse(start, to_nanosec(tnow), &marker) == 0)
+	       error = mark_phase(&marker);
+	  if (error != NULL)
+	       fprintf(stderr, "Phase marker rejected: %s\n", error);
+	  start = newline+1;
+     }
+     *fill = line+*fill-start;
+     memmove(line, start, *fill);
+     if (*fill == PHASE_MAX_LINE-1) {
+	  fprintf(stderr, "Phase marker rejected: line too long\n");
+	  *fill = 0;
+     }
+}
+
+/**
+ * Print the finished phases.
+ *
+ * @param f the stream
+ */
+void print_phases(FILE *f)
+{
+     struct phase_result r;
+     while (phase_take(phases, &r))
+	  phase_print(f, &r);
+     fflush(f);
+}
+
+/**
+ * Main loop of phase thread, which reads phase markers and prints the
+ * phases finished by the logger thread.
+ */
+void *phase_thread_loop(void *args)
+{
+     char line[PHASE_MAX_LINE];
+     size_t fill = 0;
+
+     while (true) {
+	  /* Without input, poll() only waits. */
+	  struct pollfd pfd = {phase_fd, POLLIN, 0};
+	  int ready = poll(&pfd, 1, PHASE_POLL_INTERVAL);
+
+	  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	  if (ready > 0)
+	       read_phase_markers(line, &fill);
+	  print_phases(stdout);
+	  pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+     }
+}
+
+/**
+ * Main loop of control thread, serving one client of the control socket
+ * after the other.
+ */
+void *control_thread_loop(void *args)
+{
+     while (true) {
+	  int fd = accept(control_fd, NULL, NULL);
+	  if (fd == -1)
+	       continue;
+	  int out_fd = dup(fd);
+	  FILE *in = fdopen(fd, "r");
+	  FILE *out = (out_fd != -1 ? fdopen(out_fd, "w") : NULL);
+	  if (in == NULL || out == NULL) {
+	       if (in != NULL)
+		    fclose(in);
+	       else
+		    close(fd);
+	       if (out != NULL)
+		    fclose(out);
+	       else if (out_fd != -1)
+		    close(out_fd);
+	       continue;
+	  }
+
+	  /* A command is always carried out to the end, since it may have
+	     switched recordings. */
+	  char line[CONTROL_MAX_LINE];
+	  while (fgets(line, sizeof(line), in) != NULL) {
+	       pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	       pthread_mutex_lock(&recording_mutex);
+	       control_command(line, out);
+	       pthread_mutex_unlock(&recording_mutex);
+	       fflush(out);
+	       pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	  }
+	  fclose(in);
+	  fclose(out);
      }
 }
 
@@ -267,11 +1132,30 @@ void *logger_thread_loop(void *args)
 	  perror("sched_setscheduler failed");
 	  die(-1);
      }
+     if (logger_cpu >= 0 && timing_pin(logger_cpu) == -1) {
+	  perror("Could not pin logger thread");
+	  die(-1);
+     }
+     
+     /* The logger thread may only be canceled while it is waiting for
+	samples, i.e., after it has drained the ring, and never while it is
+	writing. */
+     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+     struct page_faults faults_start;
+     rtcheck_thread_faults(&faults_start);
      
      while (true) {
-	  struct ring_entry entry;
-	  ring_get(&the_ring, &entry);
-	  log_sample(fout, entry.value1, entry.value2, entry.timestamp);
+	  pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	  unsigned int n = ring_get_many(&the_ring, logger_timestamps,
+					 logger_values, logger_gaps,
+					 DRAIN_BATCH);
+	  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	  
+	  if (feed != NULL)
+	       feed_publish(feed, logger_timestamps, logger_values, n);
+	  log_batch(n);
+	  update_faults(&faults_start, &logger_faults);
      }
 }
 
@@ -316,23 +1200,182 @@ int to_mcp320x_channel(int channel, enum channel_singleended *mcp320x_channel)
      return 0;
 }
 
+/**
+ * Parse an ADC input, either a single-ended channel ("N", N in [0,7]) or a
+ * differential channel pair ("N-M" for IN+ = N, IN- = M, where N and M
+ * are the two channels of one of the pairs 0/1, 2/3, 4/5, 6/7).
+ *
+ * @param s input specification
+ * @param input parsed input
+ * @return 0 if the input is valid; -1 otherwise
+ */
+int parse_adc_input(const char *s, struct mcp320x_input *input)
+{
+     char *end;
+     long channel = strtol(s, &end, 10);
+     if (end == s || channel < 0 || channel > 7)
+	  return -1;
+
+     if (*end == '\0') {
+	  enum channel_singleended se;
+	  to_mcp320x_channel(channel, &se);
+	  input->differential = false;
+	  input->channel = se;
+	  return 0;
+     }
+
+     if (*end != '-')
+	  return -1;
+     
+     const char *minus = end+1;
+     long channel_minus = strtol(minus, &end, 10);
+     if (end == minus || *end != '\0' || (channel^1) != channel_minus)
+	  return -1;
+
+     /* The differential pairs CH0CH1, CH1CH0, ... are enumerated in the
+	order of their IN+ channel. */
+     input->differential = true;
+     input->channel = (enum channel_differential) channel;
+
+     return 0;
+}
+
+/**
+ * Parse a comma-separated list of ADC inputs into the scan list. Each
+ * input may be prefixed by "SPI_CHANNEL:" to select the ADC on another
+ * SPI channel than the default one, and followed by "@FREQUENCY" to
+ * sample it at its own frequency rather than the default sampling
+ * frequency.
+ *
+ * @param s list of inputs
+ * @return 0 if the list is valid; -1 otherwise
+ */
+int parse_scan_list(const char *s)
+{
+     char list[256];
+     strncpy(list, s, sizeof(list)-1);
+     list[sizeof(list)-1] = '\0';
+
+     scan_length = 0;
+     char *saveptr;
+     for (char *token = strtok_r(list, ",", &saveptr); token != NULL;
+	  token = strtok_r(NULL, ",", &saveptr)) {
+	  if (scan_length == MAX_SCAN_INPUTS)
+	       return -1;
+	  
+	  scan_spi_channels[scan_length] = spi_channel;
+	  char *colon = strchr(token, ':');
+	  if (colon != NULL) {
+	       *colon = '\0';
+	       if (strcmp(token, "0") == 0)
+		    scan_spi_channels[scan_length] = 0;
+	       else if (strcmp(token, "1") == 0)
+		    scan_spi_channels[scan_length] = 1;
+	       else
+		    return -1;
+	       token = colon+1;
+	  }
+	  
+	  scan_frequencies[scan_length] = 0.0;
+	  char *at = strchr(token, '@');
+	  if (at != NULL) {
+	       *at = '\0';
+	       char *end;
+	       scan_frequencies[scan_length] = strtod(at+1, &end);
+	       if (end == at+1 || *end != '\0' ||
+		   scan_frequencies[scan_length] <= 0.0)
+		    return -1;
+	  }
+	  
+	  if (parse_adc_input(token, &scan_list[scan_length]) == -1)
+	       return -1;
+	  scan_length++;
+     }
+
+     return (scan_length > 0 ? 0 : -1);
+}
+
+/**
+ * Determine the order in which inputs are sampled within a scan. The
+ * transactions to the ADCs on both SPI channels are interleaved, so the
+ * n-th inputs of both ADCs are sampled at most one SPI transaction apart.
+ * Inputs of one ADC keep the order of the scan list.
+ */
+void interleave_scan_order(void)
+{
+     unsigned int next[2] = {0, 0};
+     unsigned int k = 0;
+     while (k < scan_length) {
+	  for (unsigned int cs = 0; cs < 2; cs++) {
+	       while (next[cs] < scan_length &&
+		      scan_spi_channels[next[cs]] != cs)
+		    next[cs]++;
+	       if (next[cs] < scan_length)
+		    scan_order[k++] = next[cs]++;
+	  }
+     }
+}
 
 /**
  * The main function.
  */
 int main(int argc, char *argv[])
 {
+     /* Never give heap memory back to the system and never map allocations
+	of their own, so all memory allocated during setup stays locked
+	and prefaulted after mlockall(). */
+     mallopt(M_TRIM_THRESHOLD, -1);
+     mallopt(M_MMAP_MAX, 0);
+
+     /* die() prints the statistics, so they must be valid from the
+	start. */
+     histogram_init(&lateness_histogram, "wakeup_lateness");
+     histogram_init(&scan_duration_histogram, "scan_duration");
+     histogram_init(&scan_interval_histogram, "scan_interval");
+
      /* Parse arguments */
      
      char *spi_channel_arg = NULL;
      char *adc_channel1_arg = NULL;
      char *adc_channel2_arg = NULL;
+     char *adc_inputs_arg = NULL;
      char *spi_frequency_arg = NULL;
      char *sampling_frequency_arg = NULL;
      char *logfile_arg = NULL;
      char *task_priority_arg = NULL;
+     char *wakeup_batch_arg = NULL;
+     char *log_format_arg = NULL;
+     char *chunk_size_arg = NULL;
+     char *flush_interval_arg = NULL;
+     bool direct = false;
+     char *calibration_arg = NULL;
+     bool calibrated_columns = false;
+     char *backend_arg = NULL;
+     char *stats_file_arg = NULL;
+     char *stats_interval_arg = NULL;
+     char *ring_size_arg = NULL;
+     char *ring_policy_arg = NULL;
+     char *oversampling_arg = NULL;
+     char *filter_arg = NULL;
+     char *feed_arg = NULL;
+     char *trigger_arg = NULL;
+     char *trigger_window_arg = NULL;
+     char *summary_interval_arg = NULL;
+     char *rollup_arg = NULL;
+     char *index_interval_arg = NULL;
+     char *affinity_arg = NULL;
+     char *timing_mode_arg = NULL;
+     char *segment_arg = NULL;
+     char *sync_interval_arg = NULL;
+     char *phase_input_arg = NULL;
+     static const struct option long_options[] = {
+	  {"rt-check", no_argument, NULL, RT_CHECK_OPTION},
+	  {NULL, 0, NULL, 0}
+     };
      int c;
-     while ((c = getopt(argc, argv, "s:a:b:f:F:o:p:")) != -1) {
+     while ((c = getopt_long(argc, argv,
+			     "s:a:b:l:f:F:o:m:c:dt:C:Pp:w:B:S:I:r:O:HX:D:L:T:W:Y:R:i:A:M:U:G:J:E:",
+			     long_options, NULL)) != -1) {
 	  switch (c) {
 	  case 's' :
 	       spi_channel_arg = malloc(strlen(optarg)+1);
@@ -346,6 +1389,10 @@ int main(int argc, char *argv[])
 	       adc_channel2_arg = malloc(strlen(optarg)+1);
 	       strcpy(adc_channel2_arg, optarg);
 	       break;
+	  case 'l' :
+	       adc_inputs_arg = malloc(strlen(optarg)+1);
+	       strcpy(adc_inputs_arg, optarg);
+	       break;
 	  case 'f' :
 	       spi_frequency_arg = malloc(strlen(optarg)+1);
 	       strcpy(spi_frequency_arg, optarg);
@@ -358,10 +1405,118 @@ int main(int argc, char *argv[])
 	       logfile_arg = malloc(strlen(optarg)+1);
 	       strcpy(logfile_arg, optarg);
 	       break;
+	  case 'm' :
+	       log_format_arg = malloc(strlen(optarg)+1);
+	       strcpy(log_format_arg, optarg);
+	       break;
+	  case 'c' :
+	       chunk_size_arg = malloc(strlen(optarg)+1);
+	       strcpy(chunk_size_arg, optarg);
+	       break;
+	  case 'd' :
+	       direct = true;
+	       break;
+	  case 't' :
+	       flush_interval_arg = malloc(strlen(optarg)+1);
+	       strcpy(flush_interval_arg, optarg);
+	       break;
+	  case 'C' :
+	       calibration_arg = malloc(strlen(optarg)+1);
+	       strcpy(calibration_arg, optarg);
+	       break;
+	  case 'P' :
+	       calibrated_columns = true;
+	       break;
 	  case 'p' :
 	       task_priority_arg = malloc(strlen(optarg)+1);
 	       strcpy(task_priority_arg, optarg);
 	       break;
+	  case 'w' :
+	       wakeup_batch_arg = malloc(strlen(optarg)+1);
+	       strcpy(wakeup_batch_arg, optarg);
+	       break;
+	  case 'B' :
+	       backend_arg = malloc(strlen(optarg)+1);
+	       strcpy(backend_arg, optarg);
+	       break;
+	  case 'S' :
+	       stats_file_arg = malloc(strlen(optarg)+1);
+	       strcpy(stats_file_arg, optarg);
+	       break;
+	  case 'I' :
+	       stats_interval_arg = malloc(strlen(optarg)+1);
+	       strcpy(stats_interval_arg, optarg);
+	       break;
+	  case 'r' :
+	       ring_size_arg = malloc(strlen(optarg)+1);
+	       strcpy(ring_size_arg, optarg);
+	       break;
+	  case 'O' :
+	       ring_policy_arg = malloc(strlen(optarg)+1);
+	       strcpy(ring_policy_arg, optarg);
+	       break;
+	  case 'H' :
+	       ring_huge_pages = true;
+	       break;
+	  case 'X' :
+	       oversampling_arg = malloc(strlen(optarg)+1);
+	       strcpy(oversampling_arg, optarg);
+	       break;
+	  case 'D' :
+	       filter_arg = malloc(strlen(optarg)+1);
+	       strcpy(filter_arg, optarg);
+	       break;
+	  case 'L' :
+	       feed_arg = malloc(strlen(optarg)+1);
+	       strcpy(feed_arg, optarg);
+	       break;
+	  case 'T' :
+	       trigger_arg = malloc(strlen(optarg)+1);
+	       strcpy(trigger_arg, optarg);
+	       break;
+	  case 'W' :
+	       trigger_window_arg = malloc(strlen(optarg)+1);
+	       strcpy(trigger_window_arg, optarg);
+	       break;
+	  case 'Y' :
+	       summary_interval_arg = malloc(strlen(optarg)+1);
+	       strcpy(summary_interval_arg, optarg);
+	       break;
+	  case 'R' :
+	       rollup_arg = malloc(strlen(optarg)+1);
+	       strcpy(rollup_arg, optarg);
+	       break;
+	  case 'i' :
+	       index_interval_arg = malloc(strlen(optarg)+1);
+	       strcpy(index_interval_arg, optarg);
+	       break;
+	  case 'A' :
+	       affinity_arg = malloc(strlen(optarg)+1);
+	       strcpy(affinity_arg, optarg);
+	       break;
+	  case 'M' :
+	       timing_mode_arg = malloc(strlen(optarg)+1);
+	       strcpy(timing_mode_arg, optarg);
+	       break;
+	  case 'G' :
+	       segment_arg = malloc(strlen(optarg)+1);
+	       strcpy(segment_arg, optarg);
+	       break;
+	  case 'J' :
+	       sync_interval_arg = malloc(strlen(optarg)+1);
+	       strcpy(sync_interval_arg, optarg);
+	       break;
+	  case 'E' :
+	       phase_input_arg = malloc(strlen(optarg)+1);
+	       strcpy(phase_input_arg, optarg);
+	       break;
+	  case 'U' :
+	       control_path = malloc(strlen(optarg)+1);
+	       strcpy(control_path, optarg);
+	       break;
+	  case RT_CHECK_OPTION :
+	       rt_check = true;
+	       break;
 	  case '?':
 	       fprintf(stderr, "Unknown option\n");
 	       usage(argv[0]);
@@ -370,83 +1525,422 @@ int main(int argc, char *argv[])
 	  }
      }
 	      
-     if (spi_frequency_arg == NULL || adc_channel1_arg == NULL ||
-	 adc_channel2_arg == NULL || spi_channel_arg == NULL ||
+     /* Inputs are either given as two channels (-a, -b) or a list (-l) */
+     bool adc_channels_given = (adc_channel1_arg != NULL ||
+				adc_channel2_arg != NULL);
+     /* Replayed logs need no SPI settings */
+     bool replay = (backend_arg != NULL &&
+		    strncmp(backend_arg, "replay", strlen("replay")) == 0);
+     if ((!replay && (spi_frequency_arg == NULL ||
+		      spi_channel_arg == NULL)) ||
+	 adc_channels_given == (adc_inputs_arg != NULL) ||
+	 (adc_channels_given && (adc_channel1_arg == NULL ||
+				 adc_channel2_arg == NULL)) ||
 	 sampling_frequency_arg == NULL ||
-	  logfile_arg == NULL) {
+	 (logfile_arg == NULL && control_path == NULL)) {
 	  usage(argv[0]);
 	  die(-1);
      }
 
-     spi_channel = atoi(spi_channel_arg);
-     spi_frequency = atoi(spi_frequency_arg);
-     sampling_frequency = strtod(sampling_frequency_arg, NULL);
-
-     uint8_t channel = atoi(adc_channel1_arg);
-     if (to_mcp320x_channel(channel, &adc_channel1) == -1) {
-	  fprintf(stderr, "ADC channel must in in range 0 to 7\n");
+     spi_channel = (spi_channel_arg != NULL ? atoi(spi_channel_arg) : 0);
+     if (spi_channel != 0 && spi_channel != 1) {
+	  fprintf(stderr, "SPI channel must be 0 or 1\n");
 	  die(-1);
      }
+     spi_frequency = (spi_frequency_arg != NULL ? atoi(spi_frequency_arg) :
+		      0);
+     sampling_frequency = strtod(sampling_frequency_arg, NULL);
 
-     channel = atoi(adc_channel2_arg);
-     if (to_mcp320x_channel(channel, &adc_channel2) == -1) {
-	  fprintf(stderr, "ADC channel must in in range 0 to 7\n");
+     if (adc_channels_given) {
+	  enum channel_singleended channel1, channel2;
+	  if (to_mcp320x_channel(atoi(adc_channel1_arg), &channel1) == -1 ||
+	      to_mcp320x_channel(atoi(adc_channel2_arg), &channel2) == -1) {
+	       fprintf(stderr, "ADC channel must in in range 0 to 7\n");
+	       die(-1);
+	  }
+	  scan_list[0].differential = false;
+	  scan_list[0].channel = channel1;
+	  scan_list[1].differential = false;
+	  scan_list[1].channel = channel2;
+	  scan_spi_channels[0] = spi_channel;
+	  scan_spi_channels[1] = spi_channel;
+	  scan_length = 2;
+     } else if (parse_scan_list(adc_inputs_arg) == -1) {
+	  fprintf(stderr, "ADC inputs must be a list of up to %d channels "
+		  "(0 to 7) or channel pairs (0-1, 1-0, ..., 7-6), "
+		  "optionally prefixed by SPI_CHANNEL: and followed by "
+		  "@FREQUENCY\n", MAX_SCAN_INPUTS);
 	  die(-1);
      }
+     interleave_scan_order();
 	  
      sampling_interval = frequency_to_interval(sampling_frequency);
 
+     /* Records of binary logs are spaced by the smallest interval. */
+     uint64_t min_interval = to_nanosec(sampling_interval);
+     bool multirate = false;
+     for (unsigned int i = 0; i < scan_length; i++) {
+	  if (scan_frequencies[i] > 0.0) {
+	       scan_intervals[i] = to_nanosec(
+		    frequency_to_interval(scan_frequencies[i]));
+	  } else {
+	       scan_intervals[i] = to_nanosec(sampling_interval);
+	  }
+	  if (scan_intervals[i] == 0) {
+	       fprintf(stderr, "Sampling frequency too high\n");
+	       die(-1);
+	  }
+	  if (scan_intervals[i] != to_nanosec(sampling_interval))
+	       multirate = true;
+	  if (scan_intervals[i] < min_interval)
+	       min_interval = scan_intervals[i];
+     }
+
+     enum log_format log_format = LOG_CSV;
+     bool compressed = false;
+     if (log_format_arg != NULL) {
+	  if (strcmp(log_format_arg, "csv") == 0) {
+	       log_format = LOG_CSV;
+	  } else if (strcmp(log_format_arg, "binary") == 0) {
+	       log_format = LOG_BINARY;
+	  } else if (strcmp(log_format_arg, "compressed") == 0) {
+	       /* Binary log with compressed blocks */
+	       log_format = LOG_BINARY;
+	       compressed = true;
+	  } else {
+	       fprintf(stderr, "Log format must be csv, binary, or "
+		       "compressed\n");
+	       die(-1);
+	  }
+     }
+
+     size_t chunk_size = LOGGER_DEFAULT_CHUNK_SIZE;
+     if (chunk_size_arg != NULL) {
+	  chunk_size = strtoul(chunk_size_arg, NULL, 10);
+	  if (chunk_size == 0 || chunk_size%LOGGER_ALIGNMENT != 0) {
+	       fprintf(stderr, "Chunk size must be a multiple of %d\n",
+		       LOGGER_ALIGNMENT);
+	       die(-1);
+	  }
+     }
+
+     if (ring_size_arg != NULL) {
+	  unsigned long n = strtoul(ring_size_arg, NULL, 10);
+	  if (n == 0 || n > RING_MAX_SIZE) {
+	       fprintf(stderr, "Ring size must be in range 1 to %u\n",
+		       RING_MAX_SIZE);
+	       die(-1);
+	  }
+	  ring_size = n;
+     }
+
+     if (ring_policy_arg != NULL) {
+	  if (strcmp(ring_policy_arg, "drop-newest") == 0) {
+	       ring_policy = RING_DROP_NEWEST;
+	  } else if (strcmp(ring_policy_arg, "drop-oldest") == 0) {
+	       ring_policy = RING_DROP_OLDEST;
+	  } else {
+	       fprintf(stderr, "Ring policy must be drop-newest or "
+		       "drop-oldest\n");
+	       die(-1);
+	  }
+     }
+
+     enum decimation_filter filter = DECIMATE_BOXCAR;
+     if (filter_arg != NULL) {
+	  if (strcmp(filter_arg, "boxcar") == 0) {
+	       filter = DECIMATE_BOXCAR;
+	  } else if (strcmp(filter_arg, "cic") == 0) {
+	       filter = DECIMATE_CIC;
+	  } else if (strcmp(filter_arg, "fir") == 0) {
+	       filter = DECIMATE_FIR;
+	  } else {
+	       fprintf(stderr, "Decimation filter must be boxcar, cic, or "
+		       "fir\n");
+	       die(-1);
+	  }
+     }
+
+     if (oversampling_arg != NULL) {
+	  oversampling = atoi(oversampling_arg);
+	  if (decimator_init(&decimator, filter, oversampling) == -1) {
+	       fprintf(stderr, "Oversampling must be a power of two up to "
+		       "%d\n", DECIMATOR_MAX_FACTOR);
+	       die(-1);
+	  }
+     }
+
+     /* Trigger windows in milliseconds */
+     uint64_t pre_trigger = DEFAULT_PRE_TRIGGER;
+     uint64_t post_trigger = DEFAULT_POST_TRIGGER;
+     if (trigger_window_arg != NULL) {
+	  char *end;
+	  pre_trigger = strtoull(trigger_window_arg, &end, 10);
+	  if (*end == ':')
+	       post_trigger = strtoull(end+1, &end, 10);
+	  if (*end != '\0') {
+	       fprintf(stderr, "Trigger window must be PRE_MS[:POST_MS]\n");
+	       die(-1);
+	  }
+     }
+     if (trigger_arg != NULL &&
+	 trigger_init(&the_trigger, trigger_arg, scan_length,
+		      1000000ull*pre_trigger,
+		      1000000ull*post_trigger) == -1) {
+	  fprintf(stderr, "Trigger conditions must be TYPE:CHANNEL:THRESHOLD "
+		  "with TYPE above, below, rise, or fall\n");
+	  die(-1);
+     }
+
+     /* Summary interval in seconds */
+     uint64_t summary_interval = DEFAULT_SUMMARY_INTERVAL;
+     if (summary_interval_arg != NULL) {
+	  summary_interval = strtoul(summary_interval_arg, NULL, 10);
+	  if (summary_interval == 0) {
+	       fprintf(stderr, "Summary interval must be at least 1 s\n");
+	       die(-1);
+	  }
+     }
+
+     long cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+     if (affinity_arg != NULL) {
+	  char *end;
+	  sampling_cpu = strtol(affinity_arg, &end, 10);
+	  bool valid = (end != affinity_arg);
+	  if (*end == ':')
+	       logger_cpu = strtol(end+1, &end, 10);
+	  if (!valid || *end != '\0' || sampling_cpu < 0 ||
+	      sampling_cpu >= cpu_count || logger_cpu >= cpu_count) {
+	       fprintf(stderr, "CPUs must be in range 0 to %ld\n",
+		       cpu_count-1);
+	       die(-1);
+	  }
+     }
+
+     enum timing_mode timing_mode = TIMING_SLEEP;
+     if (timing_mode_arg != NULL &&
+	 timing_parse_mode(timing_mode_arg, &timing_mode) == -1) {
+	  fprintf(stderr, "Timing mode must be sleep, poll, or hybrid\n");
+	  die(-1);
+     }
+     /* A polling sampling thread never leaves its CPU. */
+     if (timing_mode == TIMING_POLL &&
+	 (sampling_cpu < 0 || cpu_count < 2 || logger_cpu == sampling_cpu)) {
+	  fprintf(stderr, "Polling requires a CPU of its own for the "
+		  "sampling thread (-A)\n");
+	  die(-1);
+     }
+     if (timing_mode == TIMING_POLL && !timing_cpu_isolated(sampling_cpu))
+	  fprintf(stderr, "CPU %d is not isolated, other tasks may delay "
+		  "sampling\n", sampling_cpu);
+     timing_init(&timing, timing_mode);
+
+     if (calibration_arg != NULL && scan_length < 2) {
+	  fprintf(stderr, "Calibration requires a current and a voltage "
+		  "input\n");
+	  die(-1);
+     }
+     
+     if (calibration_arg != NULL &&
+	 calib_load(&calibration, calibration_arg) == -1) {
+	  perror("Could not load calibration file");
+	  die(-1);
+     }
+     
+     /* Flush interval in milliseconds */
+     uint64_t flush_interval = 0;
+     if (flush_interval_arg != NULL)
+	  flush_interval = 1000000ull*strtoul(flush_interval_arg, NULL, 10);
+
      if (task_priority_arg != NULL) {
 	  task_priority = atoi(task_priority_arg);
      } else {
 	  task_priority = DEFAULT_TASK_PRIORITY;
      }
+
+     if (stats_interval_arg != NULL) {
+	  stats_interval = atoi(stats_interval_arg);
+	  if (stats_interval == 0) {
+	       fprintf(stderr, "Statistics interval must be at least 1 s\n");
+	       die(-1);
+	  }
+     }
+     if (stats_file_arg != NULL) {
+	  stats_file = fopen(stats_file_arg, "w");
+	  if (stats_file == NULL) {
+	       perror("Could not open statistics file");
+	       die(-1);
+	  }
+     }
      
-     /* Setup SPI */
-
-     /* with WiringPi */
-#ifdef WIRINGPI
-     int ret;
-     ret = wiringPiSPISetup(spi_channel, spi_frequency);
-     if (ret < 0) {
-	  perror("Could not setup SPI");
+     /* Setup ADC */
+
+     if (adc_open(&the_adc, backend_arg, scan_list, scan_spi_channels,
+		  scan_length, spi_frequency) == -1) {
+	  perror("Could not open ADC");
 	  die(-1);
      }
-#endif
+     adc = &the_adc;
      
-#ifdef BCM2835LIB
-     /* with BCM2835 library */
-     bcm2835_init();
-     bcm2835_spi_begin();
+     /* Open log file */
+
+     struct binlog_header header;
+     if (log_format == LOG_BINARY) {
+	  uint8_t adc_channels[MAX_SCAN_INPUTS];
+	  for (unsigned int i = 0; i < scan_length; i++) {
+	       adc_channels[i] = scan_list[i].channel;
+	       if (scan_list[i].differential)
+		    adc_channels[i] |= BINLOG_DIFFERENTIAL;
+	  }
+	  if (binlog_header_init(&header, BINLOG_DEFAULT_BLOCK_SIZE,
+				 min_interval, scan_length, adc_channels,
+				 multirate ? scan_intervals : NULL,
+				 scan_spi_channels, spi_frequency) == -1) {
+	       fprintf(stderr, "Binary logs hold up to %d channels\n",
+		       BINLOG_MAX_CHANNELS);
+	       die(-1);
+	  }
+	  if (oversampling > 1 &&
+	      binlog_header_set_oversampling(&header, oversampling,
+					     filter) == -1) {
+	       fprintf(stderr, "Oversampled scans do not fit into a block of "
+		       "the binary log\n");
+	       die(-1);
+	  }
+	  if (compressed && binlog_header_set_compressed(&header) == -1) {
+	       fprintf(stderr, "Scans do not fit into a block of the "
+		       "compressed log\n");
+	       die(-1);
+	  }
+     }
      
-     if (spi_channel == 0)
-	  bcm2835_spi_chipSelect(BCM2835_SPI_CS0);
-     else
-	  bcm2835_spi_chipSelect(BCM2835_SPI_CS1);
+     recording_config.format = log_format;
+     recording_config.channel_count = scan_length;
+     recording_config.header = header;
+     recording_config.chunk_size = chunk_size;
+     recording_config.direct = direct;
+     recording_config.flush_interval = flush_interval;
+     recording_config.calibration = (calibration_arg != NULL ? &calibration :
+				     NULL);
+     recording_config.calibrated_columns = calibrated_columns;
+     recording_config.frac_bits = (oversampling > 1 ? DECIMATOR_FRAC_BITS :
+				   0);
+     recording_config.trigger = (trigger_arg != NULL ? &the_trigger : NULL);
+     /* The history holds all scans of the pre-trigger window. */
+     recording_config.history_size = the_trigger.pre_window/min_interval + 16;
+     recording_config.summary_interval = 1000000000ull*summary_interval;
+     recording_config.rollup_spec = rollup_arg;
+
+     /* Index interval in bytes (0 for no index) */
+     unsigned long index_interval = LOGINDEX_DEFAULT_INTERVAL;
+     if (index_interval_arg != NULL)
+	  index_interval = strtoul(index_interval_arg, NULL, 10);
+     if (index_interval > UINT32_MAX) {
+	  fprintf(stderr, "Index interval must be below 4 GiB\n");
+	  die(-1);
+     }
+     recording_config.index_interval = index_interval;
 
-     // Set divider according to requested spi frequency
-     uint16_t divider = (uint16_t) ((double) 250000000/spi_frequency + 0.5);
-     bcm2835_spi_setClockDivider(divider);
+     /* Segments end at a size ("64M") or a duration ("10min"). */
+     if (segment_arg != NULL) {
+	  char *unit;
+	  uint64_t value = strtoull(segment_arg, &unit, 10);
+	  static const struct {
+	       const char *name;
+	       uint64_t size;
+	       uint64_t duration;
+	  } units[] = {
+	       {"k", 1024ull, 0}, {"M", 1024ull*1024, 0},
+	       {"G", 1024ull*1024*1024, 0}, {"s", 0, 1000000000ull},
+	       {"min", 0, 60000000000ull}, {"h", 0, 3600000000000ull}
+	  };
+	  for (unsigned int i = 0; i < sizeof(units)/sizeof(units[0]); i++) {
+	       if (strcmp(unit, units[i].name) == 0) {
+		    recording_config.segment_size = value*units[i].size;
+		    recording_config.segment_duration = value*units[i].duration;
+	       }
+	  }
+	  if (!recording_segmented(&recording_config)) {
+	       fprintf(stderr, "Segments must be a size with unit k, M, or G, "
+		       "or a duration with unit s, min, or h\n");
+	       die(-1);
+	  }
+	  sync_interval = 1000000ull*DEFAULT_SYNC_INTERVAL;
+     }
+     if (sync_interval_arg != NULL)
+	  sync_interval = 1000000ull*strtoul(sync_interval_arg, NULL, 10);
 
-     // SPI 0,0 as per MCP3208 data sheet
-     bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);
+     /* Phases are marked through the phase input or the control socket. */
+     if (phase_input_arg != NULL || control_path != NULL) {
+	  phase_init(&the_phases);
+	  phases = &the_phases;
+	  recording_config.phases = phases;
+     }
+     if (phase_input_arg != NULL) {
+	  if (strcmp(phase_input_arg, "-") == 0) {
+	       phase_fd = STDIN_FILENO;
+	  } else {
+	       /* The FIFO is also opened for writing, so it does not reach
+		  its end when a writer closes it. */
+	       if (mkfifo(phase_input_arg, 0666) == -1 && errno != EEXIST) {
+		    perror("Could not create phase marker FIFO");
+		    die(-1);
+	       }
+	       phase_fd = open(phase_input_arg, O_RDWR|O_CLOEXEC);
+	       if (phase_fd == -1) {
+		    perror("Could not open phase marker input");
+		    die(-1);
+	       }
+	  }
+     }
 
-     bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);
+     /* In daemon mode, the log file is optional. */
+     if (logfile_arg != NULL) {
+	  if (recording_open(&the_recording, &recording_config, logfile_arg,
+			     0, recording_config.segment_size) == -1) {
+	       recording_perror(&the_recording, stderr);
+	       die(-1);
+	  }
+	  struct timespec tnow;
+	  clock_gettime(CLOCK_MONOTONIC, &tnow);
+	  the_recording.tstart = to_nanosec(tnow);
+	  recording = &the_recording;
+	  control_recording = recording;
+     }
 
-     bcm2835_spi_setChipSelectPolarity(BCM2835_SPI_CS0, LOW);
-#endif
-     
-     /* Open log file */
+     if (control_path != NULL) {
+	  control_fd = control_listen(control_path);
+	  if (control_fd == -1) {
+	       perror("Could not create control socket");
+	       die(-1);
+	  }
+	  /* Clients closing their connection early must not terminate
+	     powermeter. */
+	  signal(SIGPIPE, SIG_IGN);
+     }
 
-     fout = fopen(logfile_arg, "w");
-     if (fout == NULL) {
-	  perror("Could not open log file");
-	  die(-1);
+     if (feed_arg != NULL) {
+	  if (feed_create(&the_feed, feed_arg, scan_length,
+			  FEED_DEFAULT_SIZE, min_interval,
+			  oversampling > 1 ? DECIMATOR_FRAC_BITS : 0) == -1) {
+	       perror("Could not create live feed");
+	       die(-1);
+	  }
+	  feed = &the_feed;
      }
 
      // Sampling and logging thread communicate through the ring buffer.
 
-     ring_init(&the_ring);
+     if (ring_init(&the_ring, scan_length, ring_size, ring_policy,
+		   ring_huge_pages) == -1) {
+	  perror("Could not allocate ring");
+	  die(-1);
+     }
+     if (ring_huge_pages && !the_ring.huge_pages)
+	  fprintf(stderr, "No huge pages available for ring, using normal "
+		  "pages\n");
+     if (wakeup_batch_arg != NULL)
+	  ring_set_wakeup_batch(&the_ring, atoi(wakeup_batch_arg));
 
      /* Lock memory and prefault stack */
 
@@ -456,19 +1950,63 @@ int main(int argc, char *argv[])
      }
 
      stack_prefault();
+
+     if (rt_check && !check_realtime()) {
+	  fprintf(stderr, "Real-time check failed\n");
+	  die(-1);
+     }
      
      /* Create threads */
      
-     if (pthread_create(&sampling_thread, NULL, sampling_thread_loop, NULL)) {
-	  perror("Could not create sampling thread");
+     /* The logger thread is created first since the sampling thread
+	cancels it at the end of a replayed log. */
+     
+     if (create_prefaulted_thread(&logger_thread, logger_thread_loop) == -1) {
+	  perror("Could not create logger thread");
 	  die(-1);
      }
 
-     if (pthread_create(&logger_thread, NULL, logger_thread_loop, NULL)) {
-	  perror("Could not create logger thread");
+     if (create_prefaulted_thread(&sampling_thread,
+				  sampling_thread_loop) == -1) {
+	  perror("Could not create sampling thread");
 	  die(-1);
      }
 
+     /* The statistics and control thread run at normal priority, so
+	writing the statistics file and opening and closing recordings
+	never delay sampling or logging. */
+     if (stats_file != NULL) {
+	  if (create_background_thread(&stats_thread,
+				       stats_thread_loop) == -1) {
+	       perror("Could not create statistics thread");
+	       die(-1);
+	  }
+	  stats_thread_started = true;
+     }
+     if (control_fd != -1) {
+	  if (create_background_thread(&control_thread,
+				       control_thread_loop) == -1) {
+	       perror("Could not create control thread");
+	       die(-1);
+	  }
+	  control_thread_started = true;
+     }
+     if (recording_segmented(&recording_config) || sync_interval > 0) {
+	  if (create_background_thread(&io_thread, io_thread_loop) == -1) {
+	       perror("Could not create I/O thread");
+	       die(-1);
+	  }
+	  io_thread_started = true;
+     }
+     if (phases != NULL) {
+	  if (create_background_thread(&phase_thread,
+				       phase_thread_loop) == -1) {
+	       perror("Could not create phase thread");
+	       die(-1);
+	  }
+	  phase_thread_started = true;
+     }
+
      /* Install SIGINT signal handler for graceful termination */
      
      if (signal(SIGINT, sig_int) == SIG_ERR) {
@@ -476,8 +2014,51 @@ int main(int argc, char *argv[])
 	  die(-1);
      }
      
-     pthread_join(logger_thread, NULL);
+     /* The logger thread is canceled once sampling ended, so it drains
+	the ring before it terminates. */
      pthread_join(sampling_thread, NULL);
+     pthread_cancel(logger_thread);
+     pthread_join(logger_thread, NULL);
+     /* A switch the logger thread did not get to is carried out here; no
+	scans were sampled after its time. */
+     struct control_request *request = control_close(&control_pending);
+     if (request != NULL) {
+	  struct recording *previous = recording;
+	  recording = request->next;
+	  control_done(request, previous);
+     }
+     if (control_thread_started) {
+	  pthread_cancel(control_thread);
+	  pthread_join(control_thread, NULL);
+     }
+     if (io_thread_started) {
+	  pthread_cancel(io_thread);
+	  pthread_join(io_thread, NULL);
+     }
+     if (stats_thread_started) {
+	  pthread_cancel(stats_thread);
+	  pthread_join(stats_thread, NULL);
+     }
+     if (phase_thread_started) {
+	  pthread_cancel(phase_thread);
+	  pthread_join(phase_thread, NULL);
+     }
+     /* The current phase ends with the last scan. */
+     if (phases != NULL) {
+	  if (recording != NULL)
+	       logger_end_phase(&recording->logger);
+	  else
+	       phase_end(phases);
+	  print_phases(stdout);
+	  if (phases->results_lost > 0)
+	       fprintf(stderr, "%llu finished phases not printed (queue "
+		       "full)\n", (unsigned long long) phases->results_lost);
+     }
 
+     if (sampling_faulted) {
+	  fprintf(stderr, "Real-time check failed: the sampling thread took "
+		  "page faults\n");
+	  die(-1);
+     }
      die(0);
 }
@@ -0,0 +1,449 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Range query tool: prints the scans of a time range of a log (CSV or
+   binary) as CSV.
+
+   Usage: powermeter-query [-s START] [-e END | -d DURATION] [-c COLUMNS]
+                           LOGFILE [CSVFILE]
+
+   The start of the range is found by binary search over the index of the
+   log (LOGFILE.idx), so only the scans of the range and at most one index
+   interval before it are read. Binary logs without an index are searched
+   by the timestamps of their fixed-size blocks; CSV logs without an index
+   are read from the beginning.
+
+   START and END are timestamps of the log in ns, +SECONDS relative to the
+   first scan of the log, or a wall-clock time HH:MM[:SS] (the first time
+   of day after the start of the log; requires an index). Without START,
+   the range starts with the first scan. DURATION is in seconds. COLUMNS
+   selects value columns (counting from 0, in the order of the log). */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include "binlog.h"
+#include "logindex.h"
+
+/* Maximum number of selected columns */
+#define MAX_COLUMNS 64
+
+/**
+ * Get the timestamp of the first scan of a log.
+ *
+ * @param f the log
+ * @param binary true if the log is binary
+ * @param timestamp set to the timestamp
+ * @return 0 on success; -1 if the log has no scans
+ */
+static int first_timestamp(FILE *f, bool binary, uint64_t *timestamp)
+{
+     if (binary) {
+	  struct binlog_header h;
+	  struct binlog_block_header bh;
+	  if (fseeko(f, 0, SEEK_SET) == -1 ||
+	      fread(&h, sizeof(h), 1, f) != 1 ||
+	      fseeko(f, h.block_size, SEEK_SET) == -1 ||
+	      fread(&bh, sizeof(bh), 1, f) != 1)
+	       return -1;
+	  *timestamp = bh.t0;
+	  return 0;
+     }
+
+     char line[1024];
+     fseeko(f, 0, SEEK_SET);
+     while (fgets(line, sizeof(line), f) != NULL) {
+	  if (line[0] == '#')
+	       continue;
+	  char *end;
+	  *timestamp = strtoull(line, &end, 10);
+	  if (end != line)
+	       return 0;
+     }
+
+     return -1;
+}
+
+/**
+ * Parse a time of the range.
+ *
+ * @param arg the time
+ * @param first timestamp of the first scan of the log
+ * @param index index of the log (NULL if none)
+ * @param timestamp set to the timestamp
+ * @return 0 on success; -1 if the time is invalid
+ */
+static int parse_time(const char *arg, uint64_t first,
+		      const struct logindex_reader *index, uint64_t *timestamp)
+{
+     char *end;
+     if (arg[0] == '+') {
+	  double seconds = strtod(arg+1, &end);
+	  if (end == arg+1 || *end != '\0' || seconds < 0)
+	       return -1;
+	  *timestamp = first + (uint64_t) (seconds*1000000000.0);
+	  return 0;
+     }
+
+     if (strchr(arg, ':') != NULL) {
+	  unsigned int hour, minute, second = 0;
+	  if (index == NULL ||
+	      sscanf(arg, "%u:%u:%u", &hour, &minute, &second) < 2 ||
+	      hour > 23 || minute > 59 || second > 59)
+	       return -1;
+	  /* Wall-clock time of the first scan */
+	  int64_t offset = index->header.realtime_offset;
+	  time_t tfirst = ((int64_t) first+offset)/1000000000ll;
+	  struct tm tm;
+	  localtime_r(&tfirst, &tm);
+	  tm.tm_hour = hour;
+	  tm.tm_min = minute;
+	  tm.tm_sec = second;
+	  tm.tm_isdst = -1;
+	  time_t t = mktime(&tm);
+	  if (t < tfirst)
+	       t += 24*3600;
+	  *timestamp = (int64_t) t*1000000000ll - offset;
+	  return 0;
+     }
+
+     *timestamp = strtoull(arg, &end, 10);
+     if (end == arg || *end != '\0')
+	  return -1;
+     return 0;
+}
+
+/**
+ * Print the selected columns of a scan.
+ *
+ * @param fout the output
+ * @param timestamp timestamp of the scan
+ * @param fields the values of the scan as strings
+ * @param field_count number of values
+ * @param columns selected columns (NULL for all)
+ * @param column_count number of selected columns
+ */
+static void print_scan(FILE *fout, uint64_t timestamp, char **fields,
+		       unsigned int field_count, const unsigned int *columns,
+		       unsigned int column_count)
+{
+     fprintf(fout, "%llu", (unsigned long long) timestamp);
+     if (columns == NULL) {
+	  for (unsigned int i = 0; i < field_count; i++)
+	       fprintf(fout, ",%s", fields[i]);
+     } else {
+	  for (unsigned int i = 0; i < column_count; i++)
+	       fprintf(fout, ",%s", columns[i] < field_count ?
+		       fields[columns[i]] : "");
+     }
+     fputc('\n', fout);
+}
+
+/**
+ * Print the scans of a range of a CSV log. Comment lines (e.g., gaps) are
+ * printed if they precede a scan of the range.
+ *
+ * @param f the log
+ * @param offset where to start reading
+ * @param start start of the range
+ * @param end end of the range
+ * @param columns selected columns (NULL for all)
+ * @param column_count number of selected columns
+ * @param fout the output
+ */
+static void query_csv(FILE *f, uint64_t offset, uint64_t start, uint64_t end,
+		      const unsigned int *columns, unsigned int column_count,
+		      FILE *fout)
+{
+     char *line = NULL;
+     size_t line_size = 0;
+     /* Comment lines since the last scan */
+     char *comments = NULL;
+     size_t comments_length = 0;
+     size_t comments_size = 0;
+
+     fseeko(f, offset, SEEK_SET);
+     while (getline(&line, &line_size, f) != -1) {
+	  if (line[0] == '#') {
+	       size_t length = strlen(line);
+	       if (comments_length+length > comments_size) {
+		    comments_size = 2*(comments_length+length);
+		    comments = realloc(comments, comments_size);
+		    if (comments == NULL) {
+			 perror("Could not allocate memory");
+			 exit(-1);
+		    }
+	       }
+	       memcpy(comments+comments_length, line, length);
+	       comments_length += length;
+	       continue;
+	  }
+	  
+	  char *p;
+	  uint64_t t = strtoull(line, &p, 10);
+	  if (p == line)
+	       continue;
+	  if (t > end)
+	       break;
+	  if (t >= start)
+	       fwrite(comments, 1, comments_length, fout);
+	  comments_length = 0;
+	  if (t < start)
+	       continue;
+
+	  char *fields[MAX_COLUMNS];
+	  unsigned int field_count = 0;
+	  p[strcspn(p, "\r\n")] = '\0';
+	  while (*p == ',' && field_count < MAX_COLUMNS) {
+	       *p++ = '\0';
+	       fields[field_count++] = p;
+	       p += strcspn(p, ",");
+	  }
+	  print_scan(fout, t, fields, field_count, columns, column_count);
+     }
+
+     free(comments);
+     free(line);
+}
+
+/**
+ * Print the scans of a range of a binary log.
+ *
+ * @param r the log
+ * @param offset offset of the block where to start reading (0 to search
+ * the blocks)
+ * @param start start of the range
+ * @param end end of the range
+ * @param columns selected columns (NULL for all)
+ * @param column_count number of selected columns
+ * @param fout the output
+ * @return 0 on success; -1 if a block is corrupt
+ */
+static int query_binary(const struct binlog_reader *r, uint64_t offset,
+			uint64_t start, uint64_t end,
+			const unsigned int *columns, unsigned int column_count,
+			FILE *fout)
+{
+     /* Block 0 is the first block after the file header. */
+     uint64_t first;
+     if (offset >= r->header.block_size) {
+	  first = offset/r->header.block_size - 1;
+     } else {
+	  /* Last block starting before or at start */
+	  uint64_t low = 0;
+	  uint64_t high = r->block_count;
+	  while (low < high) {
+	       uint64_t middle = low+(high-low)/2;
+	       if (binlog_block(r, middle)->t0 <= start)
+		    low = middle+1;
+	       else
+		    high = middle;
+	  }
+	  first = (low > 0 ? low-1 : 0);
+     }
+
+     unsigned int channel_count = r->header.channel_count;
+     uint32_t max_records = r->header.records_per_block;
+     uint64_t *timestamps = malloc(max_records*sizeof(uint64_t));
+     uint16_t *values = malloc(max_records*channel_count*sizeof(uint16_t));
+     if (timestamps == NULL || values == NULL) {
+	  perror("Could not allocate memory");
+	  exit(-1);
+     }
+
+     int status = 0;
+     for (uint64_t b = first; b < r->block_count; b++) {
+	  const struct binlog_block_header *bh = binlog_block(r, b);
+	  if (bh->t0 > end)
+	       break;
+	  /* Summary blocks hold no records. */
+	  uint32_t n = binlog_read_block(r, b, timestamps, values);
+	  if (n == 0 && bh->record_count > 0) {
+	       fprintf(stderr, "Block %llu is corrupt\n",
+		       (unsigned long long) b);
+	       status = -1;
+	  }
+	  if (bh->lost > 0 && n > 0 && timestamps[0] >= start)
+	       fprintf(fout, "# gap %u\n", bh->lost);
+	  for (uint32_t i = 0; i < n && timestamps[i] <= end; i++) {
+	       if (timestamps[i] < start)
+		    continue;
+	       char strings[BINLOG_MAX_CHANNELS][8];
+	       char *fields[BINLOG_MAX_CHANNELS];
+	       for (unsigned int c = 0; c < channel_count; c++) {
+		    uint16_t v = values[i*channel_count+c];
+		    fields[c] = strings[c];
+		    if (v == BINLOG_NO_VALUE)
+			 strings[c][0] = '\0';
+		    else
+			 snprintf(strings[c], sizeof(strings[c]), "%u", v);
+	       }
+	       print_scan(fout, timestamps[i], fields, channel_count, columns,
+			  column_count);
+	  }
+     }
+
+     free(timestamps);
+     free(values);
+     return status;
+}
+
+void usage(const char *appl)
+{
+     fprintf(stderr, "%s [-s START] [-e END | -d DURATION] [-c COLUMNS] "
+	     "LOGFILE [CSVFILE]\n", appl);
+}
+
+int main(int argc, char *argv[])
+{
+     char *start_arg = NULL;
+     char *end_arg = NULL;
+     char *duration_arg = NULL;
+     char *columns_arg = NULL;
+     int c;
+     while ((c = getopt(argc, argv, "s:e:d:c:")) != -1) {
+	  switch (c) {
+	  case 's' :
+	       start_arg = optarg;
+	       break;
+	  case 'e' :
+	       end_arg = optarg;
+	       break;
+	  case 'd' :
+	       duration_arg = optarg;
+	       break;
+	  case 'c' :
+	       columns_arg = optarg;
+	       break;
+	  default:
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (optind != argc-1 && optind != argc-2) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+     const char *path = argv[optind];
+
+     unsigned int columns[MAX_COLUMNS];
+     unsigned int column_count = 0;
+     if (columns_arg != NULL) {
+	  const char *p = columns_arg;
+	  while (true) {
+	       char *e;
+	       unsigned long column = strtoul(p, &e, 10);
+	       if (e == p || column_count == MAX_COLUMNS ||
+		   (*e != ',' && *e != '\0')) {
+		    fprintf(stderr, "Invalid columns\n");
+		    exit(-1);
+	       }
+	       columns[column_count++] = column;
+	       if (*e == '\0')
+		    break;
+	       p = e+1;
+	  }
+     }
+
+     FILE *f = fopen(path, "r");
+     if (f == NULL) {
+	  perror("Could not open log");
+	  exit(-1);
+     }
+     char magic[8];
+     bool binary = (fread(magic, sizeof(magic), 1, f) == 1 &&
+		    memcmp(magic, BINLOG_MAGIC, sizeof(magic)) == 0);
+
+     char *index_path = malloc(strlen(path)+strlen(".idx")+1);
+     strcpy(index_path, path);
+     strcat(index_path, ".idx");
+     struct logindex_reader the_index;
+     struct logindex_reader *index = NULL;
+     if (logindex_open(&the_index, index_path) == 0)
+	  index = &the_index;
+     else if (errno != ENOENT)
+	  fprintf(stderr, "Ignoring invalid index %s\n", index_path);
+     free(index_path);
+
+     uint64_t first;
+     if (first_timestamp(f, binary, &first) == -1) {
+	  fprintf(stderr, "Log has no scans\n");
+	  exit(-1);
+     }
+     /* Without START, the range starts with the first scan. */
+     uint64_t start = first;
+     uint64_t end = UINT64_MAX;
+     if ((start_arg != NULL &&
+	  parse_time(start_arg, first, index, &start) == -1) ||
+	 (end_arg != NULL && parse_time(end_arg, first, index, &end) == -1)) {
+	  fprintf(stderr, "Times must be timestamps, +SECONDS, or HH:MM[:SS] "
+		  "(with an index)\n");
+	  exit(-1);
+     }
+     if (duration_arg != NULL) {
+	  char *tail;
+	  double duration = strtod(duration_arg, &tail);
+	  if (tail == duration_arg || *tail != '\0' || duration < 0) {
+	       fprintf(stderr, "Duration must be a number of seconds\n");
+	       exit(-1);
+	  }
+	  end = start + (uint64_t) (duration*1000000000.0);
+     }
+
+     FILE *fout = stdout;
+     if (optind == argc-2) {
+	  fout = fopen(argv[optind+1], "w");
+	  if (fout == NULL) {
+	       perror("Could not open output file");
+	       exit(-1);
+	  }
+     }
+
+     uint64_t offset = (index != NULL ? logindex_find(index, start) : 0);
+     int status = 0;
+     if (binary) {
+	  fclose(f);
+	  struct binlog_reader reader;
+	  if (binlog_open(&reader, path) == -1) {
+	       perror("Could not open binary log");
+	       exit(-1);
+	  }
+	  status = query_binary(&reader, offset, start, end,
+				columns_arg != NULL ? columns : NULL,
+				column_count, fout);
+	  binlog_close(&reader);
+     } else {
+	  if (index == NULL)
+	       fprintf(stderr, "No index, reading the whole log\n");
+	  query_csv(f, offset, start, end,
+		    columns_arg != NULL ? columns : NULL, column_count, fout);
+	  fclose(f);
+     }
+
+     if (index != NULL)
+	  logindex_reader_close(index);
+     if (fout != stdout)
+	  fclose(fout);
+
+     return status;
+}
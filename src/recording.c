@@ -0,0 +1,194 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "recording.h"
+
+int recording_open(struct recording *r, const struct recording_config *config,
+		   const char *path, unsigned int segment,
+		   uint64_t preallocate)
+{
+     r->error = NULL;
+     r->segment = segment;
+     r->tstart = 0;
+     r->path = malloc(strlen(path)+1);
+     if (r->path == NULL) {
+	  r->error = "Could not allocate recording";
+	  return -1;
+     }
+     strcpy(r->path, path);
+
+     /* Path of the log file, and path of the log file while it is
+	written */
+     char log_path[strlen(path)+32];
+     char part_path[strlen(path)+32];
+     if (recording_segmented(config)) {
+	  snprintf(log_path, sizeof(log_path), RECORDING_SEGMENT_FORMAT, path,
+		   segment);
+	  snprintf(part_path, sizeof(part_path),
+		   RECORDING_SEGMENT_FORMAT RECORDING_PART_SUFFIX, path,
+		   segment);
+     } else {
+	  strcpy(log_path, path);
+	  strcpy(part_path, path);
+     }
+     path = log_path;
+
+     struct logger *l = &r->logger;
+     if (logger_open(l, part_path, config->format, config->channel_count,
+		     &config->header, config->chunk_size, config->direct,
+		     config->flush_interval) == -1) {
+	  r->error = "Could not open log file";
+	  free(r->path);
+	  return -1;
+     }
+     if (recording_segmented(config))
+	  logger_set_segment(l, preallocate);
+     if (config->calibration != NULL)
+	  logger_set_calibration(l, config->calibration,
+				 config->calibrated_columns);
+     if (config->frac_bits > 0)
+	  logger_set_frac_bits(l, config->frac_bits);
+     if (config->phases != NULL)
+	  logger_set_phases(l, config->phases);
+     if (config->trigger != NULL) {
+	  r->trigger = *config->trigger;
+	  if (logger_set_trigger(l, &r->trigger, config->history_size,
+				 config->summary_interval) == -1) {
+	       r->error = "Could not allocate trigger history";
+	       goto error;
+	  }
+     }
+
+     if (config->rollup_spec != NULL) {
+	  if (rollup_open(&r->rollup, path, config->rollup_spec,
+			  config->channel_count, config->calibration != NULL,
+			  config->frac_bits) == -1) {
+	       r->error = "Could not create rollups";
+	       goto error;
+	  }
+	  logger_set_rollup(l, &r->rollup);
+     }
+
+     if (config->index_interval > 0) {
+	  char *index_path = malloc(strlen(path)+strlen(".idx")+1);
+	  if (index_path == NULL) {
+	       r->error = "Could not create index";
+	       goto error;
+	  }
+	  strcpy(index_path, path);
+	  strcat(index_path, ".idx");
+	  int ret = logindex_create(&r->index, index_path,
+				    config->index_interval);
+	  free(index_path);
+	  if (ret == -1) {
+	       r->error = "Could not create index";
+	       goto error;
+	  }
+	  logger_set_index(l, &r->index);
+     }
+
+     return 0;
+
+error:
+     {
+	  int error = errno;
+	  if (l->rollup != NULL)
+	       rollup_close(l->rollup);
+	  logger_close(l);
+	  free(r->path);
+	  errno = error;
+     }
+     return -1;
+}
+
+bool recording_segment_full(const struct recording *r,
+			    const struct recording_config *config,
+			    uint64_t tnow)
+{
+     uint64_t size = __atomic_load_n(&r->logger.bytes_written,
+				     __ATOMIC_RELAXED);
+     return ((config->segment_size > 0 && size >= config->segment_size) ||
+	     (config->segment_duration > 0 &&
+	      tnow-r->tstart >= config->segment_duration));
+}
+
+void recording_perror(const struct recording *r, FILE *f)
+{
+     if (errno == EINVAL && r->error != NULL &&
+	 strcmp(r->error, "Could not create rollups") == 0)
+	  fprintf(f, "Rollup tiers must be intervals with unit ms, s, min, "
+		  "or h, each a multiple of the previous one\n");
+     else
+	  fprintf(f, "%s: %s\n", r->error, strerror(errno));
+}
+
+void recording_close(struct recording *r)
+{
+     struct logger *l = &r->logger;
+     logger_close(l);
+     if (l->index != NULL)
+	  logindex_close(l->index);
+     if (l->rollup != NULL)
+	  rollup_close(l->rollup);
+
+     if (l->segment) {
+	  char log_path[strlen(r->path)+32];
+	  char part_path[strlen(r->path)+32];
+	  snprintf(log_path, sizeof(log_path), RECORDING_SEGMENT_FORMAT,
+		   r->path, r->segment);
+	  snprintf(part_path, sizeof(part_path),
+		   RECORDING_SEGMENT_FORMAT RECORDING_PART_SUFFIX, r->path,
+		   r->segment);
+	  rename(part_path, log_path);
+     }
+     free(r->path);
+     r->path = NULL;
+}
+
+void recording_report(const struct recording *r, FILE *out, FILE *err)
+{
+     const struct logger *l = &r->logger;
+     if (l->write_errors > 0)
+	  fprintf(err, "%llu errors while writing log file\n",
+		  (unsigned long long) l->write_errors);
+     if (l->index != NULL && l->index->write_errors > 0)
+	  fprintf(err, "%llu errors while writing index\n",
+		  (unsigned long long) l->index->write_errors);
+     if (l->rollup != NULL && l->rollup->write_errors > 0)
+	  fprintf(err, "%llu errors while writing rollups\n",
+		  (unsigned long long) l->rollup->write_errors);
+
+     if (l->gaps > 0)
+	  fprintf(out, "%llu gaps with %llu lost scans in log file\n",
+		  (unsigned long long) l->gaps,
+		  (unsigned long long) l->lost_scans);
+     if (l->trigger != NULL)
+	  fprintf(out, "%llu trigger events with %llu captured scans\n",
+		  (unsigned long long) l->trigger->events,
+		  (unsigned long long) l->captured_scans);
+     if (l->calibration != NULL && l->energy.samples > 1) {
+	  const struct energy_meter *em = &l->energy;
+	  double duration = (em->tlast-em->tfirst)/1000000000.0;
+	  double energy = em->energy/1000000000.0;
+	  fprintf(out, "Energy was %.3f mJ in %.3f s, average power %.3f "
+		  "mW\n", energy, duration, energy/duration);
+     }
+}
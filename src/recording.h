@@ -0,0 +1,157 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "logger.h"
+
+/* A recording is everything written for one log file: the log, its index,
+   its rollups, and the trigger deciding what is captured. Recordings are
+   opened and closed outside of the logger thread, which only logs into
+   the current one.
+
+   A long recording may be split into segments of a maximum size or
+   duration. Each segment is a recording of its own, whose files are named
+   PATH.NNNNN (e.g., log.csv.00042, log.csv.00042.idx). The log file of a
+   segment is named PATH.NNNNN.part until the segment is closed, synced to
+   disk, and renamed, so a log file without .part is complete. */
+
+/* Format of the number of a segment in its path */
+#define RECORDING_SEGMENT_FORMAT "%s.%05u"
+#define RECORDING_PART_SUFFIX ".part"
+
+/**
+ * Settings shared by all recordings of a process.
+ */
+struct recording_config {
+     enum log_format format;
+     unsigned int channel_count;
+     struct binlog_header header;
+     size_t chunk_size;
+     bool direct;
+     uint64_t flush_interval;
+     /* Calibration (NULL if none) */
+     const struct calibration *calibration;
+     bool calibrated_columns;
+     unsigned int frac_bits;
+     /* Trigger copied into each recording before its first scan (NULL if
+	all scans are logged), the size of its history, and the summary
+	interval in ns */
+     const struct trigger *trigger;
+     unsigned int history_size;
+     uint64_t summary_interval;
+     /* Tiers of the rollups (NULL if none) */
+     const char *rollup_spec;
+     /* Index interval in bytes (0 for no index) */
+     uint32_t index_interval;
+     /* Maximum size in bytes and duration in ns of a segment (0 for no
+	limit; both 0 for no segments) */
+     uint64_t segment_size;
+     uint64_t segment_duration;
+     /* Phase accounting shared by all recordings (NULL if none) */
+     struct phase_meter *phases;
+};
+
+/**
+ * A recording.
+ */
+struct recording {
+     /* Path given for the recording (without segment number) */
+     char *path;
+     /* Number of the segment */
+     unsigned int segment;
+     /* Time of the first scan of the recording */
+     uint64_t tstart;
+     struct logger logger;
+     struct trigger trigger;
+     struct rollup rollup;
+     struct logindex_writer index;
+     /* Step that failed if recording_open() failed */
+     const char *error;
+};
+
+/**
+ * Open a recording: create the log file, its index (PATH.idx), and its
+ * rollups.
+ *
+ * @param r the recording
+ * @param config settings of the recording
+ * @param path path of the log file
+ * @param segment number of the segment (ignored without segments)
+ * @param preallocate bytes to preallocate for a segment
+ * @return 0 on success; -1 on error (errno and error are set)
+ */
+int recording_open(struct recording *r, const struct recording_config *config,
+		   const char *path, unsigned int segment,
+		   uint64_t preallocate);
+
+/**
+ * Check whether a recording is segmented.
+ *
+ * @param config settings of the recording
+ * @return true if recordings are split into segments
+ */
+static inline bool recording_segmented(const struct recording_config *config)
+{
+     return (config->segment_size > 0 || config->segment_duration > 0);
+}
+
+/**
+ * Check whether a segment is full. May be called while the logger thread
+ * logs into the segment.
+ *
+ * @param r the segment
+ * @param config settings of the recording
+ * @param tnow current time in ns
+ * @return true if the segment reached its maximum size or duration
+ */
+bool recording_segment_full(const struct recording *r,
+			    const struct recording_config *config,
+			    uint64_t tnow);
+
+/**
+ * Print why recording_open() failed.
+ *
+ * @param r the recording
+ * @param f the stream
+ */
+void recording_perror(const struct recording *r, FILE *f);
+
+/**
+ * Flush and close all files of a recording, and rename the log file of a
+ * segment to its final name. Its counters stay valid.
+ *
+ * @param r the recording
+ */
+void recording_close(struct recording *r);
+
+/**
+ * Print the counters of a closed recording: write errors, gaps, trigger
+ * events, and energy.
+ *
+ * @param r the recording
+ * @param out stream for the counters
+ * @param err stream for errors
+ */
+void recording_report(const struct recording *r, FILE *out, FILE *err);
+
+#endif
@@ -16,57 +16,301 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include "ring.h"
 
-void ring_init(struct ring *r)
+/**
+ * Sleep on a futex word as long as it has the given value, or until the
+ * timeout expires.
+ *
+ * @param addr futex word
+ * @param val expected value of the futex word
+ * @param timeout_ms relative timeout in milliseconds
+ */
+static void futex_wait(int *addr, int val, unsigned int timeout_ms)
 {
-     r->entrycnt = 0;
+     struct timespec timeout;
+     timeout.tv_sec = timeout_ms/1000;
+     timeout.tv_nsec = (timeout_ms%1000)*1000000l;
      
-     pthread_mutex_init(&r->mutex, NULL);
+     syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &timeout, NULL, 0);
+}
+
+/**
+ * Wake up one thread sleeping on a futex word.
+ *
+ * @param addr futex word
+ */
+static void futex_wake(int *addr)
+{
+     syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+int ring_init(struct ring *r, unsigned int channel_count, unsigned int size,
+	      enum ring_policy policy, bool huge_pages)
+{
+     if (channel_count == 0 || channel_count > RING_MAX_CHANNELS ||
+	 size == 0 || size > RING_MAX_SIZE)
+	  return -1;
+
+     /* Round up to a power of two, so slots can be found by masking. */
+     unsigned int n = 1;
+     while (n < size)
+	  n <<= 1;
+     r->size = n;
+     r->mask = n-1;
+     r->policy = policy;
+     r->channel_count = channel_count;
+
+     /* All arrays share one mapping. Each array starts at a cache line. */
+     size_t timestamps_size = n*sizeof(uint64_t);
+     size_t values_size = ((size_t) n*channel_count*sizeof(uint16_t) +
+			   RING_CACHELINE-1) & ~((size_t) RING_CACHELINE-1);
+     size_t gaps_size = n*sizeof(uint32_t);
+     r->map_size = timestamps_size + values_size + gaps_size;
+
+     r->map = MAP_FAILED;
+     r->huge_pages = false;
+     if (huge_pages) {
+	  /* Huge pages save TLB entries; the mapping must be a multiple of
+	     the huge page size. Fall back to normal pages if none are
+	     available. */
+	  size_t huge_size = 2*1024*1024;
+	  size_t map_size = (r->map_size+huge_size-1) & ~(huge_size-1);
+	  r->map = mmap(NULL, map_size, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+	  if (r->map != MAP_FAILED) {
+	       r->map_size = map_size;
+	       r->huge_pages = true;
+	  }
+     }
+     if (r->map == MAP_FAILED)
+	  r->map = mmap(NULL, r->map_size, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+     if (r->map == MAP_FAILED)
+	  return -1;
+
+     /* Lock and touch all pages now rather than in the sampling thread. */
+     if (mlock(r->map, r->map_size) == -1) {
+	  munmap(r->map, r->map_size);
+	  return -1;
+     }
+     memset(r->map, 0, r->map_size);
+     r->timestamps = (uint64_t *) r->map;
+     r->values = (uint16_t *) ((uint8_t *) r->map + timestamps_size);
+     r->gaps = (uint32_t *) ((uint8_t *) r->map + timestamps_size +
+			     values_size);
      
-     pthread_cond_init(&r->notempty, NULL);
-     pthread_cond_init(&r->notfull, NULL);
+     r->head = 0;
+     r->tail_cached = 0;
+     r->pending_gap = 0;
+     r->tail = 0;
+     r->tail_expected = 0;
+     r->sleeping = 0;
+     r->wakeup_head = 0;
+     r->wakeup_batch = RING_DEFAULT_WAKEUP_BATCH;
+
+     return 0;
 }
 
 void ring_destroy(struct ring* r)
 {
-     pthread_cond_destroy(&r->notempty);
-     pthread_cond_destroy(&r->notfull);
+     munmap(r->map, r->map_size);
+}
+
+void ring_set_wakeup_batch(struct ring *r, unsigned int batch)
+{
+     if (batch == 0)
+	  batch = 1;
+     else if (batch > r->size)
+	  batch = r->size;
 
-     pthread_mutex_destroy(&r->mutex);
+     r->wakeup_batch = batch;
+}
+
+bool ring_full(struct ring *r)
+{
+     if (r->head - r->tail_cached < r->size)
+	  return false;
+
+     r->tail_cached = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+     return (r->head - r->tail_cached == r->size);
+}
+
+unsigned int ring_count(const struct ring *r)
+{
+     return r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
 }
 
-void ring_put(struct ring *r, const struct ring_entry *e)
+int ring_put(struct ring *r, uint64_t timestamp, const uint16_t *values)
 {
-     pthread_mutex_lock(&r->mutex);
+     unsigned int head = r->head;
+     int ret = 0;
      
-     while (r->entrycnt == RING_SIZE) {
-	  pthread_cond_wait(&r->notfull, &r->mutex);
+     if (head - r->tail_cached == r->size) {
+	  /* Ring seems to be full. Check whether the consumer has made
+	     progress in the meantime. */
+	  r->tail_cached = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
      }
+     if (head - r->tail_cached == r->size) {
+	  if (r->policy == RING_DROP_NEWEST) {
+	       r->pending_gap++;
+	       return -1;
+	  }
 
-     r->entries[r->head] = *e;
-     r->entrycnt++;
-     r->head = (r->head+1) & RING_SIZE_MODMASK;
+	  /* Drop the oldest entry, unless the consumer has just taken it.
+	     The consumer notices the dropped entry when it tries to advance
+	     tail itself. The CAS also keeps the writes to the slot below from
+	     being reordered before tail has been advanced. */
+	  unsigned int tail = r->tail_cached;
+	  if (__atomic_compare_exchange_n(&r->tail, &tail, tail+1, false,
+					  __ATOMIC_SEQ_CST,
+					  __ATOMIC_ACQUIRE)) {
+	       r->tail_cached = tail+1;
+	       ret = 1;
+	  } else {
+	       r->tail_cached = tail;
+	  }
+     }
+
+     unsigned int slot = head & r->mask;
+     r->gaps[slot] = r->pending_gap;
+     r->pending_gap = 0;
+     r->timestamps[slot] = timestamp;
+     uint16_t *v = &r->values[slot*r->channel_count];
+     for (unsigned int c = 0; c < r->channel_count; c++)
+	  v[c] = values[c];
+     __atomic_store_n(&r->head, head+1, __ATOMIC_RELEASE);
 
-     pthread_cond_signal(&r->notempty);
+     /* Publishing head and checking for a sleeping consumer must not be
+	reordered, otherwise we could miss a consumer that is just about to
+	go to sleep. */
+     __atomic_thread_fence(__ATOMIC_SEQ_CST);
      
-     pthread_mutex_unlock(&r->mutex);
+     if (__atomic_load_n(&r->sleeping, __ATOMIC_RELAXED)) {
+	  unsigned int wakeup_head = __atomic_load_n(&r->wakeup_head,
+						     __ATOMIC_ACQUIRE);
+	  if ((int) (head+1-wakeup_head) >= 0) {
+	       __atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
+	       futex_wake(&r->sleeping);
+	  }
+     }
+
+     return ret;
 }
 
-void ring_get(struct ring *r, struct ring_entry *e)
+/**
+ * Wait until the ring contains at least one entry.
+ *
+ * @param r the ring
+ * @param tail current tail of the ring
+ * @return number of available entries
+ */
+static unsigned int wait_for_entries(struct ring *r, unsigned int tail)
 {
-     pthread_mutex_lock(&r->mutex);
+     unsigned int head;
+     
+     while ((head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) == tail) {
+	  __atomic_store_n(&r->wakeup_head, tail+r->wakeup_batch,
+			   __ATOMIC_RELAXED);
+	  __atomic_store_n(&r->sleeping, 1, __ATOMIC_RELEASE);
+	  /* Pairs with the fence in ring_put() */
+	  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+	  
+	  if (__atomic_load_n(&r->head, __ATOMIC_RELAXED) == tail)
+	       futex_wait(&r->sleeping, 1, RING_WAKEUP_TIMEOUT_MS);
+	  
+	  __atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
 
-     while (r->entrycnt == 0) {
-	  pthread_cond_wait(&r->notempty, &r->mutex);
+	  /* The futex system call is no cancellation point (unlike
+	     pthread_cond_wait). Only honor a cancellation request if the
+	     ring is still empty, so no entries put before it are lost. */
+	  if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+	       pthread_testcancel();
      }
 
-     *e = r->entries[r->tail];
-     r->entrycnt--;
-     r->tail = (r->tail+1) & RING_SIZE_MODMASK;
-     
-     pthread_cond_signal(&r->notfull);
-	  
-     pthread_mutex_unlock(&r->mutex);
+     return head-tail;
 }
 
+unsigned int ring_get_many(struct ring *r, uint64_t *timestamps,
+			   uint16_t *values, uint32_t *gaps,
+			   unsigned int max)
+{
+     unsigned int cc = r->channel_count;
+
+     while (true) {
+	  unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	  unsigned int avail = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)-
+	       tail;
+
+	  if (avail == 0) {
+	       avail = wait_for_entries(r, tail);
+	  }
+
+	  if (avail > max)
+	       avail = max;
+
+	  /* Copy in at most two contiguous parts (before and after the
+	     wrap-around). */
+	  unsigned int slot = tail & r->mask;
+	  unsigned int first = r->size-slot;
+	  if (first > avail)
+	       first = avail;
+
+	  memcpy(timestamps, &r->timestamps[slot], first*sizeof(uint64_t));
+	  memcpy(values, &r->values[slot*cc], first*cc*sizeof(uint16_t));
+	  if (gaps != NULL)
+	       memcpy(gaps, &r->gaps[slot], first*sizeof(uint32_t));
+	  if (avail > first) {
+	       memcpy(&timestamps[first], r->timestamps,
+		      (avail-first)*sizeof(uint64_t));
+	       memcpy(&values[first*cc], r->values,
+		      (avail-first)*cc*sizeof(uint16_t));
+	       if (gaps != NULL)
+		    memcpy(&gaps[first], r->gaps,
+			   (avail-first)*sizeof(uint32_t));
+	  }
+
+	  /* Entries dropped by the producer since our last call */
+	  if (gaps != NULL)
+	       gaps[0] += tail-r->tail_expected;
+
+	  if (r->policy == RING_DROP_NEWEST) {
+	       /* Only we advance tail. */
+	       __atomic_store_n(&r->tail, tail+avail, __ATOMIC_RELEASE);
+	       r->tail_expected = tail+avail;
+	       return avail;
+	  }
+
+	  /* The copies must be complete before we check that the producer
+	     has not dropped (and possibly overwritten) the copied entries by
+	     advancing tail in the meantime. */
+	  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+	  if (__atomic_compare_exchange_n(&r->tail, &tail, tail+avail, false,
+					  __ATOMIC_SEQ_CST,
+					  __ATOMIC_RELAXED)) {
+	       r->tail_expected = tail+avail;
+	       return avail;
+	  }
+	  /* Entries have been dropped while copying; start over. The next
+	     attempt accounts for the gap. */
+     }
+}
+
+void ring_get(struct ring *r, uint64_t *timestamp, uint16_t *values)
+{
+     ring_get_many(r, timestamp, values, NULL, 1);
+}
+
+void ring_wakeup(struct ring *r)
+{
+     __atomic_store_n(&r->sleeping, 0, __ATOMIC_RELEASE);
+     futex_wake(&r->sleeping);
+}
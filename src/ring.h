@@ -19,41 +19,118 @@
 #ifndef RING_H
 #define RING_H
 
-#include <pthread.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-/* At a sampling rate of 1000 Hz, we can buffer more than 8 seconds of samples.
-   If the logging thread cannot chatch up in this timespan, the systems is
-   definitely too slow for the sampling rate. */
-#define RING_SIZE 8192
-#define RING_SIZE_MODMASK ((RING_SIZE)-1)
+/* At a sampling rate of 1000 Hz, we can buffer more than 8 seconds of samples
+   by default. If the logging thread cannot chatch up in this timespan, the
+   systems is definitely too slow for the sampling rate. */
+#define RING_DEFAULT_SIZE 8192
 
-struct ring_entry {
-     uint64_t timestamp;
-     uint16_t value1;
-     uint16_t value2;
+/* Largest ring size (entries); head and tail counters must not wrap around
+   within the ring. */
+#define RING_MAX_SIZE (1u << 30)
+
+/* Size of a cache line. Producer and consumer indices are kept on separate
+   cache lines, so the sampling and the logging thread do not steal the same
+   line from each other on every sample. */
+#define RING_CACHELINE 64
+
+/* By default, a sleeping consumer is only woken up once this many entries
+   are available. */
+#define RING_DEFAULT_WAKEUP_BATCH 64
+
+/* A sleeping consumer wakes up on its own after this timeout, even if less
+   than a batch of entries is available. */
+#define RING_WAKEUP_TIMEOUT_MS 100
+
+/* Maximum number of values per entry */
+#define RING_MAX_CHANNELS 16
+
+/* Value of channels not sampled in a scan */
+#define RING_NO_VALUE 0xffff
+
+/* What to do if an entry is added to a full ring. The producer is never
+   blocked. */
+enum ring_policy {
+     /* Drop the new entry */
+     RING_DROP_NEWEST,
+     /* Drop the oldest entry to make room for the new one */
+     RING_DROP_OLDEST
 };
 
+/**
+ * Single-producer/single-consumer ring.
+ *
+ * The producer (sampling thread) never blocks and never takes a lock.
+ * head and tail are free-running counters; an entry's slot is the counter
+ * masked with size-1.
+ *
+ * If the ring is full, either the new entry is dropped, or the producer
+ * drops the oldest entry by advancing tail itself. In the latter case, the
+ * consumer validates after copying entries that they have not been dropped
+ * (and possibly overwritten) in the meantime, similar to a seqlock. Each
+ * entry records the number of entries lost right before it, so gaps in
+ * the sequence of entries can be reported by the consumer.
+ *
+ * Each entry consists of a timestamp and one value per channel. Entries are
+ * stored as structure of arrays: timestamps in one array, values in
+ * another array with channel_count values per entry, so memory scales with
+ * the number of channels actually sampled.
+ */
 struct ring {
-     struct ring_entry entries[RING_SIZE];
+     /* Written by the producer only */
+     unsigned int head __attribute__((aligned(RING_CACHELINE)));
+     /* Producer's private copy of tail, refreshed only if the ring seems
+	full. */
+     unsigned int tail_cached;
+     /* Number of new entries dropped since the last added entry */
+     uint32_t pending_gap;
 
-     unsigned int head;
-     unsigned int tail;
+     /* Written by the consumer, and by the producer when dropping the
+	oldest entry */
+     unsigned int tail __attribute__((aligned(RING_CACHELINE)));
+     /* Consumer's private copy of the tail it has set last. If tail
+	differs, the producer has dropped entries. */
+     unsigned int tail_expected;
 
-     unsigned int entrycnt;
-     
-     pthread_cond_t notempty;
-     pthread_cond_t notfull;
+     /* Futex word; 1 while the consumer is sleeping, 0 otherwise. Written
+	by the consumer before it sleeps and by the producer to wake it up. */
+     int sleeping __attribute__((aligned(RING_CACHELINE)));
+     /* Value of head at which a sleeping consumer is to be woken up. */
+     unsigned int wakeup_head;
+     unsigned int wakeup_batch;
 
-     pthread_mutex_t mutex;
+     unsigned int size;
+     unsigned int mask;
+     enum ring_policy policy;
+     unsigned int channel_count;
+     uint64_t *timestamps;
+     uint16_t *values;
+     /* Number of entries lost right before each entry */
+     uint32_t *gaps;
+     /* Memory mapping holding the arrays */
+     void *map;
+     size_t map_size;
+     bool huge_pages;
 };
 
 /**
- * Initialize new ring.
+ * Initialize new ring. The memory of the ring is allocated, locked, and
+ * prefaulted up front.
  * 
  * @param r the ring to be initialized
+ * @param channel_count number of values per entry
+ * @param size number of entries (rounded up to a power of two)
+ * @param policy what to do if the ring is full
+ * @param huge_pages true to allocate the ring from huge pages if available
+ * (r->huge_pages tells whether huge pages are used)
+ * @return 0 on success; -1 if memory could not be allocated or locked, or
+ * the number of channels or the size is invalid
  */
-void ring_init(struct ring *r);
+int ring_init(struct ring *r, unsigned int channel_count, unsigned int size,
+	      enum ring_policy policy, bool huge_pages);
 
 /**
  * Destroy a ring.
@@ -63,19 +140,74 @@ void ring_init(struct ring *r);
 void ring_destroy(struct ring* r);
 
 /**
- * Add an entry to a ring.
+ * Set the number of entries after which a sleeping consumer is woken up.
+ *
+ * @param r the ring
+ * @param batch number of entries (1 wakes up the consumer for every entry)
+ */
+void ring_set_wakeup_batch(struct ring *r, unsigned int batch);
+
+/**
+ * Add an entry to a ring. Never blocks.
  * 
  * @param r the ring
- * @param e the entry to be added
+ * @param timestamp timestamp of the entry
+ * @param values channel_count values of the entry
+ * @return 0 on success; -1 if the ring is full and the entry was dropped
+ * (RING_DROP_NEWEST); 1 if the oldest entry was dropped to add the entry
+ * (RING_DROP_OLDEST).
+ */
+int ring_put(struct ring *r, uint64_t timestamp, const uint16_t *values);
+
+/**
+ * Check whether a ring is full. Must only be called by the producer.
+ *
+ * @param r the ring
+ * @return true if adding an entry would drop an entry
  */
-void ring_put(struct ring *r, const struct ring_entry *e);
+bool ring_full(struct ring *r);
 
 /**
- * Get and remove an entry from a ring.
+ * Get the number of entries in a ring. Must only be called by the
+ * producer.
+ *
+ * @param r the ring
+ * @return number of entries not yet taken by the consumer
+ */
+unsigned int ring_count(const struct ring *r);
+
+/**
+ * Get and remove an entry from a ring. Blocks while the ring is empty.
  * 
  * @param r the ring
- * @param e structure to copy the entry to.
+ * @param timestamp set to the timestamp of the entry
+ * @param values array to copy the channel_count values of the entry to
+ */
+void ring_get(struct ring *r, uint64_t *timestamp, uint16_t *values);
+
+/**
+ * Get and remove all available entries from a ring, up to a maximum number.
+ * Blocks while the ring is empty.
+ *
+ * @param r the ring
+ * @param timestamps array to copy the timestamps of the entries to
+ * @param values array to copy the values of the entries to
+ * (max*channel_count values)
+ * @param gaps array to store the number of entries lost right before each
+ * entry in (NULL if not needed)
+ * @param max maximum number of entries to be copied
+ * @return number of entries copied (at least 1)
+ */
+unsigned int ring_get_many(struct ring *r, uint64_t *timestamps,
+			   uint16_t *values, uint32_t *gaps,
+			   unsigned int max);
+
+/**
+ * Wake up a sleeping consumer regardless of the number of available entries,
+ * e.g., to flush the ring on termination.
+ *
+ * @param r the ring
  */
-void ring_get(struct ring *r, struct ring_entry *e);
+void ring_wakeup(struct ring *r);
 
 #endif
@@ -0,0 +1,292 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Microbenchmark comparing the latency of ring_put() of the lock-free ring
+   with the mutex/condition variable based ring used before.
+
+   Usage: ringbench [-n PUTS] [-F PUT_FREQUENCY] [-p TASK_PRIORITY]
+
+   A producer thread puts entries at the given frequency (0 = as fast as
+   possible) while a consumer thread drains the ring. The duration of each
+   put is measured, and percentiles are printed for both rings. */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include "ring.h"
+
+struct ring_entry {
+     uint64_t timestamp;
+     uint16_t value1;
+     uint16_t value2;
+};
+
+/* The ring as implemented before: every put and get takes a mutex and
+   signals a condition variable. */
+struct mutex_ring {
+     struct ring_entry entries[RING_DEFAULT_SIZE];
+     unsigned int head;
+     unsigned int tail;
+     unsigned int entrycnt;
+     pthread_cond_t notempty;
+     pthread_cond_t notfull;
+     pthread_mutex_t mutex;
+};
+
+struct ring the_ring;
+struct mutex_ring the_mutex_ring;
+
+unsigned long puts_total = 100000;
+double put_frequency = 10000.0;
+int task_priority = 0;
+
+uint64_t *latencies;
+
+volatile bool producer_done;
+
+void mutex_ring_init(struct mutex_ring *r)
+{
+     r->head = 0;
+     r->tail = 0;
+     r->entrycnt = 0;
+     pthread_mutex_init(&r->mutex, NULL);
+     pthread_cond_init(&r->notempty, NULL);
+     pthread_cond_init(&r->notfull, NULL);
+}
+
+void mutex_ring_put(struct mutex_ring *r, const struct ring_entry *e)
+{
+     pthread_mutex_lock(&r->mutex);
+     while (r->entrycnt == RING_DEFAULT_SIZE) {
+	  pthread_cond_wait(&r->notfull, &r->mutex);
+     }
+     r->entries[r->head] = *e;
+     r->entrycnt++;
+     r->head = (r->head+1) % RING_DEFAULT_SIZE;
+     pthread_cond_signal(&r->notempty);
+     pthread_mutex_unlock(&r->mutex);
+}
+
+void mutex_ring_get(struct mutex_ring *r, struct ring_entry *e)
+{
+     pthread_mutex_lock(&r->mutex);
+     while (r->entrycnt == 0) {
+	  pthread_cond_wait(&r->notempty, &r->mutex);
+     }
+     *e = r->entries[r->tail];
+     r->entrycnt--;
+     r->tail = (r->tail+1) % RING_DEFAULT_SIZE;
+     pthread_cond_signal(&r->notfull);
+     pthread_mutex_unlock(&r->mutex);
+}
+
+uint64_t now_ns(void)
+{
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return 1000000000ull*t.tv_sec + t.tv_nsec;
+}
+
+void set_priority(int priority)
+{
+     if (priority <= 0)
+	  return;
+     
+     struct sched_param schedparam;
+     schedparam.sched_priority = priority;
+     if (sched_setscheduler(0, SCHED_FIFO, &schedparam) == -1)
+	  perror("sched_setscheduler failed");
+}
+
+/**
+ * Put entries at the configured frequency and record the latency of
+ * each put.
+ *
+ * @param args true to use the mutex ring, false for the lock-free ring
+ */
+void *producer_loop(void *args)
+{
+     bool use_mutex_ring = *((bool *) args);
+     
+     set_priority(task_priority);
+
+     uint64_t interval = 0;
+     if (put_frequency > 0.0)
+	  interval = (uint64_t) (1000000000.0/put_frequency + 0.5);
+     
+     uint64_t tnext = now_ns();
+     for (unsigned long i = 0; i < puts_total; i++) {
+	  struct ring_entry entry;
+	  entry.timestamp = tnext;
+	  entry.value1 = i & 0x0fff;
+	  entry.value2 = (i >> 12) & 0x0fff;
+	  
+	  uint64_t tstart = now_ns();
+	  if (use_mutex_ring) {
+	       mutex_ring_put(&the_mutex_ring, &entry);
+	  } else {
+	       uint16_t values[2];
+	       values[0] = entry.value1;
+	       values[1] = entry.value2;
+	       while (ring_full(&the_ring))
+		    sched_yield();
+	       ring_put(&the_ring, entry.timestamp, values);
+	  }
+	  latencies[i] = now_ns()-tstart;
+
+	  if (interval > 0) {
+	       tnext += interval;
+	       struct timespec tsleep;
+	       tsleep.tv_sec = tnext/1000000000ull;
+	       tsleep.tv_nsec = tnext%1000000000ull;
+	       clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tsleep, NULL);
+	  }
+     }
+
+     producer_done = true;
+     if (!use_mutex_ring)
+	  ring_wakeup(&the_ring);
+     
+     return NULL;
+}
+
+/**
+ * Drain the ring until all entries have been received.
+ *
+ * @param args true to use the mutex ring, false for the lock-free ring
+ */
+void *consumer_loop(void *args)
+{
+     bool use_mutex_ring = *((bool *) args);
+
+     set_priority(task_priority > 1 ? task_priority-1 : 0);
+
+     struct ring_entry entry;
+     uint64_t timestamps[256];
+     uint16_t values[2*256];
+     unsigned long received = 0;
+     while (received < puts_total) {
+	  if (use_mutex_ring) {
+	       mutex_ring_get(&the_mutex_ring, &entry);
+	       received++;
+	  } else {
+	       received += ring_get_many(&the_ring, timestamps, values, NULL,
+					  256);
+	  }
+     }
+
+     return NULL;
+}
+
+int compare_u64(const void *a, const void *b)
+{
+     uint64_t x = *((const uint64_t *) a);
+     uint64_t y = *((const uint64_t *) b);
+
+     return (x > y) - (x < y);
+}
+
+/**
+ * Run the benchmark for one ring type and print latency percentiles.
+ *
+ * @param use_mutex_ring true to use the mutex ring, false for the
+ * lock-free ring
+ */
+void run(bool use_mutex_ring)
+{
+     pthread_t producer, consumer;
+
+     if (use_mutex_ring)
+	  mutex_ring_init(&the_mutex_ring);
+     else
+	  ring_init(&the_ring, 2, RING_DEFAULT_SIZE, RING_DROP_NEWEST, false);
+     producer_done = false;
+     
+     pthread_create(&consumer, NULL, consumer_loop, &use_mutex_ring);
+     pthread_create(&producer, NULL, producer_loop, &use_mutex_ring);
+     pthread_join(producer, NULL);
+     pthread_join(consumer, NULL);
+
+     if (!use_mutex_ring)
+	  ring_destroy(&the_ring);
+
+     qsort(latencies, puts_total, sizeof(uint64_t), compare_u64);
+
+     const double percentiles[] = {50.0, 90.0, 99.0, 99.9, 99.99};
+     printf("%-10s", use_mutex_ring ? "mutex" : "lock-free");
+     for (size_t i = 0; i < sizeof(percentiles)/sizeof(double); i++) {
+	  unsigned long idx = (unsigned long) (percentiles[i]/100.0*
+					       (puts_total-1));
+	  printf(" %10llu", (unsigned long long) latencies[idx]);
+     }
+     printf(" %10llu\n", (unsigned long long) latencies[puts_total-1]);
+}
+
+void usage(const char *appl)
+{
+     fprintf(stderr, "%s [-n PUTS] [-F PUT_FREQUENCY] [-p TASK_PRIORITY]\n",
+	     appl);
+}
+
+int main(int argc, char *argv[])
+{
+     int c;
+     while ((c = getopt(argc, argv, "n:F:p:")) != -1) {
+	  switch (c) {
+	  case 'n' :
+	       puts_total = strtoul(optarg, NULL, 10);
+	       break;
+	  case 'F' :
+	       put_frequency = strtod(optarg, NULL);
+	       break;
+	  case 'p' :
+	       task_priority = atoi(optarg);
+	       break;
+	  default:
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+
+     if (puts_total == 0) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+     
+     latencies = malloc(puts_total*sizeof(uint64_t));
+     if (latencies == NULL) {
+	  perror("Could not allocate memory");
+	  exit(-1);
+     }
+
+     printf("put latency [ns], %lu puts at %.0f Hz\n", puts_total,
+	    put_frequency);
+     printf("%-10s %10s %10s %10s %10s %10s %10s\n", "ring", "p50", "p90",
+	    "p99", "p99.9", "p99.99", "max");
+     run(true);
+     run(false);
+
+     free(latencies);
+     
+     return 0;
+}
@@ -0,0 +1,330 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Note: like the binary log, rollups are little-endian and written in
+   host byte order. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "rollup.h"
+
+/* Maximum length of the interval of a tier in the spec */
+#define ROLLUP_MAX_NAME 32
+
+/**
+ * Parse the interval of a tier.
+ *
+ * @param p the interval with unit (ms, s, min, or h)
+ * @param end set to the first character after the interval
+ * @return interval in ns; 0 if the interval is invalid
+ */
+static uint64_t parse_interval(const char *p, const char **end)
+{
+     static const struct {
+	  const char *unit;
+	  uint64_t ns;
+     } units[] = {
+	  {"ms", 1000000ull},
+	  {"min", 60000000000ull},
+	  {"s", 1000000000ull},
+	  {"h", 3600000000000ull}
+     };
+
+     char *e;
+     uint64_t n = strtoull(p, &e, 10);
+     if (e == p || n == 0)
+	  return 0;
+     for (unsigned int i = 0; i < sizeof(units)/sizeof(units[0]); i++) {
+	  size_t length = strlen(units[i].unit);
+	  if (strncmp(e, units[i].unit, length) == 0 &&
+	      (e[length] == ',' || e[length] == '\0')) {
+	       *end = e+length;
+	       return n*units[i].ns;
+	  }
+     }
+
+     return 0;
+}
+
+int rollup_open(struct rollup *r, const char *path, const char *spec,
+		unsigned int channel_count, bool power, unsigned int frac_bits)
+{
+     if (channel_count == 0 || channel_count > ROLLUP_MAX_CHANNELS) {
+	  errno = EINVAL;
+	  return -1;
+     }
+     r->channel_count = channel_count;
+     r->power = power;
+     r->tier_count = 0;
+     r->write_errors = 0;
+
+     const char *p = spec;
+     while (true) {
+	  const char *end;
+	  uint64_t interval = parse_interval(p, &end);
+	  if (interval == 0 || r->tier_count == ROLLUP_MAX_TIERS ||
+	      end-p >= ROLLUP_MAX_NAME ||
+	      (r->tier_count > 0 &&
+	       interval%r->tiers[r->tier_count-1].header.interval != 0)) {
+	       rollup_close(r);
+	       errno = EINVAL;
+	       return -1;
+	  }
+
+	  struct rollup_tier *tier = &r->tiers[r->tier_count];
+	  struct rollup_header *h = &tier->header;
+	  memset(h, 0, sizeof(*h));
+	  memcpy(h->magic, ROLLUP_MAGIC, sizeof(h->magic));
+	  h->version = ROLLUP_VERSION;
+	  h->channel_count = channel_count;
+	  h->flags = (power ? ROLLUP_FLAG_POWER : 0);
+	  h->frac_bits = frac_bits;
+	  h->record_size = 12 + 6*channel_count + (power ? 12 : 0);
+	  h->interval = interval;
+	  tier->bucket.count = 0;
+	  tier->fill = 0;
+
+	  char name[ROLLUP_MAX_NAME];
+	  memcpy(name, p, end-p);
+	  name[end-p] = '\0';
+	  size_t length = strlen(path)+strlen(".rollup-")+strlen(name)+1;
+	  char *tier_path = malloc(length);
+	  if (tier_path == NULL) {
+	       rollup_close(r);
+	       return -1;
+	  }
+	  snprintf(tier_path, length, "%s.rollup-%s", path, name);
+	  tier->fd = open(tier_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	  free(tier_path);
+	  if (tier->fd == -1) {
+	       rollup_close(r);
+	       return -1;
+	  }
+	  r->tier_count++;
+	  
+	  memcpy(tier->buffer, h, sizeof(*h));
+	  tier->fill = sizeof(*h);
+
+	  if (*end == '\0')
+	       return 0;
+	  p = end+1;
+     }
+}
+
+/**
+ * Write the buffered records of a tier.
+ *
+ * @param r the rollups
+ * @param tier the tier
+ */
+static void write_tier(struct rollup *r, struct rollup_tier *tier)
+{
+     size_t written = 0;
+     while (written < tier->fill) {
+	  ssize_t ret = write(tier->fd, tier->buffer+written,
+			      tier->fill-written);
+	  if (ret == -1) {
+	       if (errno == EINTR)
+		    continue;
+	       /* Like the logger, count the error and drop the data. */
+	       r->write_errors++;
+	       break;
+	  }
+	  written += ret;
+     }
+     tier->fill = 0;
+}
+
+/**
+ * Start a new interval of a tier.
+ *
+ * @param r the rollups
+ * @param b bucket of the tier
+ * @param t0 start of the interval
+ */
+static void start_bucket(const struct rollup *r, struct rollup_bucket *b,
+			 uint64_t t0)
+{
+     b->t0 = t0;
+     b->count = 0;
+     for (unsigned int c = 0; c < r->channel_count; c++) {
+	  b->counts[c] = 0;
+	  b->sums[c] = 0;
+	  b->min[c] = UINT16_MAX;
+	  b->max[c] = 0;
+     }
+     b->power_count = 0;
+     b->power_sum = 0;
+     b->power_min = INT32_MAX;
+     b->power_max = INT32_MIN;
+}
+
+/**
+ * Write the record of the current interval of a tier and merge it into the
+ * next tier.
+ *
+ * @param r the rollups
+ * @param k index of the tier
+ */
+static void finish_bucket(struct rollup *r, unsigned int k)
+{
+     struct rollup_tier *tier = &r->tiers[k];
+     const struct rollup_bucket *b = &tier->bucket;
+     unsigned int cc = r->channel_count;
+     if (b->count == 0)
+	  return;
+
+     if (tier->fill+tier->header.record_size > ROLLUP_BUFFER_SIZE)
+	  write_tier(r, tier);
+     uint8_t *p = tier->buffer+tier->fill;
+     memcpy(p, &b->t0, 8);
+     memcpy(p+8, &b->count, 4);
+     p += 12;
+     for (unsigned int c = 0; c < cc; c++) {
+	  uint16_t v[3] = {ROLLUP_NO_VALUE, ROLLUP_NO_VALUE, ROLLUP_NO_VALUE};
+	  if (b->counts[c] > 0) {
+	       v[0] = b->min[c];
+	       v[1] = (b->sums[c] + b->counts[c]/2)/b->counts[c];
+	       v[2] = b->max[c];
+	  }
+	  memcpy(p, v, 6);
+	  p += 6;
+     }
+     if (r->power) {
+	  int32_t v[3] = {0, 0, 0};
+	  if (b->power_count > 0) {
+	       v[0] = b->power_min;
+	       v[1] = b->power_sum/b->power_count;
+	       v[2] = b->power_max;
+	  }
+	  memcpy(p, v, 12);
+     }
+     tier->fill += tier->header.record_size;
+
+     if (k+1 < r->tier_count) {
+	  struct rollup_tier *next = &r->tiers[k+1];
+	  struct rollup_bucket *n = &next->bucket;
+	  uint64_t t0 = b->t0 - b->t0%next->header.interval;
+	  if (n->count > 0 && n->t0 != t0)
+	       finish_bucket(r, k+1);
+	  if (n->count == 0)
+	       start_bucket(r, n, t0);
+	  n->count += b->count;
+	  for (unsigned int c = 0; c < cc; c++) {
+	       if (b->counts[c] == 0)
+		    continue;
+	       n->counts[c] += b->counts[c];
+	       n->sums[c] += b->sums[c];
+	       if (b->min[c] < n->min[c])
+		    n->min[c] = b->min[c];
+	       if (b->max[c] > n->max[c])
+		    n->max[c] = b->max[c];
+	  }
+	  if (b->power_count > 0) {
+	       n->power_count += b->power_count;
+	       n->power_sum += b->power_sum;
+	       if (b->power_min < n->power_min)
+		    n->power_min = b->power_min;
+	       if (b->power_max > n->power_max)
+		    n->power_max = b->power_max;
+	  }
+     }
+
+     tier->bucket.count = 0;
+}
+
+void rollup_add(struct rollup *r, uint64_t timestamp, const uint16_t *values,
+		const int64_t *power)
+{
+     /* Only the finest tier sees every scan. */
+     struct rollup_tier *tier = &r->tiers[0];
+     struct rollup_bucket *b = &tier->bucket;
+     uint64_t t0 = timestamp - timestamp%tier->header.interval;
+     if (b->count > 0 && b->t0 != t0)
+	  finish_bucket(r, 0);
+     if (b->count == 0)
+	  start_bucket(r, b, t0);
+
+     b->count++;
+     for (unsigned int c = 0; c < r->channel_count; c++) {
+	  uint16_t v = values[c];
+	  if (v == ROLLUP_NO_VALUE)
+	       continue;
+	  b->counts[c]++;
+	  b->sums[c] += v;
+	  if (v < b->min[c])
+	       b->min[c] = v;
+	  if (v > b->max[c])
+	       b->max[c] = v;
+     }
+     if (r->power && power != NULL) {
+	  int32_t p = (*power > INT32_MAX ? INT32_MAX :
+		       *power < INT32_MIN ? INT32_MIN : *power);
+	  b->power_count++;
+	  b->power_sum += p;
+	  if (p < b->power_min)
+	       b->power_min = p;
+	  if (p > b->power_max)
+	       b->power_max = p;
+     }
+}
+
+void rollup_flush(struct rollup *r)
+{
+     for (unsigned int k = 0; k < r->tier_count; k++) {
+	  if (r->tiers[k].fill > 0)
+	       write_tier(r, &r->tiers[k]);
+     }
+}
+
+void rollup_close(struct rollup *r)
+{
+     /* Finer tiers first, so coarser tiers get their last records. */
+     for (unsigned int k = 0; k < r->tier_count; k++)
+	  finish_bucket(r, k);
+     rollup_flush(r);
+     for (unsigned int k = 0; k < r->tier_count; k++)
+	  close(r->tiers[k].fd);
+     r->tier_count = 0;
+}
+
+void rollup_decode(const struct rollup_header *h, const uint8_t *data,
+		   struct rollup_record *record)
+{
+     memcpy(&record->t0, data, 8);
+     memcpy(&record->count, data+8, 4);
+     data += 12;
+     for (unsigned int c = 0; c < h->channel_count; c++) {
+	  memcpy(&record->min[c], data, 2);
+	  memcpy(&record->mean[c], data+2, 2);
+	  memcpy(&record->max[c], data+4, 2);
+	  data += 6;
+     }
+     record->power_min = 0;
+     record->power_mean = 0;
+     record->power_max = 0;
+     if (h->flags & ROLLUP_FLAG_POWER) {
+	  memcpy(&record->power_min, data, 4);
+	  memcpy(&record->power_mean, data+4, 4);
+	  memcpy(&record->power_max, data+8, 4);
+     }
+}
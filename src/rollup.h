@@ -0,0 +1,181 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Multi-resolution rollups of a log
+
+   Rollups summarize the scans of a log at a few fixed resolutions
+   (tiers, e.g., 10 ms, 1 s, 1 min, 1 h), so a viewer can draw any time
+   range by reading the tier whose interval matches the zoom level instead
+   of the raw log. Each tier is a side file starting with struct
+   rollup_header, followed by one record per interval holding scans:
+
+     uint64_t t0           start of the interval (a multiple of interval)
+     uint32_t count        number of scans in the interval
+     uint16_t min, mean, max of each channel (ROLLUP_NO_VALUE if the
+                           channel was not sampled in the interval)
+     int32_t min, mean, max of the calibrated power in uW (only with
+                           ROLLUP_FLAG_POWER)
+
+   Intervals without scans have no record. Values are in the units of the
+   log (with frac_bits fractional bits if inputs are oversampled). All
+   values are little-endian. The interval of each tier is a multiple of the
+   interval of the previous tier, so intervals of a tier nest in the
+   intervals of the next tier, which are aggregated from the records of
+   the previous tier rather than from every scan. */
+
+#define ROLLUP_MAGIC "PMROLLUP"
+#define ROLLUP_VERSION 1
+
+#define ROLLUP_MAX_TIERS 8
+#define ROLLUP_MAX_CHANNELS 16
+
+/* Flag of the header: records hold the calibrated power */
+#define ROLLUP_FLAG_POWER 0x01
+
+/* Value of channels without a value in an interval */
+#define ROLLUP_NO_VALUE 0xffff
+
+/* Maximum size of a record */
+#define ROLLUP_MAX_RECORD_SIZE (12 + 6*ROLLUP_MAX_CHANNELS + 12)
+
+/* Records of a tier are written in chunks of this size */
+#define ROLLUP_BUFFER_SIZE 4096
+
+struct rollup_header {
+     char magic[8];
+     uint16_t version;
+     uint16_t channel_count;
+     uint8_t flags;
+     /* Fractional bits of the values (oversampled inputs) */
+     uint8_t frac_bits;
+     uint16_t record_size;
+     /* Interval of the tier in ns */
+     uint64_t interval;
+} __attribute__((packed));
+
+/**
+ * Decoded record of a tier.
+ */
+struct rollup_record {
+     uint64_t t0;
+     uint32_t count;
+     uint16_t min[ROLLUP_MAX_CHANNELS];
+     uint16_t mean[ROLLUP_MAX_CHANNELS];
+     uint16_t max[ROLLUP_MAX_CHANNELS];
+     int32_t power_min;
+     int32_t power_mean;
+     int32_t power_max;
+};
+
+/**
+ * Aggregate of the interval a tier is currently collecting.
+ */
+struct rollup_bucket {
+     uint64_t t0;
+     uint32_t count;
+     uint32_t counts[ROLLUP_MAX_CHANNELS];
+     uint64_t sums[ROLLUP_MAX_CHANNELS];
+     uint16_t min[ROLLUP_MAX_CHANNELS];
+     uint16_t max[ROLLUP_MAX_CHANNELS];
+     uint32_t power_count;
+     int64_t power_sum;
+     int32_t power_min;
+     int32_t power_max;
+};
+
+struct rollup_tier {
+     struct rollup_header header;
+     int fd;
+     struct rollup_bucket bucket;
+     uint8_t buffer[ROLLUP_BUFFER_SIZE];
+     size_t fill;
+};
+
+/**
+ * Rollup tiers of a log, written by a single thread.
+ */
+struct rollup {
+     unsigned int channel_count;
+     bool power;
+     struct rollup_tier tiers[ROLLUP_MAX_TIERS];
+     unsigned int tier_count;
+     uint64_t write_errors;
+};
+
+/**
+ * Create the side files of rollup tiers.
+ *
+ * @param r the rollups
+ * @param path path of the log; the file of a tier is named
+ * PATH.rollup-TIER (e.g., log.csv.rollup-10ms)
+ * @param spec comma-separated intervals of the tiers with unit ms, s, min,
+ * or h (e.g., "10ms,1s,1min,1h"), each a multiple of the previous one
+ * @param channel_count number of channels of a scan
+ * @param power true to roll up the calibrated power as well
+ * @param frac_bits fractional bits of the values
+ * @return 0 on success; -1 on error (errno is set; EINVAL if the tiers
+ * are invalid)
+ */
+int rollup_open(struct rollup *r, const char *path, const char *spec,
+		unsigned int channel_count, bool power, unsigned int frac_bits);
+
+/**
+ * Add a scan to the rollups. Scans must be added in order of their
+ * timestamps.
+ *
+ * @param r the rollups
+ * @param timestamp timestamp of the scan in ns
+ * @param values channel_count values (ROLLUP_NO_VALUE for channels not
+ * sampled)
+ * @param power calibrated power in uW (NULL if not available)
+ */
+void rollup_add(struct rollup *r, uint64_t timestamp, const uint16_t *values,
+		const int64_t *power);
+
+/**
+ * Write the buffered records of all tiers.
+ *
+ * @param r the rollups
+ */
+void rollup_flush(struct rollup *r);
+
+/**
+ * Write the intervals collected so far and close the side files.
+ *
+ * @param r the rollups
+ */
+void rollup_close(struct rollup *r);
+
+/**
+ * Decode a record of a tier.
+ *
+ * @param h header of the tier
+ * @param data the record (h->record_size bytes)
+ * @param record the decoded record
+ */
+void rollup_decode(const struct rollup_header *h, const uint8_t *data,
+		   struct rollup_record *record);
+
+#endif
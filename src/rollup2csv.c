@@ -0,0 +1,92 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Convert a rollup tier written by powermeter (-R) to CSV: one line
+   T0,COUNT followed by MIN,MEAN,MAX of each channel and of the power. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "rollup.h"
+
+void usage(const char *appl)
+{
+     fprintf(stderr, "%s ROLLUP [CSVFILE]\n", appl);
+}
+
+int main(int argc, char *argv[])
+{
+     if (argc < 2 || argc > 3) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     FILE *fin = fopen(argv[1], "r");
+     if (fin == NULL) {
+	  perror("Could not open rollup");
+	  exit(-1);
+     }
+
+     struct rollup_header header;
+     if (fread(&header, sizeof(header), 1, fin) != 1 ||
+	 memcmp(header.magic, ROLLUP_MAGIC, sizeof(header.magic)) != 0 ||
+	 header.version != ROLLUP_VERSION ||
+	 header.channel_count == 0 ||
+	 header.channel_count > ROLLUP_MAX_CHANNELS ||
+	 header.record_size > ROLLUP_MAX_RECORD_SIZE) {
+	  fprintf(stderr, "Not a rollup\n");
+	  fclose(fin);
+	  exit(-1);
+     }
+
+     FILE *fout = stdout;
+     if (argc == 3) {
+	  fout = fopen(argv[2], "w");
+	  if (fout == NULL) {
+	       perror("Could not open output file");
+	       fclose(fin);
+	       exit(-1);
+	  }
+     }
+
+     fprintf(fout, "# interval %llu\n", (unsigned long long) header.interval);
+     uint8_t data[ROLLUP_MAX_RECORD_SIZE];
+     struct rollup_record record;
+     while (fread(data, header.record_size, 1, fin) == 1) {
+	  rollup_decode(&header, data, &record);
+	  fprintf(fout, "%llu,%u", (unsigned long long) record.t0,
+		  record.count);
+	  for (unsigned int c = 0; c < header.channel_count; c++) {
+	       if (record.mean[c] == ROLLUP_NO_VALUE)
+		    fprintf(fout, ",,,");
+	       else
+		    fprintf(fout, ",%u,%u,%u", record.min[c], record.mean[c],
+			    record.max[c]);
+	  }
+	  if (header.flags & ROLLUP_FLAG_POWER)
+	       fprintf(fout, ",%d,%d,%d", record.power_min,
+		       record.power_mean, record.power_max);
+	  fputc('\n', fout);
+     }
+
+     fclose(fin);
+     if (fout != stdout)
+	  fclose(fout);
+     
+     return 0;
+}
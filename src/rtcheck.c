@@ -0,0 +1,111 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/utsname.h>
+#include <sys/resource.h>
+#include "rtcheck.h"
+
+bool rtcheck_preempt_rt(void)
+{
+     FILE *f = fopen("/sys/kernel/realtime", "r");
+     if (f != NULL) {
+	  int realtime = 0;
+	  bool found = (fscanf(f, "%d", &realtime) == 1);
+	  fclose(f);
+	  if (found)
+	       return (realtime == 1);
+     }
+
+     /* Older PREEMPT_RT kernels only name the patch in the version, e.g.,
+	"#1 SMP PREEMPT RT" or "#1 SMP PREEMPT_RT". */
+     struct utsname name;
+     if (uname(&name) == -1)
+	  return false;
+
+     return (strstr(name.version, "PREEMPT_RT") != NULL ||
+	     strstr(name.version, "PREEMPT RT") != NULL);
+}
+
+bool rtcheck_fifo(int priority)
+{
+     int policy = sched_getscheduler(0);
+     struct sched_param previous;
+     if (policy == -1 || sched_getparam(0, &previous) == -1)
+	  return false;
+
+     struct sched_param param;
+     param.sched_priority = priority;
+     if (sched_setscheduler(0, SCHED_FIFO, &param) == -1)
+	  return false;
+     struct sched_param current;
+     bool fifo = (sched_getscheduler(0) == SCHED_FIFO &&
+		  sched_getparam(0, &current) == 0 &&
+		  current.sched_priority == priority);
+     sched_setscheduler(0, policy, &previous);
+
+     return fifo;
+}
+
+bool rtcheck_memory_locked(uint64_t *locked_kb, uint64_t *unlocked_kb)
+{
+     *locked_kb = 0;
+     *unlocked_kb = 0;
+     FILE *f = fopen("/proc/self/smaps", "r");
+     if (f == NULL)
+	  return false;
+
+     /* Each mapping starts with a line "START-END PERMS ... [NAME]",
+	followed by its resident size ("Rss:") and ends with its flags
+	("VmFlags:"), which include "lo" if it is locked. */
+     char line[512];
+     bool special = false;
+     unsigned long long rss = 0;
+     while (fgets(line, sizeof(line), f) != NULL) {
+	  unsigned long long start, end, kb;
+	  if (sscanf(line, "%llx-%llx", &start, &end) == 2) {
+	       special = (strstr(line, "[vvar") != NULL ||
+			  strstr(line, "[vdso]") != NULL ||
+			  strstr(line, "[vsyscall]") != NULL);
+	       rss = 0;
+	  } else if (sscanf(line, "Rss: %llu kB", &kb) == 1) {
+	       rss = kb;
+	  } else if (strncmp(line, "VmFlags:", strlen("VmFlags:")) == 0) {
+	       if (strstr(line, " lo") != NULL)
+		    *locked_kb += rss;
+	       else if (!special)
+		    *unlocked_kb += rss;
+	  }
+     }
+     fclose(f);
+
+     return (*locked_kb > 0 && *unlocked_kb == 0);
+}
+
+int rtcheck_thread_faults(struct page_faults *faults)
+{
+     struct rusage usage;
+     if (getrusage(RUSAGE_THREAD, &usage) == -1)
+	  return -1;
+     faults->minor = usage.ru_minflt;
+     faults->major = usage.ru_majflt;
+
+     return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RTCHECK_H
+#define RTCHECK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Checks whether the system and the process are ready for deterministic
+   sampling, and page fault accounting of threads. */
+
+/**
+ * Page faults of a thread.
+ */
+struct page_faults {
+     /* Faults served without I/O (e.g., first access to a page) */
+     uint64_t minor;
+     /* Faults that needed I/O (e.g., a page swapped out) */
+     uint64_t major;
+};
+
+/**
+ * Check whether the kernel is a PREEMPT_RT kernel.
+ *
+ * @return true if /sys/kernel/realtime is 1 or the kernel version names
+ * PREEMPT_RT
+ */
+bool rtcheck_preempt_rt(void);
+
+/**
+ * Check whether threads may run with SCHED_FIFO at a priority by switching
+ * the calling thread to SCHED_FIFO and back.
+ *
+ * @param priority the priority
+ * @return true if the calling thread ran with SCHED_FIFO at the priority
+ */
+bool rtcheck_fifo(int priority);
+
+/**
+ * Check whether all memory of the process is locked (mlockall()). The
+ * pages the kernel maps for the vDSO cannot be locked and are ignored.
+ *
+ * @param locked_kb set to the resident memory of locked mappings in KiB
+ * @param unlocked_kb set to the resident memory of other mappings in KiB
+ * @return true if there is locked memory and no unlocked memory
+ */
+bool rtcheck_memory_locked(uint64_t *locked_kb, uint64_t *unlocked_kb);
+
+/**
+ * Get the page faults of the calling thread since it was started.
+ *
+ * @param faults set to the page faults
+ * @return 0 on success; -1 on error (errno is set)
+ */
+int rtcheck_thread_faults(struct page_faults *faults);
+
+#endif
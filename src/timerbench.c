@@ -0,0 +1,176 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Benchmark of the timing modes of the sampling thread.
+
+   Usage: timerbench [-F FREQUENCY] [-n TICKS] [-c CPU] [-p TASK_PRIORITY]
+   [-m MODE]
+
+   A thread waits for TICKS deadlines spaced 1/FREQUENCY apart in each
+   timing mode (or only in MODE), optionally pinned to CPU and at realtime
+   priority TASK_PRIORITY, like the sampling thread. Missed deadlines are
+   skipped. For each mode, the achieved tick rate, the CPU time used per
+   second, and percentiles of the wakeup lateness and of the interval
+   between ticks are printed. */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "timing.h"
+#include "histogram.h"
+
+double frequency = 10000.0;
+unsigned long ticks_total = 100000;
+int cpu = -1;
+int task_priority = 0;
+
+struct histogram lateness;
+struct histogram intervals;
+
+/**
+ * Get the CPU time of the calling thread.
+ *
+ * @return CPU time in ns
+ */
+uint64_t thread_cpu_time(void)
+{
+     struct timespec t;
+     clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+     return 1000000000ull*t.tv_sec + t.tv_nsec;
+}
+
+/**
+ * Wait for deadlines in one timing mode and print the statistics.
+ *
+ * @param mode the timing mode
+ */
+void run(enum timing_mode mode)
+{
+     struct timing timing;
+     timing_init(&timing, mode);
+     histogram_init(&lateness, "lateness");
+     histogram_init(&intervals, "interval");
+
+     uint64_t interval = (uint64_t) (1000000000.0/frequency + 0.5);
+     uint64_t missed = 0;
+     uint64_t tstart = timing_now();
+     uint64_t cpu_start = thread_cpu_time();
+     uint64_t tdue = tstart+interval;
+     uint64_t tprevious = 0;
+     for (unsigned long i = 0; i < ticks_total; i++) {
+	  uint64_t twake = timing_wait(&timing, tdue);
+	  histogram_record(&lateness, twake > tdue ? twake-tdue : 0);
+	  if (i > 0)
+	       histogram_record(&intervals, twake-tprevious);
+	  tprevious = twake;
+
+	  tdue += interval;
+	  if (tdue <= twake) {
+	       uint64_t n = (twake-tdue)/interval + 1;
+	       tdue += n*interval;
+	       missed += n;
+	  }
+     }
+     double duration = (timing_now()-tstart)/1000000000.0;
+     double cpu_time = (thread_cpu_time()-cpu_start)/1000000000.0;
+
+     printf("%s: %.0f ticks/s, %.3f s CPU/s (%.3f s spinning), "
+	    "%llu deadlines missed", timing_mode_name(mode),
+	    ticks_total/duration, cpu_time/duration,
+	    timing.spin_time/1000000000.0/duration,
+	    (unsigned long long) missed);
+     if (mode == TIMING_HYBRID)
+	  printf(", slack %llu ns", (unsigned long long) timing.slack);
+     printf("\n");
+     histogram_print(stdout, &lateness);
+     histogram_print(stdout, &intervals);
+}
+
+void usage(const char *appl)
+{
+     fprintf(stderr, "%s [-F FREQUENCY] [-n TICKS] [-c CPU] "
+	     "[-p TASK_PRIORITY] [-m sleep|poll|hybrid]\n", appl);
+}
+
+int main(int argc, char *argv[])
+{
+     char *mode_arg = NULL;
+     int c;
+     while ((c = getopt(argc, argv, "F:n:c:p:m:")) != -1) {
+	  switch (c) {
+	  case 'F' :
+	       frequency = strtod(optarg, NULL);
+	       break;
+	  case 'n' :
+	       ticks_total = strtoul(optarg, NULL, 10);
+	       break;
+	  case 'c' :
+	       cpu = atoi(optarg);
+	       break;
+	  case 'p' :
+	       task_priority = atoi(optarg);
+	       break;
+	  case 'm' :
+	       mode_arg = optarg;
+	       break;
+	  default:
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+
+     enum timing_mode mode = TIMING_SLEEP;
+     if (frequency <= 0 || ticks_total == 0 ||
+	 (mode_arg != NULL && timing_parse_mode(mode_arg, &mode) == -1)) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     if (cpu >= 0 && timing_pin(cpu) == -1) {
+	  perror("Could not pin thread");
+	  exit(-1);
+     }
+     if (task_priority > 0) {
+	  struct sched_param schedparam;
+	  schedparam.sched_priority = task_priority;
+	  if (sched_setscheduler(0, SCHED_FIFO, &schedparam) == -1) {
+	       perror("sched_setscheduler failed");
+	       exit(-1);
+	  }
+     }
+     if (mlockall(MCL_CURRENT|MCL_FUTURE) == -1)
+	  perror("mlockall failed");
+
+     printf("%lu ticks at %.0f Hz%s\n", ticks_total, frequency,
+	    cpu >= 0 && timing_cpu_isolated(cpu) ? " on an isolated CPU" : "");
+     histogram_print_header(stdout);
+     if (mode_arg != NULL) {
+	  run(mode);
+     } else {
+	  run(TIMING_SLEEP);
+	  run(TIMING_POLL);
+	  run(TIMING_HYBRID);
+     }
+
+     return 0;
+}
@@ -0,0 +1,167 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include "timing.h"
+
+/* Names of the timing modes */
+static const char *mode_names[] = {"sleep", "poll", "hybrid"};
+
+#define MODE_COUNT (sizeof(mode_names)/sizeof(mode_names[0]))
+
+int timing_parse_mode(const char *name, enum timing_mode *mode)
+{
+     for (unsigned int i = 0; i < MODE_COUNT; i++) {
+	  if (strcmp(name, mode_names[i]) == 0) {
+	       *mode = i;
+	       return 0;
+	  }
+     }
+
+     return -1;
+}
+
+const char *timing_mode_name(enum timing_mode mode)
+{
+     return mode_names[mode];
+}
+
+void timing_init(struct timing *t, enum timing_mode mode)
+{
+     t->mode = mode;
+     t->slack = TIMING_INITIAL_SLACK;
+     t->spin_time = 0;
+     t->wakeups = 0;
+     histogram_init(&t->sleep_lateness, "sleep_lateness");
+}
+
+/**
+ * Sleep until a time.
+ *
+ * @param tdue the time (CLOCK_MONOTONIC in ns)
+ */
+static void sleep_until(uint64_t tdue)
+{
+     struct timespec tsleep;
+     tsleep.tv_sec = tdue/1000000000ull;
+     tsleep.tv_nsec = tdue%1000000000ull;
+     clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tsleep, NULL);
+}
+
+/**
+ * Set the slack from the lateness of the recent sleeps.
+ *
+ * @param t the timing state
+ */
+static void adapt_slack(struct timing *t)
+{
+     t->wakeups = 0;
+     /* Without sleeps, there is nothing to adapt to. */
+     if (t->sleep_lateness.count == 0)
+	  return;
+
+     uint64_t slack = histogram_percentile(&t->sleep_lateness,
+					   TIMING_SLACK_PERCENTILE);
+     if (slack < TIMING_MIN_SLACK)
+	  slack = TIMING_MIN_SLACK;
+     if (slack > TIMING_MAX_SLACK)
+	  slack = TIMING_MAX_SLACK;
+     __atomic_store_n(&t->slack, slack, __ATOMIC_RELAXED);
+     histogram_init(&t->sleep_lateness, "sleep_lateness");
+}
+
+uint64_t timing_wait(struct timing *t, uint64_t tdue)
+{
+     if (t->mode == TIMING_SLEEP) {
+	  sleep_until(tdue);
+	  return timing_now();
+     }
+
+     uint64_t tnow = timing_now();
+     if (t->mode == TIMING_HYBRID) {
+	  /* At intervals shorter than the slack, the slack is cut to half
+	     the time left, so the thread still sleeps. */
+	  if (tnow+2*TIMING_MIN_SLACK < tdue) {
+	       uint64_t slack = t->slack;
+	       if (slack > (tdue-tnow)/2)
+		    slack = (tdue-tnow)/2;
+	       uint64_t twake = tdue-slack;
+	       sleep_until(twake);
+	       tnow = timing_now();
+	       histogram_record(&t->sleep_lateness,
+				tnow > twake ? tnow-twake : 0);
+	  }
+	  if (++t->wakeups == TIMING_ADAPT_WAKEUPS)
+	       adapt_slack(t);
+     }
+
+     /* Reading CLOCK_MONOTONIC is served by the vDSO without a system
+	call, so the deadline is met within the time of a clock read. */
+     uint64_t tspin = tnow;
+     while (tnow < tdue)
+	  tnow = timing_now();
+     __atomic_store_n(&t->spin_time, t->spin_time+(tnow-tspin),
+		      __ATOMIC_RELAXED);
+     return tnow;
+}
+
+int timing_pin(int cpu)
+{
+     cpu_set_t set;
+     CPU_ZERO(&set);
+     CPU_SET(cpu, &set);
+     int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+     if (ret != 0) {
+	  errno = ret;
+	  return -1;
+     }
+
+     return 0;
+}
+
+bool timing_cpu_isolated(int cpu)
+{
+     FILE *f = fopen("/sys/devices/system/cpu/isolated", "r");
+     if (f == NULL)
+	  return false;
+
+     /* List of CPUs and ranges, e.g., "2-3,5" */
+     bool isolated = false;
+     int first, last;
+     while (fscanf(f, "%d", &first) == 1) {
+	  last = first;
+	  int c = fgetc(f);
+	  if (c == '-') {
+	       if (fscanf(f, "%d", &last) != 1)
+		    break;
+	       c = fgetc(f);
+	  }
+	  if (cpu >= first && cpu <= last)
+	       isolated = true;
+	  if (c != ',')
+	       break;
+     }
+     fclose(f);
+
+     return isolated;
+}
@@ -0,0 +1,131 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "histogram.h"
+
+/* Ways of waiting for a sampling deadline */
+enum timing_mode {
+     /* Sleep until the deadline (clock_nanosleep) */
+     TIMING_SLEEP,
+     /* Spin on the clock until the deadline. Only sensible on a core of
+	its own: the core is busy all the time. */
+     TIMING_POLL,
+     /* Sleep until slack before the deadline, then spin until the
+	deadline. The slack adapts to the observed wakeup lateness. */
+     TIMING_HYBRID
+};
+
+/* The hybrid mode sets the slack every TIMING_ADAPT_WAKEUPS wakeups to
+   the TIMING_SLACK_PERCENTILE percentile of the lateness of the sleeps
+   since the last adaptation, within TIMING_MIN_SLACK and
+   TIMING_MAX_SLACK ns. The maximum bounds the CPU time spent spinning per
+   deadline. Before each deadline, the thread sleeps at least half of the
+   time left (unless less than 2*TIMING_MIN_SLACK is left), so it never
+   degrades to polling at intervals shorter than the slack. */
+#define TIMING_ADAPT_WAKEUPS 1024
+#define TIMING_SLACK_PERCENTILE 99.0
+#define TIMING_INITIAL_SLACK 100000
+#define TIMING_MIN_SLACK 2000
+#define TIMING_MAX_SLACK 500000
+
+/**
+ * State of waiting for deadlines, used by a single thread. slack and
+ * spin_time may be read by other threads.
+ */
+struct timing {
+     enum timing_mode mode;
+     /* Time slept before a deadline is slack ns short of it */
+     uint64_t slack;
+     /* Total time spent spinning in ns */
+     uint64_t spin_time;
+     /* Wakeups and lateness of the sleeps since the last adaptation of
+	the slack */
+     unsigned int wakeups;
+     struct histogram sleep_lateness;
+};
+
+/**
+ * Get the time of CLOCK_MONOTONIC.
+ *
+ * @return the time in ns
+ */
+static inline uint64_t timing_now(void)
+{
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return 1000000000ull*t.tv_sec + t.tv_nsec;
+}
+
+/**
+ * Parse the name of a timing mode.
+ *
+ * @param name the name (sleep, poll, or hybrid)
+ * @param mode set to the mode
+ * @return 0 on success; -1 if the name is unknown
+ */
+int timing_parse_mode(const char *name, enum timing_mode *mode);
+
+/**
+ * Get the name of a timing mode.
+ *
+ * @param mode the mode
+ * @return the name
+ */
+const char *timing_mode_name(enum timing_mode mode);
+
+/**
+ * Initialize the timing state.
+ *
+ * @param t the timing state
+ * @param mode the timing mode
+ */
+void timing_init(struct timing *t, enum timing_mode mode);
+
+/**
+ * Wait until a deadline.
+ *
+ * @param t the timing state
+ * @param tdue the deadline (CLOCK_MONOTONIC in ns)
+ * @return time of wakeup in ns (at or after the deadline, unless
+ * interrupted)
+ */
+uint64_t timing_wait(struct timing *t, uint64_t tdue);
+
+/**
+ * Pin the calling thread to a CPU.
+ *
+ * @param cpu the CPU
+ * @return 0 on success; -1 on error (errno is set)
+ */
+int timing_pin(int cpu);
+
+/**
+ * Check whether a CPU is isolated from the scheduler (isolcpus=).
+ *
+ * @param cpu the CPU
+ * @return true if the CPU is isolated
+ */
+bool timing_cpu_isolated(int cpu);
+
+#endif
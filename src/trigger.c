@@ -0,0 +1,115 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "trigger.h"
+
+int trigger_init(struct trigger *t, const char *spec,
+		 unsigned int channel_count, uint64_t pre_window,
+		 uint64_t post_window)
+{
+     memset(t, 0, sizeof(*t));
+     t->pre_window = pre_window;
+     t->post_window = post_window;
+     for (unsigned int c = 0; c < TRIGGER_MAX_CHANNELS; c++)
+	  t->previous[c] = 0xffff;
+
+     const char *p = spec;
+     while (true) {
+	  if (t->condition_count == TRIGGER_MAX_CONDITIONS)
+	       return -1;
+	  struct trigger_condition *cond =
+	       &t->conditions[t->condition_count++];
+
+	  size_t n;
+	  if (strncmp(p, "above:", n = strlen("above:")) == 0)
+	       cond->type = TRIGGER_ABOVE;
+	  else if (strncmp(p, "below:", n = strlen("below:")) == 0)
+	       cond->type = TRIGGER_BELOW;
+	  else if (strncmp(p, "rise:", n = strlen("rise:")) == 0)
+	       cond->type = TRIGGER_RISE;
+	  else if (strncmp(p, "fall:", n = strlen("fall:")) == 0)
+	       cond->type = TRIGGER_FALL;
+	  else
+	       return -1;
+	  p += n;
+
+	  char *end;
+	  unsigned long channel = strtoul(p, &end, 10);
+	  if (end == p || *end != ':' || channel >= channel_count)
+	       return -1;
+	  cond->channel = channel;
+	  p = end+1;
+
+	  long threshold = strtol(p, &end, 10);
+	  if (end == p || threshold < 0 || threshold > 0xffff)
+	       return -1;
+	  cond->threshold = threshold;
+	  p = end;
+
+	  if (*p == '\0')
+	       return 0;
+	  if (*p != ',')
+	       return -1;
+	  p++;
+     }
+}
+
+bool trigger_check(struct trigger *t, uint64_t timestamp,
+		   const uint16_t *values)
+{
+     bool fired = false;
+     for (unsigned int i = 0; i < t->condition_count; i++) {
+	  const struct trigger_condition *cond = &t->conditions[i];
+	  int32_t v = values[cond->channel];
+	  int32_t previous = t->previous[cond->channel];
+	  if (v == 0xffff)
+	       continue;
+	  switch (cond->type) {
+	  case TRIGGER_ABOVE:
+	       fired |= (v > cond->threshold);
+	       break;
+	  case TRIGGER_BELOW:
+	       fired |= (v < cond->threshold);
+	       break;
+	  case TRIGGER_RISE:
+	       fired |= (previous != 0xffff && v-previous >= cond->threshold);
+	       break;
+	  case TRIGGER_FALL:
+	       fired |= (previous != 0xffff && previous-v >= cond->threshold);
+	       break;
+	  }
+     }
+     for (unsigned int i = 0; i < t->condition_count; i++) {
+	  unsigned int c = t->conditions[i].channel;
+	  if (values[c] != 0xffff)
+	       t->previous[c] = values[c];
+     }
+
+     if (fired) {
+	  if (!t->capturing)
+	       t->events++;
+	  t->capturing = true;
+	  t->tend = timestamp+t->post_window;
+     } else if (t->capturing && timestamp > t->tend) {
+	  t->capturing = false;
+     }
+
+     return t->capturing;
+}
@@ -0,0 +1,97 @@
+/**
+ * This file is part of RPi-Powermeter.
+ *
+ * Copyright 2015 University of Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Maximum number of conditions of a trigger */
+#define TRIGGER_MAX_CONDITIONS 8
+
+/* Maximum number of channels of a scan */
+#define TRIGGER_MAX_CHANNELS 16
+
+enum trigger_type {
+     /* Value of the channel above the threshold */
+     TRIGGER_ABOVE,
+     /* Value of the channel below the threshold */
+     TRIGGER_BELOW,
+     /* Value of the channel rose by at least the threshold since the
+	previous value of the channel */
+     TRIGGER_RISE,
+     /* Value of the channel fell by at least the threshold since the
+	previous value of the channel */
+     TRIGGER_FALL
+};
+
+struct trigger_condition {
+     enum trigger_type type;
+     unsigned int channel;
+     int32_t threshold;
+};
+
+/**
+ * Trigger evaluating threshold and slope conditions on a stream of scans.
+ * A scan fulfilling any condition triggers a capture, which lasts until
+ * post_window after the last triggering scan.
+ */
+struct trigger {
+     struct trigger_condition conditions[TRIGGER_MAX_CONDITIONS];
+     unsigned int condition_count;
+     /* Durations in ns to capture before and after a triggering scan */
+     uint64_t pre_window;
+     uint64_t post_window;
+
+     /* Previous value of each channel (0xffff if none yet) */
+     uint16_t previous[TRIGGER_MAX_CHANNELS];
+     bool capturing;
+     /* End of the current capture */
+     uint64_t tend;
+     /* Number of captures started */
+     uint64_t events;
+};
+
+/**
+ * Initialize a trigger from a list of conditions.
+ *
+ * @param t the trigger
+ * @param spec comma-separated conditions TYPE:CHANNEL:THRESHOLD with TYPE
+ * one of above, below, rise, fall (e.g., "above:0:1200,rise:0:100")
+ * @param channel_count number of channels of a scan
+ * @param pre_window duration in ns to capture before a triggering scan
+ * @param post_window duration in ns to capture after a triggering scan
+ * @return 0 on success; -1 if the conditions are invalid
+ */
+int trigger_init(struct trigger *t, const char *spec,
+		 unsigned int channel_count, uint64_t pre_window,
+		 uint64_t post_window);
+
+/**
+ * Evaluate the conditions on a scan and update the capture state.
+ *
+ * @param t the trigger
+ * @param timestamp timestamp of the scan
+ * @param values values of the scan (0xffff for channels not sampled)
+ * @return true if the scan is part of a capture
+ */
+bool trigger_check(struct trigger *t, uint64_t timestamp,
+		   const uint16_t *values);
+
+#endif